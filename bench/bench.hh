@@ -0,0 +1,160 @@
+/** \file
+ * Shared helpers for the benchmarks in `Kiseki.ThumbnailBench`.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "test_source.hh"
+#include "thumb.hh"
+
+/** Keep the compiler from discarding a result that is otherwise unused. */
+template<typename T> inline void bench_keep(const T &value) {
+  asm volatile("" : : "g"(&value) : "memory");
+}
+
+/**
+ * Best wall time of a single \a fn call in seconds. \a fn is repeated until
+ * at least \a min_seconds have passed, with a minimum of three runs.
+ */
+template<typename Fn> double bench_time(Fn &&fn, double min_seconds = 0.25) {
+  using clock = std::chrono::steady_clock;
+  fn();
+  double best = 1e30;
+  double total = 0.0;
+  for (int runs = 0; runs < 3 || total < min_seconds; runs++) {
+    clock::time_point start = clock::now();
+    fn();
+    double elapsed =
+        std::chrono::duration<double>(clock::now() - start).count();
+    best = elapsed < best ? elapsed : best;
+    total += elapsed;
+  }
+  return best;
+}
+
+/** Print one result; \a bytes is used for a throughput column when non-zero. */
+void bench_report(const char *suite, const char *name, double seconds,
+                  uint64_t bytes);
+
+/** Print a named counter next to the timings. */
+void bench_counter(const char *suite, const char *name, const char *counter,
+                   uint64_t value);
+
+/**
+ * Report a failed correctness check on stderr. The run goes on, but exits
+ * non-zero at the end, which is what CTest looks at.
+ */
+void bench_fail(const char *format, ...)
+    __attribute__((format(printf, 1, 2)));
+
+/** Whether #bench_fail was called. */
+bool bench_failed();
+
+/**
+ * Write every result printed so far to \a path as JSON, in the order they
+ * were printed. Names and ordering only depend on the suites and options
+ * given in \a argv, so files from two builds can be diffed line by line.
+ */
+bool bench_write_json(const char *path, int argc, char *argv[]);
+
+/** Deterministic place-like XML of \a size bytes, without the closing tag. */
+std::vector<uint8_t> bench_place_xml(size_t size, uint32_t seed = 1);
+
+/** A place of about \a xml_size bytes with \a trailer appended after the tag. */
+std::vector<uint8_t> bench_place_file(size_t xml_size,
+                                      const std::vector<uint8_t> &trailer);
+
+/**
+ * A binary place of \a chunk_count chunks of \a payload_size random
+ * (incompressible, so stored with a compressed length) bytes each, then the
+ * END chunk, the separating NUL and \a trailer.
+ */
+std::vector<uint8_t> bench_binary_place(size_t chunk_count, size_t payload_size,
+                                        const std::vector<uint8_t> &trailer);
+
+/**
+ * Stream the same place as #bench_place_file straight into the file at
+ * \a path, for places too large to build in memory.
+ */
+bool bench_place_write(const char *path, size_t xml_size,
+                       const std::vector<uint8_t> &trailer, uint32_t seed = 1);
+
+/**
+ * The synthetic places the "pipeline" suite generates, one for every
+ * combination. Set from the command line, see `bench_main.cc`.
+ */
+struct BenchCorpusOptions {
+  std::vector<size_t> xml_sizes;
+  /** Thumbnail width and height pairs. */
+  std::vector<int> dimensions;
+  std::vector<int> qualities;
+  /** 420 or 444. */
+  std::vector<int> subsamplings;
+  /** Read sizes for the stream extraction stage. */
+  std::vector<size_t> chunks;
+  /** Keep the generated places here instead of in a temporary directory. */
+  std::string output_dir;
+};
+
+extern BenchCorpusOptions bench_corpus_options;
+
+/**
+ * Heap allocations made so far, through `malloc` and friends as well as
+ * `operator new` where bench_alloc.cc can hook them. Reporting a result
+ * allocates as well, so take every reading before reporting any.
+ */
+uint64_t bench_alloc_count();
+uint64_t bench_alloc_bytes();
+
+#ifdef KISEKI_BENCH_HAVE_JPEG
+/**
+ * Synthetic "place screenshot" (sky gradient, ground, blocky parts and a
+ * little noise) encoded as a baseline, or \a progressive, JPEG with the
+ * system libjpeg.
+ */
+std::vector<uint8_t> bench_jpeg_encode(int width, int height, int quality = 85,
+                                       bool subsample_420 = true,
+                                       int restart_interval = 0,
+                                       bool progressive = false);
+
+/**
+ * Reference decode with the system libjpeg at 1/\a denominator scale, into
+ * the 4-byte aligned BGR rows the shell handler produces.
+ */
+bool bench_jpeg_decode_reference(const std::vector<uint8_t> &jpeg,
+                                 int denominator, Thumbnail *thumb);
+
+struct ThumbJpegInfo;
+
+/** The fields of #thumb_jpeg_probe, read with `jpeg_read_header`. */
+bool bench_jpeg_header_reference(const std::vector<uint8_t> &jpeg,
+                                 ThumbJpegInfo *r_info);
+#endif
+
+/* One entry point per `bench_*.cc` file. */
+void bench_arena();
+void bench_cache();
+void bench_decode();
+void bench_extract();
+void bench_fused();
+void bench_idct();
+void bench_ingest();
+void bench_manifest();
+void bench_mip();
+void bench_pack();
+void bench_pipeline();
+void bench_probe();
+void bench_resample();
+void bench_restart();
+void bench_scale();
+void bench_scan();
+void bench_setup();
+void bench_stats();
+void bench_stream();
+void bench_ycc();
@@ -0,0 +1,108 @@
+/** \file
+ * Allocator replacements that count heap traffic, so suites can report
+ * allocations per thumbnail.
+ *
+ * With glibc the `malloc` family itself is replaced, forwarding to the
+ * `__libc_` entry points, so allocations from C code and the C library are
+ * counted too; `operator new` goes through `malloc` and is counted there.
+ * Elsewhere, and under AddressSanitizer, which brings its own `malloc`, only
+ * the global `operator new` is.
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <new>
+
+#include "bench.hh"
+
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+#  define BENCH_HOOK_MALLOC 1
+#endif
+
+static std::atomic<uint64_t> alloc_count{0};
+static std::atomic<uint64_t> alloc_bytes{0};
+
+uint64_t bench_alloc_count() { return alloc_count.load(); }
+
+uint64_t bench_alloc_bytes() { return alloc_bytes.load(); }
+
+static inline void count_alloc(size_t size) {
+  alloc_count.fetch_add(1, std::memory_order_relaxed);
+  alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+#ifdef BENCH_HOOK_MALLOC
+
+extern "C" {
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *ptr);
+
+void *malloc(size_t size) {
+  count_alloc(size);
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+  count_alloc(count * size);
+  return __libc_calloc(count, size);
+}
+
+/* Counted like a new allocation, a growing realloc usually is one. */
+void *realloc(void *ptr, size_t size) {
+  if (size) {
+    count_alloc(size);
+  }
+  return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size) {
+  count_alloc(size);
+  return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+  return memalign(alignment, size);
+}
+
+int posix_memalign(void **r_ptr, size_t alignment, size_t size) {
+  if (alignment % sizeof(void *) || (alignment & (alignment - 1))) {
+    return EINVAL;
+  }
+  void *ptr = memalign(alignment, size);
+  if (!ptr) {
+    return ENOMEM;
+  }
+  *r_ptr = ptr;
+  return 0;
+}
+
+void free(void *ptr) { __libc_free(ptr); }
+
+}  // extern "C"
+
+#endif
+
+void *operator new(size_t size) {
+#ifndef BENCH_HOOK_MALLOC
+  count_alloc(size);
+#endif
+  if (void *ptr = malloc(size ? size : 1)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+
+void operator delete(void *ptr) noexcept { free(ptr); }
+
+void operator delete[](void *ptr) noexcept { free(ptr); }
+
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+
+void operator delete[](void *ptr, size_t) noexcept { free(ptr); }
@@ -0,0 +1,219 @@
+/** \file
+ * Heap traffic of whole thumbnail requests, taken through the same steps as
+ * GetThumbnail in thumb_win32.cc: find the trailer, try the on-disk cache,
+ * then the pyramid cache, and otherwise decode, building a pyramid when the
+ * JPEG is asked for again, before packing into a DIB-sized buffer. Every
+ * session of requests goes through all of those paths. After a few warm-up
+ * sessions the thread's context, the arena and the caches have grown to
+ * size, and every further request must get through without a single
+ * counted allocation, from `operator new` or the `malloc` family (see
+ * bench_alloc.cc); anything else fails the run. A "cold" request, on a
+ * fresh context like a new thread would get, is timed alongside for
+ * comparison.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+
+#include "bench.hh"
+#include "thumb_cache.hh"
+#include "thumb_jpeg.hh"
+#include "thumb_mip.hh"
+#include "thumb_pack.hh"
+#include "thumb_resample.hh"
+
+/**
+ * Sizes of one session: the first misses and takes the fused decode, the
+ * second misses again and builds the pyramid, the third is served from the
+ * pyramid and the last one from the disk cache.
+ */
+static const int session_sizes[] = {96, 256, 768, 256};
+static constexpr int session_length = 4;
+static constexpr int warmup_sessions = 3;
+static constexpr int counted_sessions = 25;
+
+/* Long enough for the comment marker, its length and a session number. */
+static constexpr size_t jpeg_comment_size = 12;
+
+namespace {
+
+/** What the handler keeps between requests. */
+struct ArenaHandler {
+  ThumbCache cache;
+  ThumbPyramidCache pyramids;
+};
+
+/** How the requests were served. */
+struct ArenaPaths {
+  uint64_t cache_hits = 0;
+  uint64_t pyramid_hits = 0;
+  uint64_t decodes = 0;
+  uint64_t builds = 0;
+};
+
+}  // namespace
+
+static bool request(ArenaHandler &handler, ThumbContext &context,
+                    const std::vector<uint8_t> &place, eTestSourceMode mode,
+                    int cx, std::vector<uint8_t> &dib, ArenaPaths &paths) {
+  TestSource source(place, mode);
+  ThumbTrailer trailer;
+  if (thumb_read_trailer(&source, context.buffer, &trailer) != THUMB_OK) {
+    return false;
+  }
+
+  Thumbnail &thumb = context.pixels;
+  const ThumbCacheKey key = thumb_cache_key(trailer, cx);
+  if (handler.cache.lookup(key, context.scratch, &thumb)) {
+    paths.cache_hits++;
+  } else if (std::shared_ptr<const ThumbPyramid> pyramid =
+                 handler.pyramids.lookup(key.hash, key.length);
+             pyramid && thumb_pyramid_fit(*pyramid, cx, &thumb)) {
+    paths.pyramid_hits++;
+    handler.cache.store(key, thumb, context.scratch);
+  } else {
+    const bool above_top = cx >= thumb_mip_top;
+    const bool build =
+        above_top || handler.pyramids.note_miss(key.hash, key.length);
+    const bool decode_top = build && !above_top;
+    const eThumbStatus status =
+        decode_top ? thumb_jpeg_decode(trailer.data, trailer.length,
+                                       thumb_mip_top, &thumb)
+                   : thumb_jpeg_decode_fit(trailer.data, trailer.length, cx,
+                                           &thumb);
+    if (status != THUMB_OK) {
+      return false;
+    }
+    paths.decodes++;
+    if (build) {
+      std::shared_ptr<ThumbPyramid> built = handler.pyramids.acquire();
+      thumb_pyramid_build(&thumb, built.get());
+      thumb_pyramid_fit(*built, cx, &thumb);
+      handler.pyramids.insert(key.hash, key.length, std::move(built));
+      paths.builds++;
+    }
+    handler.cache.store(key, thumb, context.scratch);
+  }
+
+  thumb_pack_bgra(thumb, dib.data(), thumb_bgra_stride(thumb.width));
+  return true;
+}
+
+/**
+ * Give the JPEG at the end of \a place a comment holding \a session, so every
+ * session is a JPEG neither cache has seen yet.
+ */
+static void set_session(std::vector<uint8_t> &place, size_t comment,
+                        int session) {
+  char number[9];
+  snprintf(number, sizeof(number), "%08x", unsigned(session));
+  memcpy(place.data() + comment + 4, number, 8);
+}
+
+static bool run_session(ArenaHandler &handler,
+                        std::vector<uint8_t> &place, size_t comment,
+                        int session, eTestSourceMode mode,
+                        std::vector<uint8_t> &dib, ArenaPaths &paths) {
+  set_session(place, comment, session);
+  bool ok = true;
+  for (int cx : session_sizes) {
+    ThumbContextLease context;
+    ok &= request(handler, *context, place, mode, cx, dib, paths);
+  }
+  return ok;
+}
+
+void bench_arena() {
+  char dir_template[] = "/tmp/kiseki-arena-XXXXXX";
+  if (!mkdtemp(dir_template)) {
+    perror(dir_template);
+    bench_fail("arena: no directory for the disk cache");
+    return;
+  }
+  const std::filesystem::path directory(dir_template);
+
+  /* A COM segment right after SOI, which the decoder skips. */
+  std::vector<uint8_t> jpeg = bench_jpeg_encode(1920, 1080);
+  const uint8_t comment_header[] = {0xFF, 0xFE, 0, jpeg_comment_size - 2};
+  jpeg.insert(jpeg.begin() + 2, jpeg_comment_size, '0');
+  memcpy(jpeg.data() + 2, comment_header, sizeof(comment_header));
+  std::vector<uint8_t> place = bench_place_file(1 << 20, jpeg);
+  const size_t comment = place.size() - jpeg.size() + 2;
+
+  int max_cx = 0;
+  for (int cx : session_sizes) {
+    max_cx = std::max(max_cx, cx);
+  }
+  std::vector<uint8_t> dib(thumb_bgra_stride(max_cx) * max_cx);
+
+  {
+    /* Room for one pyramid, so each build drops the previous one and the
+     * cache runs full, recycling them. */
+    ArenaHandler handler{ThumbCache(directory, uint64_t(1) << 30),
+                         ThumbPyramidCache(1)};
+    int session = 0;
+
+    for (eTestSourceMode mode : {TEST_SOURCE_FILE, TEST_SOURCE_PIPE}) {
+      const char *mode_name = mode == TEST_SOURCE_FILE ? "tail" : "sequential";
+      char name[64];
+      ArenaPaths paths;
+      bool ok = true;
+
+      for (int i = 0; i < warmup_sessions; i++) {
+        ok &= run_session(handler, place, comment, session++, mode, dib,
+                          paths);
+      }
+      paths = ArenaPaths();
+      const uint64_t allocs = bench_alloc_count();
+      const uint64_t alloc_bytes = bench_alloc_bytes();
+      for (int i = 0; i < counted_sessions; i++) {
+        ok &= run_session(handler, place, comment, session++, mode, dib,
+                          paths);
+      }
+      const uint64_t steady_allocs = bench_alloc_count() - allocs;
+      const uint64_t steady_bytes = bench_alloc_bytes() - alloc_bytes;
+
+      snprintf(name, sizeof(name), "steady/%s", mode_name);
+      static_assert(counted_sessions * session_length == 100,
+                    "the counters are per 100 requests");
+      bench_counter("arena", name, "allocations per 100", steady_allocs);
+      bench_counter("arena", name, "bytes allocated per 100", steady_bytes);
+      bench_counter("arena", name, "disk cache hits", paths.cache_hits);
+      bench_counter("arena", name, "pyramid hits", paths.pyramid_hits);
+      bench_counter("arena", name, "decodes", paths.decodes);
+      bench_counter("arena", name, "pyramid builds", paths.builds);
+      if (!ok) {
+        bench_fail("arena: %s: thumbnail request failed", name);
+      }
+      if (!paths.cache_hits || !paths.pyramid_hits || !paths.builds ||
+          paths.decodes == paths.builds) {
+        bench_fail("arena: %s: a path of the request was never taken", name);
+      }
+      if (steady_allocs) {
+        bench_fail("arena: %s: %llu heap allocations after warm-up", name,
+                   (unsigned long long)steady_allocs);
+      }
+
+      double seconds = bench_time([&] {
+        run_session(handler, place, comment, session++, mode, dib, paths);
+      });
+      snprintf(name, sizeof(name), "session/%s", mode_name);
+      bench_report("arena", name, seconds, 0);
+
+      /* A lease taken while the thread's context is leased gets a fresh
+       * private one. */
+      ThumbContextLease outer;
+      seconds = bench_time([&] {
+        run_session(handler, place, comment, session++, mode, dib, paths);
+      });
+      snprintf(name, sizeof(name), "cold/%s", mode_name);
+      bench_report("arena", name, seconds, 0);
+    }
+  }
+
+  std::error_code ec;
+  std::filesystem::remove_all(directory, ec);
+}
@@ -0,0 +1,89 @@
+/** \file
+ * The on-disk thumbnail cache: a hit (hashing the trailer, reading and
+ * decompressing the entry) against decoding and fitting the thumbnail from
+ * scratch, plus what a store costs and how eviction keeps the directory
+ * within its limit.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+
+#include "bench.hh"
+#include "thumb_cache.hh"
+#include "thumb_hash.hh"
+#include "thumb_jpeg.hh"
+#include "thumb_resample.hh"
+
+void bench_cache() {
+  char dir_template[] = "/tmp/kiseki-cache-XXXXXX";
+  if (!mkdtemp(dir_template)) {
+    perror(dir_template);
+    return;
+  }
+  const std::filesystem::path directory(dir_template);
+
+  std::vector<uint8_t> jpeg = bench_jpeg_encode(1920, 1080);
+  ThumbTrailer trailer = {jpeg.data(), jpeg.size(), 0};
+  ThumbBuffer scratch;
+  Thumbnail thumb, cached;
+  char name[64];
+
+  double seconds = bench_time([&] {
+    bench_keep(thumb_hash64(jpeg.data(), jpeg.size()));
+  });
+  bench_report("cache", "hash/1920x1080-jpeg", seconds, jpeg.size());
+
+  for (int cx : {96, 256, 768}) {
+    ThumbCache cache(directory, uint64_t(1) << 30);
+    ThumbCacheKey key = thumb_cache_key(trailer, cx);
+
+    seconds = bench_time([&] {
+      thumb_jpeg_decode(jpeg.data(), jpeg.size(), cx, &thumb);
+      thumb_fit_to(&thumb, cx);
+    });
+    snprintf(name, sizeof(name), "decode/cx%d", cx);
+    bench_report("cache", name, seconds, 0);
+
+    seconds = bench_time([&] { cache.store(key, thumb, scratch); });
+    snprintf(name, sizeof(name), "store/cx%d", cx);
+    bench_report("cache", name, seconds, 0);
+
+    seconds = bench_time([&] {
+      ThumbCacheKey lookup_key = thumb_cache_key(trailer, cx);
+      if (!cache.lookup(lookup_key, scratch, &cached)) {
+        bench_fail("cache: miss on a stored entry");
+      }
+    });
+    snprintf(name, sizeof(name), "hit/cx%d", cx);
+    bench_report("cache", name, seconds, 0);
+
+    if (cached.data != thumb.data) {
+      bench_fail("cache: entry doesn't round trip");
+    }
+    bench_counter("cache", name, "raw bytes", thumb.data.size());
+    bench_counter("cache", name, "entry bytes", cache.size_bytes());
+  }
+
+  /* Fill a small cache with many distinct keys. */
+  {
+    const uint64_t limit = 1 << 20;
+    ThumbCache cache(directory / "evict", limit);
+    thumb_jpeg_decode(jpeg.data(), jpeg.size(), 256, &thumb);
+    thumb_fit_to(&thumb, 256);
+    for (int i = 0; i < 200; i++) {
+      ThumbCacheKey key = {uint64_t(i) * 0x9E3779B97F4A7C15ull, jpeg.size(),
+                           256};
+      cache.store(key, thumb, scratch);
+    }
+    uint64_t on_disk = 0;
+    for (const auto &entry :
+         std::filesystem::directory_iterator(directory / "evict")) {
+      on_disk += entry.file_size();
+    }
+    bench_counter("cache", "evict/200-stores", "limit bytes", limit);
+    bench_counter("cache", "evict/200-stores", "bytes on disk", on_disk);
+  }
+
+  std::filesystem::remove_all(directory);
+}
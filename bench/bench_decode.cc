@@ -0,0 +1,148 @@
+/** \file
+ * The built-in baseline decoder against the system libjpeg, at full size and
+ * at the scale a 256 pixel thumbnail is decoded at.
+ *
+ * The corpus is a set of synthetic trailers plus, when `KISEKI_BENCH_CORPUS`
+ * names a directory, every place (`.rbxl`) and JPEG (`.jpg`) in it. The
+ * pixel difference to the reference is reported next to the timings; chroma
+ * upsampling differs between the two, so subsampled images don't match
+ * exactly. A trailer cut short must be left to the platform decoder.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <dirent.h>
+
+#include "bench.hh"
+#include "thumb_jpeg.hh"
+#include "thumb_resample.hh"
+
+namespace {
+
+struct CorpusEntry {
+  std::string name;
+  std::vector<uint8_t> jpeg;
+};
+
+}  // namespace
+
+static bool has_suffix(const std::string &name, const char *suffix) {
+  size_t len = strlen(suffix);
+  return name.size() >= len &&
+         strcasecmp(name.c_str() + name.size() - len, suffix) == 0;
+}
+
+static bool load_trailer(const std::string &path,
+                         std::vector<uint8_t> *r_jpeg) {
+  std::unique_ptr<ThumbSource> source = thumb_source_open_file(path.c_str());
+  if (!source) {
+    return false;
+  }
+  if (has_suffix(path, ".jpg") || has_suffix(path, ".jpeg")) {
+    r_jpeg->resize(size_t(source->size()));
+    return source->read_at(0, r_jpeg->data(), r_jpeg->size()) ==
+           int64_t(r_jpeg->size());
+  }
+  ThumbBuffer buffer;
+  ThumbTrailer trailer;
+  if (thumb_read_trailer(source.get(), buffer, &trailer) != THUMB_OK) {
+    return false;
+  }
+  r_jpeg->assign(trailer.data, trailer.data + trailer.length);
+  return true;
+}
+
+static void load_corpus(std::vector<CorpusEntry> &corpus) {
+  const char *dir_path = getenv("KISEKI_BENCH_CORPUS");
+  DIR *dir = dir_path ? opendir(dir_path) : nullptr;
+  if (!dir) {
+    return;
+  }
+  while (dirent *entry = readdir(dir)) {
+    std::string name = entry->d_name;
+    if (!has_suffix(name, ".rbxl") && !has_suffix(name, ".jpg") &&
+        !has_suffix(name, ".jpeg")) {
+      continue;
+    }
+    CorpusEntry item;
+    item.name = name;
+    if (load_trailer(std::string(dir_path) + "/" + name, &item.jpeg)) {
+      corpus.push_back(std::move(item));
+    }
+  }
+  closedir(dir);
+}
+
+static void report_difference(const char *name, const Thumbnail &a,
+                              const Thumbnail &b) {
+  if (a.width != b.width || a.height != b.height) {
+    bench_counter("decode", name, "size-mismatch", 1);
+    return;
+  }
+  const size_t stride = thumb_bgr_stride(a.width);
+  uint64_t total = 0;
+  int largest = 0;
+  for (int y = 0; y < a.height; y++) {
+    const uint8_t *pa = a.data.data() + y * stride;
+    const uint8_t *pb = b.data.data() + y * stride;
+    for (int x = 0; x < a.width * 3; x++) {
+      int diff = abs(pa[x] - pb[x]);
+      total += diff;
+      largest = diff > largest ? diff : largest;
+    }
+  }
+  uint64_t samples = uint64_t(a.width) * a.height * 3;
+  bench_counter("decode", name, "max-diff", largest);
+  bench_counter("decode", name, "mean-diff-x100", total * 100 / samples);
+}
+
+void bench_decode() {
+  std::vector<CorpusEntry> corpus = {
+      {"640x360", bench_jpeg_encode(640, 360)},
+      {"1280x720", bench_jpeg_encode(1280, 720)},
+      {"1920x1080", bench_jpeg_encode(1920, 1080)},
+      {"1920x1080-444", bench_jpeg_encode(1920, 1080, 85, false)},
+      {"1920x1080-rst", bench_jpeg_encode(1920, 1080, 85, true, 8)},
+  };
+  load_corpus(corpus);
+
+  Thumbnail ours, reference;
+  char name[96];
+  for (const CorpusEntry &entry : corpus) {
+    const uint8_t *data = entry.jpeg.data();
+    const size_t len = entry.jpeg.size();
+    if (thumb_jpeg_decode(data, len, 0, &ours) != THUMB_OK) {
+      bench_counter("decode", entry.name.c_str(), "unsupported", 1);
+      continue;
+    }
+    const int width = ours.width, height = ours.height;
+
+    for (int cx : {0, 256}) {
+      int denominator = cx ? thumb_scale_denominator(width, height, cx) : 1;
+      snprintf(name, sizeof(name), "%s/1:%d", entry.name.c_str(), denominator);
+      std::string label = name;
+
+      double seconds = bench_time([&] {
+        bench_jpeg_decode_reference(entry.jpeg, denominator, &reference);
+      });
+      bench_report("decode", (label + "/libjpeg").c_str(), seconds, len);
+      seconds = bench_time([&] { thumb_jpeg_decode(data, len, cx, &ours); });
+      bench_report("decode", (label + "/builtin").c_str(), seconds, len);
+      report_difference(name, ours, reference);
+    }
+  }
+
+  /* A scan cut short is left to the platform decoder, which shows the part
+   * that is there. */
+  std::vector<uint8_t> cut = bench_jpeg_encode(1280, 720);
+  cut.resize(cut.size() / 2);
+  if (thumb_jpeg_decode(cut.data(), cut.size(), 0, &ours) !=
+          THUMB_UNSUPPORTED ||
+      thumb_jpeg_decode_fit(cut.data(), cut.size(), 100, &ours) !=
+          THUMB_UNSUPPORTED) {
+    bench_fail("decode: truncated scan not left to the platform decoder");
+  }
+}
@@ -0,0 +1,107 @@
+/** \file
+ * Trailer extraction cost: time, heap traffic and bytes buffered per call of
+ * #thumb_read_trailer. The JPEG must be handed out as a view into the
+ * ingestion buffer (or the mapping), so anything allocated or copied beyond
+ * that shows up here. Every source must find the JPEG appended to the place.
+ *
+ * Binary places are run at the same size with few large and many small
+ * chunks; only the chunk headers are read, so the read calls follow the
+ * chunk count and not the size.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "bench.hh"
+
+static bool write_temp_place(const std::vector<uint8_t> &place, char *path) {
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = write(fd, place.data(), place.size()) == ssize_t(place.size());
+  close(fd);
+  return ok;
+}
+
+/** Time \a make_source plus extraction; \a trailer ends \a place. */
+template<typename MakeSource>
+static void measure(const char *name, const std::vector<uint8_t> &place,
+                    const std::vector<uint8_t> &trailer,
+                    MakeSource &&make_source) {
+  ThumbBuffer buffer;
+  ThumbTrailer found = {};
+  double seconds = bench_time([&] {
+    std::unique_ptr<ThumbSource> source = make_source();
+    thumb_read_trailer(source.get(), buffer, &found);
+    bench_keep(found);
+  });
+  bench_report("extract", name, seconds, 0);
+
+  std::unique_ptr<ThumbSource> source = make_source();
+  uint64_t allocs = bench_alloc_count();
+  uint64_t alloc_bytes = bench_alloc_bytes();
+  eThumbStatus status = thumb_read_trailer(source.get(), buffer, &found);
+  /* Both read before anything is reported, which allocates itself. */
+  allocs = bench_alloc_count() - allocs;
+  alloc_bytes = bench_alloc_bytes() - alloc_bytes;
+  if (status != THUMB_OK || found.length != trailer.size() ||
+      found.file_offset != place.size() - trailer.size() ||
+      memcmp(found.data, trailer.data(), trailer.size()) != 0) {
+    bench_fail("%s: wrong trailer", name);
+  }
+  bench_counter("extract", name, "allocations", allocs);
+  bench_counter("extract", name, "bytes allocated", alloc_bytes);
+  bench_counter("extract", name, "bytes buffered", buffer.size());
+  if (TestSource *memory = dynamic_cast<TestSource *>(source.get())) {
+    bench_counter("extract", name, "read calls", memory->read_calls);
+  }
+}
+
+void bench_extract() {
+  std::vector<uint8_t> trailer(200 * 1024, 0x5a);
+  trailer[0] = 0xff;
+  trailer[1] = 0xd8;
+
+  for (size_t xml_size : {size_t(1) << 20, size_t(64) << 20}) {
+    std::vector<uint8_t> place = bench_place_file(xml_size, trailer);
+    char name[64];
+
+    for (eTestSourceMode mode : {TEST_SOURCE_FILE, TEST_SOURCE_PIPE}) {
+      snprintf(name, sizeof(name), "%s/%zuMB",
+               mode == TEST_SOURCE_FILE ? "tail" : "sequential",
+               xml_size >> 20);
+      measure(name, place, trailer, [&] {
+        return std::make_unique<TestSource>(place, mode);
+      });
+    }
+
+    char path[] = "/tmp/kiseki-bench-XXXXXX";
+    if (!write_temp_place(place, path)) {
+      perror(path);
+      continue;
+    }
+    snprintf(name, sizeof(name), "mapped/%zuMB", xml_size >> 20);
+    measure(name, place, trailer, [&] { return thumb_source_map_file(path); });
+    snprintf(name, sizeof(name), "pread/%zuMB", xml_size >> 20);
+    measure(name, place, trailer, [&] { return thumb_source_open_file(path); });
+    unlink(path);
+  }
+
+  /* 64MB of payload either way. */
+  for (size_t chunk_count : {size_t(256), size_t(16384)}) {
+    std::vector<uint8_t> place = bench_binary_place(
+        chunk_count, (size_t(64) << 20) / chunk_count, trailer);
+    char name[64];
+    for (eTestSourceMode mode : {TEST_SOURCE_FILE, TEST_SOURCE_PIPE}) {
+      snprintf(name, sizeof(name), "binary/%s/%zu-chunks",
+               mode == TEST_SOURCE_FILE ? "tail" : "sequential",
+               chunk_count);
+      measure(name, place, trailer, [&] {
+        return std::make_unique<TestSource>(place, mode);
+      });
+    }
+  }
+}
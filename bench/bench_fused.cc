@@ -0,0 +1,101 @@
+/** \file
+ * Decoding straight to cx against decoding and then scaling: 1080p, 1440p
+ * and 4K captures fitted to a large and a shell-sized thumbnail, the
+ * stage-by-stage #thumb_jpeg_decode and #thumb_fit_to next to the fused
+ * #thumb_jpeg_decode_fit. Besides the time, each path reports the memory it
+ * writes on the way: the largest image it produces and the scratch the
+ * arena had to grow to, both from a fresh context. The outputs have to be
+ * the same pixel for pixel.
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include "bench.hh"
+#include "thumb_jpeg.hh"
+#include "thumb_resample.hh"
+
+static bool same_pixels(const Thumbnail &a, const Thumbnail &b) {
+  if (a.width != b.width || a.height != b.height) {
+    return false;
+  }
+  /* Row padding is left uninitialized. */
+  const size_t stride = thumb_bgr_stride(a.width);
+  for (int y = 0; y < a.height; y++) {
+    if (memcmp(a.data.data() + y * stride, b.data.data() + y * stride,
+               size_t(a.width) * 3) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void bench_fused() {
+  const struct {
+    const char *name;
+    int width, height;
+    bool subsample_420;
+  } sizes[] = {{"1920x1080", 1920, 1080, true},
+               {"1920x1080-444", 1920, 1080, false},
+               {"2560x1440", 2560, 1440, true},
+               {"3840x2160", 3840, 2160, true}};
+  const int fit_sizes[] = {1024, 256};
+  char name[64];
+
+  for (const auto &size : sizes) {
+    const std::vector<uint8_t> jpeg = bench_jpeg_encode(
+        size.width, size.height, 85, size.subsample_420);
+
+    for (int cx : fit_sizes) {
+      auto decode = [&](bool is_fused, Thumbnail *thumb) {
+        if (is_fused) {
+          return thumb_jpeg_decode_fit(jpeg.data(), jpeg.size(), cx, thumb) ==
+                 THUMB_OK;
+        }
+        if (thumb_jpeg_decode(jpeg.data(), jpeg.size(), cx, thumb) !=
+            THUMB_OK) {
+          return false;
+        }
+        thumb_fit_to(thumb, cx);
+        return true;
+      };
+
+      Thumbnail reference;
+      double staged_seconds = 0.0;
+      for (bool is_fused : {false, true}) {
+        snprintf(name, sizeof(name), "%s/cx%d/%s", size.name, cx,
+                 is_fused ? "fused" : "staged");
+
+        /* A lease taken while the thread's context is leased gets a fresh
+         * private one, whose arena grows to exactly what the path needs. */
+        ThumbContextLease outer;
+        {
+          ThumbContextLease context;
+          if (!decode(is_fused, &context->pixels)) {
+            bench_fail("%s: decode failed", name);
+            continue;
+          }
+          bench_counter("fused", name, "image bytes",
+                        context->pixels.data.capacity());
+          bench_counter("fused", name, "scratch bytes",
+                        context->arena.capacity());
+          if (reference.data.empty()) {
+            reference = context->pixels;
+          } else if (!same_pixels(context->pixels, reference)) {
+            bench_fail("%s: output differs from the staged one", name);
+          }
+        }
+
+        Thumbnail thumb;
+        const double seconds = bench_time([&] { decode(is_fused, &thumb); });
+        bench_report("fused", name, seconds, 0);
+        if (!is_fused) {
+          staged_seconds = seconds;
+        } else {
+          bench_counter("fused", name, "speedup-x100",
+                        uint64_t(staged_seconds / seconds * 100.0 + 0.5));
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,111 @@
+/** \file
+ * The 8x8 inverse DCT from `thumb_idct.hh` per kernel level, on blocks
+ * shaped like real ones and on the extremes of the coefficient range the
+ * decoder lets through, one block at a time and in the pairs the decoder
+ * uses for 4:2:x luma. Throughput counts the samples written. Every level
+ * is checked byte for byte against the scalar kernel.
+ */
+
+#include <cstdio>
+
+#include "bench.hh"
+#include "thumb_cpu.hh"
+#include "thumb_idct.hh"
+
+static constexpr int blocks = 4096;
+
+/** Coefficients within the +-4095 the decoder clamps to. */
+static int16_t clamp_coef(int value) {
+  return int16_t(value < -4095 ? -4095 : (value > 4095 ? 4095 : value));
+}
+
+void bench_idct() {
+  enum { DC_ONLY, TYPICAL, RANDOM, EXTREME };
+  static const struct {
+    int kind;
+    const char *name;
+  } inputs[] = {{DC_ONLY, "dc-only"},
+                {TYPICAL, "typical"},
+                {RANDOM, "random"},
+                {EXTREME, "extreme"}};
+  static const struct {
+    eThumbSimdLevel level;
+    const char *name;
+  } levels[] = {{THUMB_SIMD_SCALAR, "scalar"},
+                {THUMB_SIMD_SSE2, "sse2"},
+                {THUMB_SIMD_AVX2, "avx2"}};
+
+  for (const auto &input : inputs) {
+    std::vector<int16_t> coef(size_t(blocks) * 64, 0);
+    uint32_t noise = 1;
+    auto next = [&] {
+      noise = noise * 1664525u + 1013904223u;
+      return noise >> 8;
+    };
+    for (int i = 0; i < blocks; i++) {
+      int16_t *block = coef.data() + i * 64;
+      for (int k = 0; k < 64; k++) {
+        const int u = k % 8, v = k / 8;
+        switch (input.kind) {
+        case DC_ONLY:
+          block[k] = k ? 0 : clamp_coef(int(next() % 2048) - 1024);
+          break;
+        case TYPICAL:
+          /* Quantized detail falling off with frequency, mostly zeros
+           * past the first few. */
+          if (k == 0) {
+            block[k] = clamp_coef(int(next() % 2048) - 1024);
+          } else if (u + v < 6 && next() % 3 == 0) {
+            block[k] = clamp_coef((int(next() % 513) - 256) / (u + v));
+          }
+          break;
+        case RANDOM:
+          block[k] = clamp_coef(int(next() % 8191) - 4095);
+          break;
+        case EXTREME:
+          /* Saturated patterns, for the ranges and the scalar fallback. */
+          block[k] = ((u ^ v ^ i) & 1) ? 4095 : -4095;
+          break;
+        }
+      }
+    }
+
+    std::vector<uint8_t> reference, pair_reference;
+    std::vector<uint8_t> out(size_t(blocks) * 64);
+    for (const auto &level : levels) {
+      thumb_simd_set_cap(level.level);
+      const ThumbIdctFn idct = thumb_idct(8);
+      double seconds = bench_time([&] {
+        for (int i = 0; i < blocks; i++) {
+          idct(coef.data() + i * 64, out.data() + i * 64, 8);
+        }
+        bench_keep(out[0]);
+      });
+      char name[64];
+      snprintf(name, sizeof(name), "8x8/%s/%s", input.name, level.name);
+      bench_report("idct", name, seconds, out.size());
+      if (reference.empty()) {
+        reference = out;
+      } else if (out != reference) {
+        bench_fail("%s: output differs from the scalar kernel", name);
+      }
+
+      /* Pairs land side by side in 16 byte rows. */
+      const ThumbIdctFn idct_pair = thumb_idct_pair(8);
+      seconds = bench_time([&] {
+        for (int i = 0; i < blocks; i += 2) {
+          idct_pair(coef.data() + i * 64, out.data() + i * 64, 16);
+        }
+        bench_keep(out[0]);
+      });
+      snprintf(name, sizeof(name), "8x8-pair/%s/%s", input.name, level.name);
+      bench_report("idct", name, seconds, out.size());
+      if (pair_reference.empty()) {
+        pair_reference = out;
+      } else if (out != pair_reference) {
+        bench_fail("%s: output differs from the scalar kernel", name);
+      }
+    }
+  }
+  thumb_simd_set_cap(THUMB_SIMD_AVX2);
+}
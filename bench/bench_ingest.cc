@@ -0,0 +1,62 @@
+/** \file
+ * Reading a whole sequential stream: the original 4 KB `Read` +
+ * `vector::insert` loop from `GetThumbnail` against the large block,
+ * streaming ingestion behind #thumb_read_trailer.
+ */
+
+#include <cstdio>
+
+#include "bench.hh"
+
+/** The read loop `GetThumbnail` used before the extraction core existed. */
+static void ingest_4k_insert(ThumbSource *source, std::vector<char> &buffer) {
+  buffer.clear();
+  char chunk[4096];
+  int64_t n;
+  do {
+    n = source->read(chunk, sizeof(chunk));
+    if (n > 0) {
+      buffer.insert(buffer.end(), chunk, chunk + n);
+    }
+  } while (n > 0);
+}
+
+void bench_ingest() {
+  std::vector<uint8_t> trailer(200 * 1024, 0x5a);
+
+  for (size_t xml_size : {size_t(8) << 20, size_t(256) << 20}) {
+    std::vector<uint8_t> place = bench_place_file(xml_size, trailer);
+    char name[64];
+
+    auto run = [&](const char *label, auto &&ingest) {
+      snprintf(name, sizeof(name), "%s/%zuMB", label, xml_size >> 20);
+      double seconds = bench_time([&] { ingest(); });
+      bench_report("ingest", name, seconds, place.size());
+
+      uint64_t allocs = bench_alloc_count();
+      uint64_t calls = ingest();
+      allocs = bench_alloc_count() - allocs;
+      bench_counter("ingest", name, "read calls", calls);
+      bench_counter("ingest", name, "allocations", allocs);
+    };
+
+    /* Both variants start from an empty buffer, as a fresh call would. */
+    run("4k-insert", [&] {
+      TestSource source(place, TEST_SOURCE_PIPE);
+      std::vector<char> buffer;
+      ingest_4k_insert(&source, buffer);
+      bench_keep(buffer.data());
+      return source.read_calls;
+    });
+    for (eTestSourceMode mode : {TEST_SOURCE_SIZED_STREAM, TEST_SOURCE_PIPE}) {
+      run(mode == TEST_SOURCE_PIPE ? "blocks-unsized" : "blocks-sized", [&] {
+        TestSource source(place, mode);
+        ThumbBuffer buffer;
+        ThumbTrailer found;
+        thumb_read_trailer(&source, buffer, &found);
+        bench_keep(found);
+        return source.read_calls;
+      });
+    }
+  }
+}
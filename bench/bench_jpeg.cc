@@ -0,0 +1,145 @@
+/** \file
+ * JPEG encoding and reference decoding through the system libjpeg, used to
+ * build benchmark inputs and baselines.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#include <jpeglib.h>
+
+#include "bench.hh"
+#include "thumb_jpeg.hh"
+
+static void fill_scene(std::vector<uint8_t> &rgb, int width, int height) {
+  uint32_t noise = 12345;
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      uint8_t *px = &rgb[(size_t(y) * width + x) * 3];
+      int horizon = height * 3 / 5;
+      if (y < horizon) {
+        px[0] = uint8_t(90 + 80 * y / horizon);
+        px[1] = uint8_t(150 + 60 * y / horizon);
+        px[2] = 235;
+      } else {
+        px[0] = 60;
+        px[1] = uint8_t(140 - 40 * (y - horizon) / (height - horizon));
+        px[2] = 50;
+      }
+      /* A grid of "parts" with flat colors and hard edges. */
+      int cell = width / 12 + 1;
+      int cx = x / cell, cy = y / cell;
+      if ((cx * 7 + cy * 3) % 5 == 0 && (x % cell) > cell / 6 &&
+          (y % cell) > cell / 4) {
+        px[0] = uint8_t(40 * cx);
+        px[1] = uint8_t(200 - 15 * cy);
+        px[2] = uint8_t(30 * (cx + cy));
+      }
+      noise = noise * 1103515245u + 12345u;
+      int n = int((noise >> 16) & 3) - 2;
+      for (int c = 0; c < 3; c++) {
+        int v = px[c] + n;
+        px[c] = uint8_t(v < 0 ? 0 : v > 255 ? 255 : v);
+      }
+    }
+  }
+}
+
+std::vector<uint8_t> bench_jpeg_encode(int width, int height, int quality,
+                                       bool subsample_420,
+                                       int restart_interval,
+                                       bool progressive) {
+  std::vector<uint8_t> rgb(size_t(width) * height * 3);
+  fill_scene(rgb, width, height);
+
+  jpeg_compress_struct cinfo;
+  jpeg_error_mgr jerr;
+  cinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_compress(&cinfo);
+
+  unsigned char *out = nullptr;
+  unsigned long out_size = 0;
+  jpeg_mem_dest(&cinfo, &out, &out_size);
+  cinfo.image_width = width;
+  cinfo.image_height = height;
+  cinfo.input_components = 3;
+  cinfo.in_color_space = JCS_RGB;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, quality, TRUE);
+  cinfo.comp_info[0].h_samp_factor = subsample_420 ? 2 : 1;
+  cinfo.comp_info[0].v_samp_factor = subsample_420 ? 2 : 1;
+  cinfo.restart_interval = restart_interval;
+  if (progressive) {
+    jpeg_simple_progression(&cinfo);
+  }
+
+  jpeg_start_compress(&cinfo, TRUE);
+  while (cinfo.next_scanline < cinfo.image_height) {
+    JSAMPROW row = &rgb[size_t(cinfo.next_scanline) * width * 3];
+    jpeg_write_scanlines(&cinfo, &row, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+
+  std::vector<uint8_t> jpeg(out, out + out_size);
+  free(out);
+  return jpeg;
+}
+
+bool bench_jpeg_decode_reference(const std::vector<uint8_t> &jpeg,
+                                 int denominator, Thumbnail *thumb) {
+  jpeg_decompress_struct cinfo;
+  jpeg_error_mgr jerr;
+  cinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_decompress(&cinfo);
+  jpeg_mem_src(&cinfo, jpeg.data(), jpeg.size());
+  if (jpeg_read_header(&cinfo, TRUE) != JPEG_HEADER_OK) {
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = denominator;
+  cinfo.out_color_space = JCS_EXT_BGR;
+  jpeg_start_decompress(&cinfo);
+
+  size_t stride = (cinfo.output_width * 3 + 3) & ~3u;
+  thumb->width = int(cinfo.output_width);
+  thumb->height = int(cinfo.output_height);
+  thumb->data.resize(stride * cinfo.output_height);
+  while (cinfo.output_scanline < cinfo.output_height) {
+    JSAMPROW row = &thumb->data[stride * cinfo.output_scanline];
+    jpeg_read_scanlines(&cinfo, &row, 1);
+  }
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+  return true;
+}
+
+bool bench_jpeg_header_reference(const std::vector<uint8_t> &jpeg,
+                                 ThumbJpegInfo *r_info) {
+  jpeg_decompress_struct cinfo;
+  jpeg_error_mgr jerr;
+  cinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_decompress(&cinfo);
+  jpeg_mem_src(&cinfo, jpeg.data(), jpeg.size());
+  const bool ok = jpeg_read_header(&cinfo, TRUE) == JPEG_HEADER_OK;
+  if (ok) {
+    r_info->width = int(cinfo.image_width);
+    r_info->height = int(cinfo.image_height);
+    r_info->components = cinfo.num_components;
+    r_info->precision = cinfo.data_precision;
+    r_info->subsample_x = r_info->subsample_y = 1;
+    for (int i = 0; i < cinfo.num_components; i++) {
+      const jpeg_component_info &comp = cinfo.comp_info[i];
+      r_info->subsample_x = std::max(
+          r_info->subsample_x, cinfo.max_h_samp_factor / comp.h_samp_factor);
+      r_info->subsample_y = std::max(
+          r_info->subsample_y, cinfo.max_v_samp_factor / comp.v_samp_factor);
+    }
+    r_info->progressive = cinfo.progressive_mode;
+    r_info->arithmetic = cinfo.arith_code;
+  }
+  jpeg_destroy_decompress(&cinfo);
+  return ok;
+}
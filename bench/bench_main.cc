@@ -0,0 +1,218 @@
+/** \file
+ * `Kiseki.ThumbnailBench [options] [suite...]` runs the named suites, or all
+ * of them. Suites check their results as they go, and the run exits
+ * non-zero if any check failed.
+ *
+ * Options shape the places generated for the "pipeline" suite; each takes a
+ * comma separated list and every combination is run. Sizes accept K, M and G
+ * suffixes.
+ *
+ *   --xml-size=1M,64M       XML before the closing tag, up to a few GB
+ *   --size=1280x720,...     thumbnail dimensions
+ *   --quality=85            JPEG quality
+ *   --subsampling=420,444   chroma subsampling
+ *   --chunk=4K,64K          read size for the stream extraction stage
+ *   --corpus-out=DIR        keep the generated places in DIR
+ *   --json=FILE             also write all results to FILE
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "bench.hh"
+
+struct BenchSuite {
+  const char *name;
+  void (*run)();
+};
+
+static const BenchSuite suites[] = {
+#ifdef KISEKI_BENCH_HAVE_JPEG
+    {"arena", bench_arena},
+    {"cache", bench_cache},
+    {"decode", bench_decode},
+#endif
+    {"extract", bench_extract},
+#ifdef KISEKI_BENCH_HAVE_JPEG
+    {"fused", bench_fused},
+#endif
+    {"idct", bench_idct},
+    {"ingest", bench_ingest},
+    {"manifest", bench_manifest},
+#ifdef KISEKI_BENCH_HAVE_JPEG
+    {"mip", bench_mip},
+#endif
+    {"pack", bench_pack},
+#ifdef KISEKI_BENCH_HAVE_JPEG
+    {"pipeline", bench_pipeline},
+    {"probe", bench_probe},
+#endif
+    {"resample", bench_resample},
+#ifdef KISEKI_BENCH_HAVE_JPEG
+    {"restart", bench_restart},
+    {"scale", bench_scale},
+#endif
+    {"scan", bench_scan},
+    {"setup", bench_setup},
+    {"stats", bench_stats},
+    {"stream", bench_stream},
+    {"ycc", bench_ycc},
+};
+
+BenchCorpusOptions bench_corpus_options = {
+    {size_t(1) << 20, size_t(64) << 20},
+    {1280, 720, 1920, 1080},
+    {85},
+    {420},
+    {size_t(64) << 10},
+    "",
+};
+
+/** Parse "64", "64K", "64M" or "2G". */
+static bool parse_size(const char *text, size_t *r_size) {
+  char *end;
+  unsigned long long value = strtoull(text, &end, 10);
+  switch (*end) {
+  case 'G':
+    value <<= 10;
+    [[fallthrough]];
+  case 'M':
+    value <<= 10;
+    [[fallthrough]];
+  case 'K':
+    value <<= 10;
+    end++;
+    break;
+  }
+  *r_size = size_t(value);
+  return end != text && *end == '\0';
+}
+
+/** Parse a comma separated list, calling \a parse_item on every element. */
+template<typename Fn> static bool parse_list(const char *text, Fn &&parse_item) {
+  std::string list = text;
+  size_t start = 0;
+  for (;;) {
+    size_t comma = list.find(',', start);
+    std::string item = list.substr(start, comma - start);
+    if (!parse_item(item.c_str())) {
+      return false;
+    }
+    if (comma == std::string::npos) {
+      return true;
+    }
+    start = comma + 1;
+  }
+}
+
+static bool parse_option(const char *arg) {
+  BenchCorpusOptions &options = bench_corpus_options;
+  const char *value = strchr(arg, '=');
+  if (!value) {
+    return false;
+  }
+  const std::string key(arg, value++);
+  auto parse_int = [](const char *text, int *r_value) {
+    char *end;
+    *r_value = int(strtol(text, &end, 10));
+    return end != text && *end == '\0' && *r_value > 0;
+  };
+
+  if (key == "--xml-size" || key == "--chunk") {
+    std::vector<size_t> &list =
+        key == "--chunk" ? options.chunks : options.xml_sizes;
+    list.clear();
+    return parse_list(value, [&](const char *item) {
+      size_t size;
+      if (!parse_size(item, &size) || size == 0) {
+        return false;
+      }
+      list.push_back(size);
+      return true;
+    });
+  }
+  if (key == "--size") {
+    options.dimensions.clear();
+    return parse_list(value, [&](const char *item) {
+      int width, height;
+      char tail;
+      if (sscanf(item, "%dx%d%c", &width, &height, &tail) != 2 || width <= 0 ||
+          height <= 0) {
+        return false;
+      }
+      options.dimensions.push_back(width);
+      options.dimensions.push_back(height);
+      return true;
+    });
+  }
+  if (key == "--quality" || key == "--subsampling") {
+    std::vector<int> &list =
+        key == "--quality" ? options.qualities : options.subsamplings;
+    list.clear();
+    return parse_list(value, [&](const char *item) {
+      int number;
+      if (!parse_int(item, &number) ||
+          (key == "--quality" ? number > 100
+                              : number != 420 && number != 444)) {
+        return false;
+      }
+      list.push_back(number);
+      return true;
+    });
+  }
+  if (key == "--corpus-out") {
+    options.output_dir = value;
+    return true;
+  }
+  return false;
+}
+
+static void usage(const char *program) {
+  fprintf(stderr, "Usage: %s [options] [suite...]\nSuites:", program);
+  for (const BenchSuite &suite : suites) {
+    fprintf(stderr, " %s", suite.name);
+  }
+  fprintf(stderr,
+          "\nOptions: --xml-size= --size= --quality= --subsampling= "
+          "--chunk= --corpus-out= --json=\n");
+}
+
+int main(int argc, char *argv[]) {
+  const char *json_path = nullptr;
+  std::vector<const char *> selected;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--json=", 7) == 0) {
+      json_path = argv[i] + 7;
+    } else if (strncmp(argv[i], "--", 2) == 0) {
+      if (!parse_option(argv[i])) {
+        fprintf(stderr, "Invalid option: %s\n", argv[i]);
+        usage(argv[0]);
+        return 1;
+      }
+    } else {
+      selected.push_back(argv[i]);
+    }
+  }
+
+  bool ran = false;
+  for (const BenchSuite &suite : suites) {
+    bool run = selected.empty();
+    for (const char *name : selected) {
+      run |= strcmp(name, suite.name) == 0;
+    }
+    if (run) {
+      suite.run();
+      ran = true;
+    }
+  }
+  if (!ran) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (json_path && !bench_write_json(json_path, argc, argv)) {
+    perror(json_path);
+    return 1;
+  }
+  return bench_failed() ? 1 : 0;
+}
@@ -0,0 +1,143 @@
+/** \file
+ * Trailer manifests: writing one, opening it mapped, and looking paths up in
+ * it at a thousand and at a million entries, where the binary search should
+ * only add a few steps. Then what the manifest saves per file: reading the
+ * JPEG from a known range against searching the place for it again.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <unistd.h>
+
+#include "bench.hh"
+#include "thumb_manifest.hh"
+
+static std::string place_path(size_t i) {
+  char path[64];
+  snprintf(path, sizeof(path), "archive/%04zu/place-%07zu.rbxl", i % 1000, i);
+  return path;
+}
+
+static void bench_lookups(size_t count) {
+  ThumbManifestWriter writer;
+  for (size_t i = 0; i < count; i++) {
+    ThumbManifestEntry entry = {};
+    entry.stamp = {uint64_t(1) << 20, int64_t(i), 1, i};
+    entry.jpeg_offset = uint64_t(1) << 20;
+    entry.jpeg_length = 100000 + i % 1000;
+    writer.add(place_path(i), entry);
+  }
+
+  char path[] = "/tmp/kiseki-manifest-XXXXXX";
+  const int fd = mkstemp(path);
+  if (fd < 0) {
+    perror(path);
+    return;
+  }
+  close(fd);
+  char name[64];
+  double seconds = bench_time([&] { writer.write(path, 0); }, 0.0);
+  snprintf(name, sizeof(name), "write/%zu", count);
+  bench_report("manifest", name, seconds, 0);
+
+  seconds = bench_time([&] {
+    ThumbManifest manifest(thumb_source_map_file(path));
+    bench_keep(manifest.size());
+  });
+  snprintf(name, sizeof(name), "open/%zu", count);
+  bench_report("manifest", name, seconds, 0);
+
+  ThumbManifest manifest(thumb_source_map_file(path));
+  bench_counter("manifest", name, "file bytes per entry",
+                uint64_t(std::filesystem::file_size(path)) / count);
+  if (manifest.size() != count) {
+    bench_fail("%s: %zu of %zu entries", name, manifest.size(), count);
+  }
+
+  /* Scattered keys, so every lookup walks its own path down the table. */
+  static constexpr size_t batch = 1024;
+  std::vector<std::string> hits, misses;
+  for (size_t i = 0; i < batch; i++) {
+    const size_t index = (i * 2654435761u) % count;
+    hits.push_back(place_path(index));
+    misses.push_back(place_path(index) + ".bak");
+  }
+  size_t found = 0;
+  seconds = bench_time([&] {
+    found = 0;
+    for (const std::string &key : hits) {
+      const ThumbManifestEntry *entry = manifest.find(key);
+      found += entry && entry->stamp.inode < count;
+    }
+  });
+  snprintf(name, sizeof(name), "lookup-hit/%zu", count);
+  bench_report("manifest", name, seconds / batch, 0);
+  if (found != batch) {
+    bench_fail("%s: %zu of %zu found", name, found, batch);
+  }
+
+  seconds = bench_time([&] {
+    found = 0;
+    for (const std::string &key : misses) {
+      found += manifest.find(key) != nullptr;
+    }
+  });
+  snprintf(name, sizeof(name), "lookup-miss/%zu", count);
+  bench_report("manifest", name, seconds / batch, 0);
+  if (found) {
+    bench_fail("%s: %zu false hits", name, found);
+  }
+  unlink(path);
+}
+
+void bench_manifest() {
+  bench_lookups(1000);
+  bench_lookups(1000000);
+
+  /* The saving per file: search the place for its trailer, or read the
+   * range a manifest entry holds. */
+  std::vector<uint8_t> trailer(256 * 1024);
+  uint32_t noise = 1;
+  for (uint8_t &byte : trailer) {
+    noise = noise * 1664525u + 1013904223u;
+    byte = uint8_t(noise >> 24);
+  }
+  const std::vector<uint8_t> place = bench_place_file(16 << 20, trailer);
+  ThumbBuffer buffer;
+  ThumbTrailer found;
+  ThumbManifestEntry entry = {};
+  {
+    TestSource source(place, TEST_SOURCE_FILE);
+    eThumbStatus status = thumb_read_trailer(&source, buffer, &found);
+    entry = thumb_manifest_entry({}, status, &found);
+  }
+
+  const struct {
+    const char *name;
+    eTestSourceMode mode;
+    bool from_manifest;
+  } reads[] = {{"rescan/tail", TEST_SOURCE_FILE, false},
+               {"rescan/sequential", TEST_SOURCE_PIPE, false},
+               {"known-range", TEST_SOURCE_FILE, true}};
+  for (const auto &read : reads) {
+    uint64_t read_calls = 0, bytes_read = 0;
+    eThumbStatus status = THUMB_OK;
+    double seconds = bench_time([&] {
+      TestSource source(place, read.mode);
+      status = read.from_manifest
+                   ? thumb_read_manifest_trailer(&source, entry, buffer,
+                                                 &found)
+                   : thumb_read_trailer(&source, buffer, &found);
+      read_calls = source.read_calls;
+      bytes_read = source.bytes_read;
+    });
+    bench_report("manifest", read.name, seconds, 0);
+    bench_counter("manifest", read.name, "read calls", read_calls);
+    bench_counter("manifest", read.name, "bytes read", bytes_read);
+    if (status != THUMB_OK || found.length != trailer.size()) {
+      bench_fail("%s: trailer not found", read.name);
+    }
+  }
+}
@@ -0,0 +1,104 @@
+/** \file
+ * Serving the sizes Explorer asks for from one decode: building the mip
+ * pyramid of a 1080p thumbnail, serving each size from it against decoding
+ * and fitting that size from scratch, and a whole session of sizes both
+ * ways. The PSNR of every pyramid result against the direct one is printed
+ * next to it, the two paths filter differently and should stay close.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <utility>
+
+#include "bench.hh"
+#include "thumb_jpeg.hh"
+#include "thumb_mip.hh"
+#include "thumb_resample.hh"
+
+/* Small and medium icons, large icons, extra large icons, the preview pane. */
+static const int session_sizes[] = {32, 96, 256, 768, 1024};
+
+static double psnr(const Thumbnail &a, const Thumbnail &b) {
+  if (a.width != b.width || a.height != b.height) {
+    return 0.0;
+  }
+  const size_t stride = thumb_bgr_stride(a.width);
+  double error = 0.0;
+  for (int y = 0; y < a.height; y++) {
+    const uint8_t *p = a.data.data() + size_t(y) * stride;
+    const uint8_t *q = b.data.data() + size_t(y) * stride;
+    for (int x = 0; x < a.width * 3; x++) {
+      const double d = double(p[x]) - double(q[x]);
+      error += d * d;
+    }
+  }
+  error /= double(a.width) * a.height * 3;
+  return error == 0.0 ? 99.0 : 10.0 * std::log10(255.0 * 255.0 / error);
+}
+
+static void decode_fit(const std::vector<uint8_t> &jpeg, int cx,
+                       Thumbnail *thumb) {
+  thumb_jpeg_decode(jpeg.data(), jpeg.size(), cx, thumb);
+  thumb_fit_to(thumb, cx);
+}
+
+void bench_mip() {
+  std::vector<uint8_t> jpeg = bench_jpeg_encode(1920, 1080);
+  ThumbContextLease context;
+  Thumbnail decoded, direct, served;
+  ThumbPyramid pyramid;
+  char name[64];
+
+  thumb_jpeg_decode(jpeg.data(), jpeg.size(), thumb_mip_top, &decoded);
+  double seconds = bench_time([&] {
+    thumb_jpeg_decode(jpeg.data(), jpeg.size(), thumb_mip_top, &decoded);
+  });
+  bench_report("mip", "decode/top", seconds, 0);
+  /* The build takes the decoded pixels and hands the old top level back;
+   * swapping them back in makes every run build from the same image. */
+  seconds = bench_time([&] {
+    thumb_pyramid_build(&decoded, &pyramid);
+    std::swap(decoded, pyramid.levels.front());
+  });
+  std::swap(decoded, pyramid.levels.front());
+  bench_report("mip", "build", seconds, 0);
+  bench_counter("mip", "build", "levels", pyramid.levels.size());
+  bench_counter("mip", "build", "bytes", pyramid.size_bytes());
+
+  for (int cx : session_sizes) {
+    seconds = bench_time([&] { decode_fit(jpeg, cx, &direct); });
+    snprintf(name, sizeof(name), "direct/cx%d", cx);
+    bench_report("mip", name, seconds, 0);
+
+    seconds = bench_time([&] { thumb_pyramid_fit(pyramid, cx, &served); });
+    snprintf(name, sizeof(name), "pyramid/cx%d", cx);
+    bench_report("mip", name, seconds, 0);
+    bench_counter("mip", name, "psnr dB", uint64_t(psnr(direct, served)));
+  }
+
+  /* Every size of the session in turn, the way the shell handler serves them
+   * without and with the pyramid cache. */
+  seconds = bench_time([&] {
+    for (int cx : session_sizes) {
+      decode_fit(jpeg, cx, &direct);
+    }
+  });
+  bench_report("mip", "session/direct", seconds, 0);
+
+  seconds = bench_time([&] {
+    ThumbPyramidCache cache(size_t(64) << 20);
+    for (int cx : session_sizes) {
+      std::shared_ptr<const ThumbPyramid> cached = cache.lookup(1, jpeg.size());
+      if (!cached) {
+        thumb_jpeg_decode(jpeg.data(), jpeg.size(), thumb_mip_top, &decoded);
+        auto built = cache.acquire();
+        thumb_pyramid_build(&decoded, built.get());
+        cache.insert(1, jpeg.size(), built);
+        cached = std::move(built);
+      }
+      thumb_pyramid_fit(*cached, cx, &served);
+    }
+  });
+  bench_report("mip", "session/pyramid", seconds, 0);
+}
@@ -0,0 +1,83 @@
+/** \file
+ * Pixel format conversion from `thumb_pack.hh`, per kernel and per kernel
+ * level, at a shell thumbnail size and at 1080p. Throughput counts the bytes
+ * written. Every level is checked byte for byte against the scalar kernel.
+ */
+
+#include <cstdio>
+
+#include "bench.hh"
+#include "thumb_cpu.hh"
+#include "thumb_pack.hh"
+#include "thumb_resample.hh"
+
+namespace {
+
+struct PackKernel {
+  const char *name;
+  size_t src_pixel, dst_pixel;
+  /** Source rows are BGR24-padded, like the decoder's output. */
+  bool padded_src;
+  void (*convert)(const uint8_t *src, size_t src_stride, uint8_t *dst,
+                  size_t dst_stride, int width, int height);
+};
+
+}  // namespace
+
+void bench_pack() {
+  static const PackKernel kernels[] = {
+      {"rgb24-bgra32", 3, 4, true,
+       thumb_convert_pixels<THUMB_PIXEL_RGB24, THUMB_PIXEL_BGRA32>},
+      {"bgr24-bgra32", 3, 4, true,
+       thumb_convert_pixels<THUMB_PIXEL_BGR24, THUMB_PIXEL_BGRA32>},
+      {"bgra32-bgr24", 4, 3, false,
+       thumb_convert_pixels<THUMB_PIXEL_BGRA32, THUMB_PIXEL_BGR24>},
+      {"bgr24-padded-packed", 3, 3, true,
+       thumb_convert_pixels<THUMB_PIXEL_BGR24, THUMB_PIXEL_BGR24>},
+  };
+  static const struct {
+    eThumbSimdLevel level;
+    const char *name;
+  } levels[] = {{THUMB_SIMD_SCALAR, "scalar"},
+                {THUMB_SIMD_SSSE3, "ssse3"},
+                {THUMB_SIMD_AVX2, "avx2"}};
+  /* 255 wide leaves a ragged tail for every kernel width. */
+  static const int sizes[][2] = {{255, 144}, {1920, 1080}};
+
+  for (const PackKernel &kernel : kernels) {
+    for (const auto &size : sizes) {
+      const int width = size[0], height = size[1];
+      const size_t src_stride = kernel.padded_src
+                                    ? thumb_bgr_stride(width)
+                                    : size_t(width) * kernel.src_pixel;
+      const size_t dst_stride = size_t(width) * kernel.dst_pixel;
+      std::vector<uint8_t> src(src_stride * height);
+      uint32_t noise = 1;
+      for (uint8_t &byte : src) {
+        noise = noise * 1664525u + 1013904223u;
+        byte = uint8_t(noise >> 24);
+      }
+      std::vector<uint8_t> reference, dst(dst_stride * height);
+
+      for (const auto &level : levels) {
+        thumb_simd_set_cap(level.level);
+        double seconds = bench_time([&] {
+          kernel.convert(src.data(), src_stride, dst.data(), dst_stride,
+                         width, height);
+          bench_keep(dst[0]);
+        });
+        char name[64];
+        snprintf(name, sizeof(name), "%s/%s/%dx%d", kernel.name, level.name,
+                 width, height);
+        bench_report("pack", name, seconds, dst.size());
+
+        if (reference.empty()) {
+          reference = dst;
+        } else if (dst != reference) {
+          bench_fail("%s: output differs from the scalar kernel", name);
+        }
+      }
+    }
+  }
+  thumb_simd_set_cap(THUMB_SIMD_AVX2);
+}
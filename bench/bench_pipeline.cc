@@ -0,0 +1,190 @@
+/** \file
+ * Every stage of producing a thumbnail, timed separately on generated places.
+ *
+ * For each combination in #bench_corpus_options a place is written to disk
+ * with #bench_place_write, then each stage is timed on its own: finding the
+ * trailer through a mapping, through `pread` and by streaming the whole file
+ * through a #ThumbStreamExtractor, copying the JPEG out, decoding it at full
+ * size and at the scale for a 256 pixel thumbnail, and resampling to the
+ * final size. "total" runs the whole chain the way the shell handler does.
+ * The files stay in the page cache between runs, so this measures CPU and
+ * memory cost rather than disk speed.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "bench.hh"
+#include "thumb_jpeg.hh"
+#include "thumb_resample.hh"
+
+static constexpr int pipeline_cx = 256;
+
+static std::string format_size(size_t size) {
+  static const char *const units[] = {"B", "KB", "MB", "GB"};
+  int unit = 0;
+  while (unit < 3 && size >= 1024 && size % 1024 == 0) {
+    size >>= 10;
+    unit++;
+  }
+  return std::to_string(size) + units[unit];
+}
+
+/** Push the file at \a path through an extractor, \a chunk bytes a read. */
+static eThumbStatus stream_file(const char *path, size_t chunk,
+                                ThumbBuffer &buffer,
+                                ThumbTrailer *r_trailer) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return THUMB_READ_ERROR;
+  }
+  ThumbStreamExtractor extractor(buffer);
+  eThumbStatus status;
+  for (;;) {
+    ssize_t n = read(fd, extractor.reserve(chunk), chunk);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    status = n < 0 ? THUMB_READ_ERROR : extractor.commit(size_t(n));
+    if (status != THUMB_OK || n == 0) {
+      break;
+    }
+  }
+  close(fd);
+  return status == THUMB_OK ? extractor.finish(r_trailer) : status;
+}
+
+static void run_place(const std::string &label, const std::string &path,
+                      const std::vector<uint8_t> &jpeg) {
+  const uint64_t jpeg_size = jpeg.size();
+  ThumbBuffer buffer;
+  ThumbTrailer trailer = {};
+  auto report = [&](const char *stage, double seconds, uint64_t bytes) {
+    bench_report("pipeline", (label + "/" + stage).c_str(), seconds, bytes);
+  };
+
+  std::unique_ptr<ThumbSource> source;
+  eThumbStatus status = THUMB_OK;
+  double seconds = bench_time([&] {
+    source = thumb_source_map_file(path.c_str());
+    status = thumb_read_trailer(source.get(), buffer, &trailer);
+  });
+  if (!source || status != THUMB_OK || trailer.length != jpeg_size) {
+    bench_counter("pipeline", label.c_str(), "extract failures", 1);
+    return;
+  }
+  const uint64_t place_size = uint64_t(source->size());
+  bench_counter("pipeline", label.c_str(), "place bytes", place_size);
+  bench_counter("pipeline", label.c_str(), "jpeg bytes", jpeg_size);
+  report("extract-map", seconds, 0);
+
+  seconds = bench_time([&] {
+    std::unique_ptr<ThumbSource> file = thumb_source_open_file(path.c_str());
+    thumb_read_trailer(file.get(), buffer, &trailer);
+    bench_keep(trailer);
+  });
+  report("extract-pread", seconds, 0);
+
+  for (size_t chunk : bench_corpus_options.chunks) {
+    seconds = bench_time([&] {
+      status = stream_file(path.c_str(), chunk, buffer, &trailer);
+    });
+    const std::string stage = "extract-stream-" + format_size(chunk);
+    if (status != THUMB_OK || trailer.length != jpeg_size) {
+      bench_counter("pipeline", (label + "/" + stage).c_str(), "failures", 1);
+    }
+    report(stage.c_str(), seconds, place_size);
+  }
+
+  /* What `GetThumbnail` did with the trailer before decoding in place. */
+  std::vector<uint8_t> copy;
+  seconds = bench_time([&] {
+    copy.assign(jpeg.begin(), jpeg.end());
+    bench_keep(copy);
+  });
+  report("copy", seconds, jpeg_size);
+
+  Thumbnail full, scaled;
+  seconds = bench_time([&] {
+    thumb_jpeg_decode(jpeg.data(), jpeg.size(), 0, &full);
+  });
+  report("decode-full", seconds, jpeg_size);
+  seconds = bench_time([&] {
+    thumb_jpeg_decode(jpeg.data(), jpeg.size(), pipeline_cx, &scaled);
+  });
+  report("decode-cx256", seconds, jpeg_size);
+
+  Thumbnail fitted;
+  thumb_fit_size(scaled.width, scaled.height, pipeline_cx, &fitted.width,
+                 &fitted.height);
+  fitted.data.resize(thumb_bgr_stride(fitted.width) * fitted.height);
+  seconds = bench_time([&] {
+    thumb_resample_bgr(scaled.data.data(), scaled.width, scaled.height,
+                       thumb_bgr_stride(scaled.width), fitted.data.data(),
+                       fitted.width, fitted.height,
+                       thumb_bgr_stride(fitted.width));
+  });
+  report("scale-cx256", seconds, 0);
+
+  seconds = bench_time([&] {
+    ThumbContextLease context;
+    std::unique_ptr<ThumbSource> file = thumb_source_map_file(path.c_str());
+    if (thumb_read_trailer(file.get(), context->buffer, &trailer) ==
+            THUMB_OK &&
+        thumb_jpeg_decode(trailer.data, trailer.length, pipeline_cx,
+                          &context->pixels) == THUMB_OK) {
+      thumb_fit_to(&context->pixels, pipeline_cx);
+    }
+  });
+  report("total-cx256", seconds, 0);
+}
+
+void bench_pipeline() {
+  const BenchCorpusOptions &options = bench_corpus_options;
+  std::string directory = options.output_dir;
+  const bool temporary = directory.empty();
+  if (temporary) {
+    const char *tmp = getenv("TMPDIR");
+    std::string pattern = std::string(tmp ? tmp : "/tmp") + "/kiseki-XXXXXX";
+    if (!mkdtemp(&pattern[0])) {
+      perror(pattern.c_str());
+      return;
+    }
+    directory = pattern;
+  }
+
+  for (size_t d = 0; d + 1 < options.dimensions.size(); d += 2) {
+    const int width = options.dimensions[d];
+    const int height = options.dimensions[d + 1];
+    for (int quality : options.qualities) {
+      for (int subsampling : options.subsamplings) {
+        std::vector<uint8_t> jpeg =
+            bench_jpeg_encode(width, height, quality, subsampling == 420);
+        for (size_t xml_size : options.xml_sizes) {
+          char variant[64];
+          snprintf(variant, sizeof(variant), "%dx%d-q%d-%d", width, height,
+                   quality, subsampling);
+          const std::string size = format_size(xml_size);
+          const std::string path =
+              directory + "/place-" + size + "-" + variant + ".rbxl";
+          if (!bench_place_write(path.c_str(), xml_size, jpeg)) {
+            perror(path.c_str());
+            continue;
+          }
+          run_place(size + "/" + variant, path, jpeg);
+          if (temporary) {
+            unlink(path.c_str());
+          }
+        }
+      }
+    }
+  }
+  if (temporary) {
+    rmdir(directory.c_str());
+  }
+}
@@ -0,0 +1,100 @@
+/** \file
+ * Reading a thumbnail's size and format from its headers alone:
+ * #thumb_jpeg_probe against `jpeg_read_header` and against decoding the
+ * pixels, for the trailer shapes the shell meets, then the whole path from a
+ * place through a tail read or a sequential one. Every result is checked
+ * against libjpeg's, and the shortest prefix of the trailer the probe gets
+ * by with is printed next to it.
+ */
+
+#include <cstdio>
+
+#include "bench.hh"
+#include "thumb_jpeg.hh"
+
+static bool same_info(const ThumbJpegInfo &a, const ThumbJpegInfo &b) {
+  return a.width == b.width && a.height == b.height &&
+         a.components == b.components && a.precision == b.precision &&
+         a.subsample_x == b.subsample_x && a.subsample_y == b.subsample_y &&
+         a.progressive == b.progressive && a.arithmetic == b.arithmetic;
+}
+
+void bench_probe() {
+  const struct {
+    const char *name;
+    std::vector<uint8_t> jpeg;
+  } inputs[] = {
+      {"1920x1080", bench_jpeg_encode(1920, 1080)},
+      {"1920x1080-444", bench_jpeg_encode(1920, 1080, 85, false)},
+      {"1920x1080-progressive",
+       bench_jpeg_encode(1920, 1080, 85, true, 0, true)},
+      {"3840x2160", bench_jpeg_encode(3840, 2160)},
+  };
+  Thumbnail thumb;
+  char name[64];
+
+  for (const auto &input : inputs) {
+    const std::vector<uint8_t> &jpeg = input.jpeg;
+    ThumbJpegInfo info = {}, reference = {};
+    eThumbStatus status = thumb_jpeg_probe(jpeg.data(), jpeg.size(), &info);
+    bench_jpeg_header_reference(jpeg, &reference);
+    if (status != THUMB_OK || !same_info(info, reference)) {
+      bench_fail("%s: probe disagrees with libjpeg", input.name);
+    }
+
+    double seconds = bench_time([&] {
+      thumb_jpeg_probe(jpeg.data(), jpeg.size(), &info);
+      bench_keep(info);
+    });
+    snprintf(name, sizeof(name), "probe/%s", input.name);
+    bench_report("probe", name, seconds, 0);
+
+    size_t prefix = 2;
+    while (thumb_jpeg_probe(jpeg.data(), prefix, &info) != THUMB_OK &&
+           prefix < jpeg.size()) {
+      prefix++;
+    }
+    bench_counter("probe", name, "header bytes", prefix);
+
+    seconds = bench_time([&] {
+      bench_jpeg_header_reference(jpeg, &reference);
+      bench_keep(reference);
+    });
+    snprintf(name, sizeof(name), "libjpeg-header/%s", input.name);
+    bench_report("probe", name, seconds, 0);
+
+    /* Progressive trailers go to the platform decoder in the shell. */
+    if (!info.progressive) {
+      seconds = bench_time([&] {
+        thumb_jpeg_decode(jpeg.data(), jpeg.size(), 0, &thumb);
+      });
+      snprintf(name, sizeof(name), "decode/%s", input.name);
+      bench_report("probe", name, seconds, 0);
+    }
+  }
+
+  /* From the place: find the trailer, then probe it. A tail read only
+   * touches the end of the file; a sequential one streams all of it. */
+  std::vector<uint8_t> place =
+      bench_place_file(16 << 20, bench_jpeg_encode(1920, 1080));
+  for (eTestSourceMode mode : {TEST_SOURCE_FILE, TEST_SOURCE_PIPE}) {
+    const char *mode_name = mode == TEST_SOURCE_FILE ? "tail" : "sequential";
+    ThumbContextLease context;
+    ThumbJpegInfo info = {};
+    uint64_t bytes_read = 0;
+    double seconds = bench_time([&] {
+      TestSource source(place, mode);
+      ThumbTrailer trailer;
+      if (thumb_read_trailer(&source, context->buffer, &trailer) == THUMB_OK) {
+        thumb_jpeg_probe(trailer.data, trailer.length, &info);
+      }
+      bytes_read = source.bytes_read;
+    });
+    snprintf(name, sizeof(name), "place/%s", mode_name);
+    bench_report("probe", name, seconds, 0);
+    bench_counter("probe", name, "bytes read", bytes_read);
+    if (info.width != 1920 || info.height != 1080) {
+      bench_fail("%s: wrong size %dx%d", name, info.width, info.height);
+    }
+  }
+}
@@ -0,0 +1,66 @@
+/** \file
+ * Lanczos resampling to exact cx-sized output, per kernel level, from the
+ * sizes the DCT-scaled decode typically leaves behind.
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include "bench.hh"
+#include "thumb_cpu.hh"
+#include "thumb_resample.hh"
+
+static Thumbnail make_image(int width, int height) {
+  Thumbnail thumb;
+  thumb.width = width;
+  thumb.height = height;
+  thumb.data.resize(thumb_bgr_stride(width) * height);
+  uint32_t noise = 1;
+  for (uint8_t &byte : thumb.data) {
+    noise = noise * 1664525u + 1013904223u;
+    byte = uint8_t(noise >> 24);
+  }
+  return thumb;
+}
+
+void bench_resample() {
+  struct Case {
+    int width, height, cx;
+  };
+  static const Case cases[] = {
+      {1920, 1080, 256}, {480, 270, 256}, {960, 540, 768}, {240, 135, 96}};
+  static const struct {
+    eThumbSimdLevel level;
+    const char *name;
+  } levels[] = {{THUMB_SIMD_SCALAR, "scalar"},
+                {THUMB_SIMD_SSE2, "sse2"},
+                {THUMB_SIMD_AVX2, "avx2"}};
+
+  for (const Case &c : cases) {
+    Thumbnail src = make_image(c.width, c.height);
+    int width, height;
+    thumb_fit_size(c.width, c.height, c.cx, &width, &height);
+    std::vector<uint8_t> reference, dst(thumb_bgr_stride(width) * height);
+
+    for (const auto &level : levels) {
+      thumb_simd_set_cap(level.level);
+      double seconds = bench_time([&] {
+        thumb_resample_bgr(src.data.data(), src.width, src.height,
+                           thumb_bgr_stride(src.width), dst.data(), width,
+                           height, thumb_bgr_stride(width));
+        bench_keep(dst[0]);
+      });
+      char name[64];
+      snprintf(name, sizeof(name), "%s/%dx%d->%dx%d", level.name, c.width,
+               c.height, width, height);
+      bench_report("resample", name, seconds, 0);
+
+      if (reference.empty()) {
+        reference = dst;
+      } else if (dst != reference) {
+        bench_fail("%s: output differs from the scalar kernel", name);
+      }
+    }
+  }
+  thumb_simd_set_cap(THUMB_SIMD_AVX2);
+}
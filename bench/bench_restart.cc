@@ -0,0 +1,69 @@
+/** \file
+ * Decoding trailers with restart markers on several threads: 1080p, 1440p
+ * and 4K captures with one restart interval per MCU row, at full size and at
+ * the scale the shell decodes for its pyramid, against thread count. Every
+ * output is compared with the single threaded one, which it has to match
+ * exactly. The speedup only shows on as many cores as threads.
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include "bench.hh"
+#include "thumb_jpeg.hh"
+#include "thumb_pool.hh"
+
+static bool same_pixels(const Thumbnail &a, const Thumbnail &b) {
+  return a.width == b.width && a.height == b.height &&
+         a.data.size() == b.data.size() &&
+         memcmp(a.data.data(), b.data.data(), a.data.size()) == 0;
+}
+
+void bench_restart() {
+  const struct {
+    const char *name;
+    int width, height;
+  } sizes[] = {{"1920x1080", 1920, 1080},
+               {"2560x1440", 2560, 1440},
+               {"3840x2160", 3840, 2160}};
+  const int decode_sizes[] = {0, 1024};
+  const int thread_counts[] = {1, 2, 4, 8};
+  char name[64];
+
+  for (const auto &size : sizes) {
+    /* 4:2:0 MCUs are 16 pixels wide; one interval per row is what encoders
+     * asked for restart markers usually write. */
+    const std::vector<uint8_t> jpeg = bench_jpeg_encode(
+        size.width, size.height, 85, true, (size.width + 15) / 16);
+
+    for (int cx : decode_sizes) {
+      Thumbnail reference, thumb;
+      thumb_pool_set_threads(1);
+      if (thumb_jpeg_decode(jpeg.data(), jpeg.size(), cx, &reference) !=
+          THUMB_OK) {
+        bench_fail("%s: decode failed", size.name);
+        continue;
+      }
+      double single = 0.0;
+      for (int threads : thread_counts) {
+        thumb_pool_set_threads(threads);
+        eThumbStatus status = THUMB_OK;
+        double seconds = bench_time([&] {
+          status = thumb_jpeg_decode(jpeg.data(), jpeg.size(), cx, &thumb);
+        });
+        if (threads == 1) {
+          single = seconds;
+        }
+        snprintf(name, sizeof(name), "%s/cx%d/threads-%d", size.name, cx,
+                 threads);
+        bench_report("restart", name, seconds, 0);
+        bench_counter("restart", name, "speedup-x100",
+                      uint64_t(single / seconds * 100 + 0.5));
+        if (status != THUMB_OK || !same_pixels(thumb, reference)) {
+          bench_fail("%s: differs from the single threaded decode", name);
+        }
+      }
+    }
+  }
+  thumb_pool_set_threads(0);
+}
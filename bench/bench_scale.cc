@@ -0,0 +1,30 @@
+/** \file
+ * DCT-domain scaling: decoding a 1920x1080 trailer at the
+ * #thumb_scale_denominator picked for typical shell sizes, against a full
+ * size decode. Uses the system libjpeg as the portable decoder.
+ */
+
+#include <cstdio>
+
+#include "bench.hh"
+
+void bench_scale() {
+  const int width = 1920, height = 1080;
+  std::vector<uint8_t> jpeg = bench_jpeg_encode(width, height);
+  Thumbnail thumb;
+  char name[64];
+  bench_counter("scale", "jpeg/1920x1080", "bytes", jpeg.size());
+
+  double full = bench_time(
+      [&] { bench_jpeg_decode_reference(jpeg, 1, &thumb); });
+  bench_report("scale", "full/1920x1080", full, 0);
+
+  for (int cx : {96, 256, 768}) {
+    int denominator = thumb_scale_denominator(width, height, cx);
+    double seconds = bench_time(
+        [&] { bench_jpeg_decode_reference(jpeg, denominator, &thumb); });
+    snprintf(name, sizeof(name), "cx%d/1:%d/%dx%d", cx, denominator,
+             thumb.width, thumb.height);
+    bench_report("scale", name, seconds, 0);
+  }
+}
@@ -0,0 +1,56 @@
+/** \file
+ * `</roblox>` search throughput: #thumb_find against `std::search` and
+ * `memmem` on generated place XML, with the tag as far away as possible.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "bench.hh"
+#include "thumb_scan.hh"
+
+static const char end_tag[] = "</roblox>";
+static constexpr size_t end_tag_len = sizeof(end_tag) - 1;
+
+void bench_scan() {
+  for (size_t size : {size_t(1) << 20, size_t(64) << 20}) {
+    std::vector<uint8_t> xml = bench_place_xml(size);
+    xml.insert(xml.end(), end_tag, end_tag + end_tag_len);
+    const uint8_t *data = xml.data();
+    const size_t len = xml.size();
+    const uint8_t *expect = data + len - end_tag_len;
+
+    char name[64];
+    auto run = [&](const char *label, auto &&find) {
+      double seconds = bench_time([&] {
+        const uint8_t *found = find();
+        if (found != expect) {
+          bench_fail("%s: wrong match", label);
+        }
+        bench_keep(found);
+      });
+      snprintf(name, sizeof(name), "%s/%zuMB", label, size >> 20);
+      bench_report("scan", name, seconds, len);
+    };
+
+    run("std::search", [&] {
+      return std::search(data, data + len, end_tag, end_tag + end_tag_len);
+    });
+    run("memmem", [&] {
+      return static_cast<const uint8_t *>(
+          memmem(data, len, end_tag, end_tag_len));
+    });
+    run("thumb_find", [&] {
+      return thumb_find(data, len, end_tag, end_tag_len);
+    });
+
+    /* The tail search runs backward, so its worst case has the tag first. */
+    std::vector<uint8_t> reversed(end_tag, end_tag + end_tag_len);
+    reversed.insert(reversed.end(), xml.begin(), xml.end() - end_tag_len);
+    expect = reversed.data();
+    run("thumb_find_last", [&] {
+      return thumb_find_last(reversed.data(), len, end_tag, end_tag_len);
+    });
+  }
+}
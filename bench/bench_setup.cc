@@ -0,0 +1,52 @@
+/** \file
+ * Per-thumbnail setup cost, separated from the actual work: extracting a
+ * small place's trailer into fresh buffers against the pooled per-thread
+ * #ThumbContext, and the bare cost of creating a libjpeg decoder per image.
+ */
+
+#include <cstdio>
+
+#include "bench.hh"
+
+#ifdef KISEKI_BENCH_HAVE_JPEG
+#  include <jpeglib.h>
+#endif
+
+void bench_setup() {
+  std::vector<uint8_t> trailer(60 * 1024, 0x5a);
+  std::vector<uint8_t> place = bench_place_file(256 * 1024, trailer);
+  /* Decoded size of a 480x270 image, what a 1/4 scaled 1080p trailer gives. */
+  const size_t pixels_size = 1440 * 270;
+
+  auto extract = [&](ThumbContext &context) {
+    TestSource source(place, TEST_SOURCE_FILE);
+    ThumbTrailer found;
+    thumb_read_trailer(&source, context.buffer, &found);
+    context.pixels.data.resize(pixels_size);
+    bench_keep(context.pixels.data[pixels_size - 1]);
+  };
+
+  double fresh = bench_time([&] {
+    ThumbContext context;
+    extract(context);
+  });
+  double pooled = bench_time([&] {
+    ThumbContextLease context;
+    extract(*context);
+  });
+  bench_report("setup", "context/fresh", fresh, 0);
+  bench_report("setup", "context/pooled", pooled, 0);
+  bench_report("setup", "context/setup-cost", fresh - pooled, 0);
+
+#ifdef KISEKI_BENCH_HAVE_JPEG
+  double decoder = bench_time([&] {
+    jpeg_decompress_struct cinfo;
+    jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+    bench_keep(cinfo);
+    jpeg_destroy_decompress(&cinfo);
+  });
+  bench_report("setup", "libjpeg/create+destroy", decoder, 0);
+#endif
+}
@@ -0,0 +1,81 @@
+/** \file
+ * Cost of the always-on statistics from `thumb_stats.hh`: one histogram
+ * sample, one timed lap (a clock read plus the sample), and the same from
+ * several threads hitting the same histogram. The percentile error against
+ * an exact sort of the samples is reported in parts per thousand.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <thread>
+
+#include "bench.hh"
+#include "thumb_stats.hh"
+
+static constexpr int samples_per_run = 100000;
+
+static void fill_samples(std::vector<uint64_t> &samples) {
+  /* Log-uniform between 1 us and 100 ms, like stage latencies. */
+  uint32_t seed = 7;
+  for (uint64_t &ns : samples) {
+    seed = seed * 1664525u + 1013904223u;
+    double exponent = 3.0 + 5.0 * double(seed >> 8) / double(1 << 24);
+    ns = uint64_t(std::pow(10.0, exponent));
+  }
+}
+
+static void record_all(const std::vector<uint64_t> &samples) {
+  for (uint64_t ns : samples) {
+    thumb_stats_record(THUMB_STAGE_DECODE, ns);
+  }
+}
+
+void bench_stats() {
+  std::vector<uint64_t> samples(samples_per_run);
+  fill_samples(samples);
+  char name[64];
+
+  double seconds = bench_time([&] { record_all(samples); });
+  bench_report("stats", "record", seconds / samples_per_run, 0);
+
+  seconds = bench_time([&] {
+    ThumbStageTimer timer;
+    for (int i = 0; i < samples_per_run; i++) {
+      timer.lap(THUMB_STAGE_SCALE);
+    }
+  });
+  bench_report("stats", "timer-lap", seconds / samples_per_run, 0);
+
+  for (unsigned threads : {2u, 4u}) {
+    seconds = bench_time([&] {
+      std::vector<std::thread> workers;
+      for (unsigned i = 0; i < threads; i++) {
+        workers.emplace_back(record_all, std::cref(samples));
+      }
+      for (std::thread &worker : workers) {
+        worker.join();
+      }
+    });
+    snprintf(name, sizeof(name), "record/%u-threads", threads);
+    bench_report("stats", name, seconds / (samples_per_run * threads), 0);
+  }
+
+  /* Percentiles of a fresh histogram against the exact values. */
+  static ThumbHistogram histogram;
+  for (uint64_t ns : samples) {
+    histogram.count++;
+    histogram.buckets[thumb_histogram_bucket(ns)]++;
+    histogram.max_ns = std::max<uint64_t>(histogram.max_ns, ns);
+  }
+  std::vector<uint64_t> sorted = samples;
+  std::sort(sorted.begin(), sorted.end());
+  for (double q : {0.5, 0.99, 0.999}) {
+    uint64_t exact = sorted[size_t(q * double(sorted.size())) - 1];
+    uint64_t estimate = thumb_histogram_percentile(histogram, q);
+    uint64_t error = (std::max(exact, estimate) - std::min(exact, estimate)) *
+                     1000 / exact;
+    snprintf(name, sizeof(name), "p%g", q * 100.0);
+    bench_counter("stats", name, "error per mille", error);
+  }
+}
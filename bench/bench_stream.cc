@@ -0,0 +1,102 @@
+/** \file
+ * Push-style extraction with #ThumbStreamExtractor.
+ *
+ * Every place is first fed in random chunk splits (down to single bytes,
+ * so the closing tag and the gap byte land on every possible seam) and
+ * checked against a plain search of the whole file; any mismatch fails the
+ * run. Then throughput and peak buffer size are measured for fixed chunk
+ * sizes, the way an upload handler would push its body.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "bench.hh"
+
+/** Push \a place in chunks of 1 to \a max_chunk bytes. */
+static eThumbStatus push_random(const std::vector<uint8_t> &place,
+                                size_t max_chunk, uint32_t *seed,
+                                ThumbBuffer &buffer,
+                                ThumbTrailer *r_trailer) {
+  ThumbStreamExtractor extractor(buffer);
+  size_t pos = 0;
+  while (pos < place.size()) {
+    *seed = *seed * 1664525u + 1013904223u;
+    size_t n = std::min(size_t(*seed >> 8) % max_chunk + 1,
+                        place.size() - pos);
+    eThumbStatus status = extractor.push(place.data() + pos, n);
+    if (status != THUMB_OK) {
+      return status;
+    }
+    pos += n;
+  }
+  return extractor.finish(r_trailer);
+}
+
+static uint64_t check_splits(const std::vector<uint8_t> &place,
+                             size_t jpeg_offset, size_t jpeg_length) {
+  static const size_t max_chunks[] = {1, 7, 64, 4096, 1 << 20};
+  uint64_t mismatches = 0;
+  uint32_t seed = 1;
+  ThumbBuffer buffer;
+  for (size_t max_chunk : max_chunks) {
+    int rounds = max_chunk == 1 ? 1 : 40;
+    for (int round = 0; round < rounds; round++) {
+      ThumbTrailer found = {};
+      eThumbStatus status =
+          push_random(place, max_chunk, &seed, buffer, &found);
+      if (status != THUMB_OK || found.length != jpeg_length ||
+          found.file_offset != jpeg_offset ||
+          memcmp(found.data, place.data() + jpeg_offset, jpeg_length) != 0) {
+        mismatches++;
+      }
+    }
+  }
+  return mismatches;
+}
+
+void bench_stream() {
+  std::vector<uint8_t> trailer(200 * 1024);
+  for (size_t i = 0; i < trailer.size(); i++) {
+    trailer[i] = uint8_t(i * 31 + 7);
+  }
+  trailer[0] = 0xff;
+  trailer[1] = 0xd8;
+
+  /* Tag placement around every seam is covered by the single byte pushes on
+   * the small place; the larger one exercises slicing and buffer reuse. */
+  for (size_t xml_size : {size_t(4) << 10, size_t(1) << 20}) {
+    std::vector<uint8_t> place = bench_place_file(xml_size, trailer);
+    size_t offset = place.size() - trailer.size();
+    char name[64];
+    snprintf(name, sizeof(name), "splits/%zuKB", xml_size >> 10);
+    uint64_t mismatches = check_splits(place, offset, trailer.size());
+    bench_counter("stream", name, "mismatches", mismatches);
+    if (mismatches) {
+      bench_fail("%s: %llu splits found the wrong JPEG", name,
+                 (unsigned long long)mismatches);
+    }
+  }
+
+  std::vector<uint8_t> place = bench_place_file(size_t(64) << 20, trailer);
+  for (size_t chunk : {size_t(4) << 10, size_t(64) << 10, size_t(1) << 20}) {
+    ThumbBuffer buffer;
+    ThumbTrailer found = {};
+    size_t peak = 0;
+    double seconds = bench_time([&] {
+      ThumbStreamExtractor extractor(buffer);
+      for (size_t pos = 0; pos < place.size(); pos += chunk) {
+        size_t n = std::min(chunk, place.size() - pos);
+        extractor.push(place.data() + pos, n);
+        peak = std::max(peak, buffer.capacity());
+      }
+      extractor.finish(&found);
+      bench_keep(found);
+    });
+    char name[64];
+    snprintf(name, sizeof(name), "push/%zuKB-chunks/64MB", chunk >> 10);
+    bench_report("stream", name, seconds, place.size());
+    bench_counter("stream", name, "peak buffer bytes", peak);
+  }
+}
@@ -0,0 +1,249 @@
+/** \file
+ * Reporting and input generation shared by the benchmarks.
+ */
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "bench.hh"
+
+namespace {
+
+/** One line of output, kept for #bench_write_json. */
+struct BenchRecord {
+  std::string suite;
+  std::string name;
+  /** Empty for timings. */
+  std::string counter;
+  double seconds;
+  uint64_t bytes;
+  uint64_t value;
+};
+
+}  // namespace
+
+static std::vector<BenchRecord> records;
+
+void bench_report(const char *suite, const char *name, double seconds,
+                  uint64_t bytes) {
+  if (bytes) {
+    printf("%-10s %-32s %12.3f us %10.2f GB/s\n", suite, name, seconds * 1e6,
+           double(bytes) / seconds / 1e9);
+  } else {
+    printf("%-10s %-32s %12.3f us\n", suite, name, seconds * 1e6);
+  }
+  fflush(stdout);
+  records.push_back({suite, name, "", seconds, bytes, 0});
+}
+
+void bench_counter(const char *suite, const char *name, const char *counter,
+                   uint64_t value) {
+  printf("%-10s %-32s %12llu %s\n", suite, name, (unsigned long long)value,
+         counter);
+  fflush(stdout);
+  records.push_back({suite, name, counter, 0.0, 0, value});
+}
+
+static bool failed = false;
+
+void bench_fail(const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+  fputc('\n', stderr);
+  failed = true;
+}
+
+bool bench_failed() { return failed; }
+
+static void put_json_string(FILE *out, const std::string &text) {
+  fputc('"', out);
+  for (unsigned char c : text) {
+    if (c == '"' || c == '\\') {
+      fprintf(out, "\\%c", c);
+    } else if (c < 0x20) {
+      fprintf(out, "\\u%04x", c);
+    } else {
+      fputc(c, out);
+    }
+  }
+  fputc('"', out);
+}
+
+bool bench_write_json(const char *path, int argc, char *argv[]) {
+  FILE *out = fopen(path, "w");
+  if (!out) {
+    return false;
+  }
+  fprintf(out, "{\n  \"format\": \"kiseki-bench\",\n  \"version\": 1,\n");
+  fprintf(out, "  \"args\": [");
+  for (int i = 1; i < argc; i++) {
+    fprintf(out, i > 1 ? ", " : "");
+    put_json_string(out, argv[i]);
+  }
+  fprintf(out, "],\n  \"results\": [");
+  for (size_t i = 0; i < records.size(); i++) {
+    const BenchRecord &record = records[i];
+    fprintf(out, i ? ",\n    {" : "\n    {");
+    fprintf(out, "\"suite\": ");
+    put_json_string(out, record.suite);
+    fprintf(out, ", \"name\": ");
+    put_json_string(out, record.name);
+    if (record.counter.empty()) {
+      fprintf(out, ", \"us\": %.3f, \"bytes\": %llu", record.seconds * 1e6,
+              (unsigned long long)record.bytes);
+      if (record.bytes) {
+        fprintf(out, ", \"gb_per_s\": %.3f",
+                double(record.bytes) / record.seconds / 1e9);
+      }
+    } else {
+      fprintf(out, ", \"counter\": ");
+      put_json_string(out, record.counter);
+      fprintf(out, ", \"value\": %llu", (unsigned long long)record.value);
+    }
+    fprintf(out, "}");
+  }
+  fprintf(out, "\n  ]\n}\n");
+  return fclose(out) == 0;
+}
+
+namespace {
+
+/* Small LCG, enough to make the generated numbers look irregular. */
+struct Lcg {
+  uint32_t state;
+
+  uint32_t next() {
+    state = state * 1664525u + 1013904223u;
+    return state >> 8;
+  }
+
+  std::string number() {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.6g", double(next() % 200000) / 100.0 - 1000.0);
+    return buf;
+  }
+};
+
+}  // namespace
+
+static void append_part(std::string &xml, Lcg &rng) {
+  char referent[32];
+  snprintf(referent, sizeof(referent), "RBX%08X%08X", rng.next(), rng.next());
+  xml += "\t<Item class=\"Part\" referent=\"";
+  xml += referent;
+  xml += "\">\n\t\t<Properties>\n";
+  xml += "\t\t\t<bool name=\"Anchored\">true</bool>\n";
+  xml += "\t\t\t<CoordinateFrame name=\"CFrame\">\n";
+  static const char *cframe_fields[] = {"X",   "Y",   "Z",   "R00", "R01",
+                                        "R02", "R10", "R11", "R12", "R20",
+                                        "R21", "R22"};
+  for (const char *field : cframe_fields) {
+    xml += "\t\t\t\t<";
+    xml += field;
+    xml += ">";
+    xml += rng.number();
+    xml += "</";
+    xml += field;
+    xml += ">\n";
+  }
+  xml += "\t\t\t</CoordinateFrame>\n";
+  xml += "\t\t\t<string name=\"Name\">Part</string>\n";
+  xml += "\t\t\t<Vector3 name=\"size\"><X>" + rng.number() + "</X><Y>" +
+         rng.number() + "</Y><Z>" + rng.number() + "</Z></Vector3>\n";
+  xml += "\t\t</Properties>\n\t</Item>\n";
+}
+
+static const char place_header[] =
+    "<roblox xmlns:xmime=\"http://www.w3.org/2005/05/xmlmime\" "
+    "version=\"4\">\n";
+/* The closing tag, with the NUL that separates it from the JPEG. */
+static const char place_end_tag[] = "</roblox>";
+
+std::vector<uint8_t> bench_place_xml(size_t size, uint32_t seed) {
+  std::string xml(place_header);
+  Lcg rng{seed};
+  while (xml.size() < size) {
+    append_part(xml, rng);
+  }
+  xml.resize(size);
+  return std::vector<uint8_t>(xml.begin(), xml.end());
+}
+
+std::vector<uint8_t> bench_place_file(size_t xml_size,
+                                      const std::vector<uint8_t> &trailer) {
+  std::vector<uint8_t> place = bench_place_xml(xml_size);
+  place.insert(place.end(), place_end_tag,
+               place_end_tag + sizeof(place_end_tag));
+  place.insert(place.end(), trailer.begin(), trailer.end());
+  return place;
+}
+
+static void append_chunk_header(std::vector<uint8_t> &place, const char *name,
+                                uint32_t compressed, uint32_t uncompressed) {
+  uint8_t header[16] = {};
+  memcpy(header, name, 4);
+  for (int i = 0; i < 4; i++) {
+    header[4 + i] = uint8_t(compressed >> (8 * i));
+    header[8 + i] = uint8_t(uncompressed >> (8 * i));
+  }
+  place.insert(place.end(), header, header + sizeof(header));
+}
+
+std::vector<uint8_t> bench_binary_place(size_t chunk_count, size_t payload_size,
+                                        const std::vector<uint8_t> &trailer) {
+  static const uint8_t file_header[32] = {'<', 'r', 'o', 'b', 'l', 'o', 'x',
+                                          '!', 0x89, 0xff, 0x0d, 0x0a, 0x1a,
+                                          0x0a};
+  static const char *const chunk_names[] = {"INST", "PROP", "PRNT"};
+  static const char end_payload[] = "</roblox>";
+
+  std::vector<uint8_t> place(file_header, file_header + sizeof(file_header));
+  place.reserve(sizeof(file_header) + chunk_count * (16 + payload_size) +
+                trailer.size() + 64);
+  Lcg rng{1};
+  for (size_t i = 0; i < chunk_count; i++) {
+    append_chunk_header(place, chunk_names[i % 3], uint32_t(payload_size),
+                        uint32_t(payload_size * 2));
+    for (size_t j = 0; j < payload_size; j++) {
+      place.push_back(uint8_t(rng.next()));
+    }
+  }
+  /* The END chunk is stored uncompressed. */
+  append_chunk_header(place, "END\0", 0, sizeof(end_payload) - 1);
+  place.insert(place.end(), end_payload, end_payload + sizeof(end_payload));
+  place.insert(place.end(), trailer.begin(), trailer.end());
+  return place;
+}
+
+bool bench_place_write(const char *path, size_t xml_size,
+                       const std::vector<uint8_t> &trailer, uint32_t seed) {
+  /* The XML is generated and written a megabyte at a time, so even the
+   * largest places never sit in memory. */
+  static constexpr size_t flush_size = 1 << 20;
+  FILE *out = fopen(path, "wb");
+  if (!out) {
+    return false;
+  }
+  std::string xml(place_header);
+  Lcg rng{seed};
+  size_t written = 0;
+  bool ok = true;
+  while (ok && written + xml.size() < xml_size) {
+    append_part(xml, rng);
+    if (xml.size() >= flush_size && written + xml.size() < xml_size) {
+      ok = fwrite(xml.data(), 1, xml.size(), out) == xml.size();
+      written += xml.size();
+      xml.clear();
+    }
+  }
+  xml.resize(xml_size - written);
+  ok = ok && fwrite(xml.data(), 1, xml.size(), out) == xml.size() &&
+       fwrite(place_end_tag, sizeof(place_end_tag), 1, out) == 1 &&
+       fwrite(trailer.data(), 1, trailer.size(), out) == trailer.size();
+  return fclose(out) == 0 && ok;
+}
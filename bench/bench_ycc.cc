@@ -0,0 +1,83 @@
+/** \file
+ * YCbCr to BGR conversion from `thumb_ycc.hh` per chroma layout, output
+ * format and kernel level, at a shell thumbnail width and at 1080p. The
+ * samples are random over the whole byte range, so clamping is covered.
+ * Throughput counts the bytes written. Every level is checked byte for byte
+ * against the scalar kernel.
+ */
+
+#include <cstdio>
+
+#include "bench.hh"
+#include "thumb_cpu.hh"
+#include "thumb_ycc.hh"
+
+void bench_ycc() {
+  static const struct {
+    int chroma_shift;
+    const char *name;
+  } layouts[] = {{0, "444"}, {1, "420"}};
+  static const struct {
+    eThumbPixelFormat format;
+    size_t pixel;
+    const char *name;
+    ThumbYccRowFn (*select)(int);
+  } formats[] = {
+      {THUMB_PIXEL_BGR24, 3, "bgr24", thumb_ycc_row<THUMB_PIXEL_BGR24>},
+      {THUMB_PIXEL_BGRA32, 4, "bgra32", thumb_ycc_row<THUMB_PIXEL_BGRA32>}};
+  static const struct {
+    eThumbSimdLevel level;
+    const char *name;
+  } levels[] = {{THUMB_SIMD_SCALAR, "scalar"},
+                {THUMB_SIMD_SSE2, "sse2"},
+                {THUMB_SIMD_AVX2, "avx2"}};
+  /* 255 wide leaves a ragged tail for every kernel width. */
+  static const int sizes[][2] = {{255, 144}, {1920, 1080}};
+
+  for (const auto &layout : layouts) {
+    for (const auto &format : formats) {
+      for (const auto &size : sizes) {
+        const int width = size[0], height = size[1];
+        const int chroma_width = (width + layout.chroma_shift) >>
+                                 layout.chroma_shift;
+        std::vector<uint8_t> y(size_t(width) * height);
+        std::vector<uint8_t> cb(size_t(chroma_width) * height);
+        std::vector<uint8_t> cr(cb.size());
+        uint32_t noise = 1;
+        for (std::vector<uint8_t> *plane : {&y, &cb, &cr}) {
+          for (uint8_t &byte : *plane) {
+            noise = noise * 1664525u + 1013904223u;
+            byte = uint8_t(noise >> 24);
+          }
+        }
+        const size_t stride = size_t(width) * format.pixel;
+        std::vector<uint8_t> reference, dst(stride * height);
+
+        for (const auto &level : levels) {
+          thumb_simd_set_cap(level.level);
+          const ThumbYccRowFn row = format.select(layout.chroma_shift);
+          double seconds = bench_time([&] {
+            for (int i = 0; i < height; i++) {
+              row(y.data() + size_t(i) * width,
+                  cb.data() + size_t(i) * chroma_width,
+                  cr.data() + size_t(i) * chroma_width,
+                  dst.data() + size_t(i) * stride, width);
+            }
+            bench_keep(dst[0]);
+          });
+          char name[64];
+          snprintf(name, sizeof(name), "%s-%s/%s/%dx%d", layout.name,
+                   format.name, level.name, width, height);
+          bench_report("ycc", name, seconds, dst.size());
+
+          if (reference.empty()) {
+            reference = dst;
+          } else if (dst != reference) {
+            bench_fail("%s: output differs from the scalar kernel", name);
+          }
+        }
+      }
+    }
+  }
+  thumb_simd_set_cap(THUMB_SIMD_AVX2);
+}
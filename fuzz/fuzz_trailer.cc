@@ -0,0 +1,197 @@
+/** \file
+ * libFuzzer harness for the portable parse path: #thumb_read_trailer on every
+ * kind of source, the #ThumbStreamExtractor fed in arbitrary pieces, and
+ * #thumb_jpeg_probe, #thumb_jpeg_decode and #thumb_jpeg_decode_fit on
+ * whatever trailer comes out.
+ *
+ * Input layout: a 5 byte prefix followed by the file body.
+ *
+ *   flags        bit 7 enables amplification, the rest seed the stream splits
+ *   repeat (u16) little endian
+ *   unit_start, unit_len
+ *
+ * With amplification the unit `body[unit_start, unit_start + unit_len)` is
+ * repeated `repeat` times in place, so a few bytes of `</robloX` near misses
+ * grow into megabytes of them. That lets a small corpus reach the sizes where
+ * superlinear scanning shows up as a timeout, without libFuzzer having to
+ * mutate multi-megabyte inputs.
+ *
+ * Besides crashes and sanitizer reports, any disagreement between the source
+ * kinds is a failure: mapped and `pread` sources must produce the same
+ * trailer, and streaming must find the same JPEG the tail search does.
+ *
+ * Run through the `fuzz-trailer` target, which applies the time and memory
+ * budget, or by hand with `-timeout` and `-rss_limit_mb`.
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "thumb.hh"
+#include "thumb_jpeg.hh"
+
+/* Amplified inputs are capped well below the default RSS limit. */
+static constexpr size_t amplified_max = 64 * 1024 * 1024;
+/* Between DCT scales for most sizes, so the fused decode resamples. */
+static constexpr int fit_cx = 100;
+
+namespace {
+
+enum eFuzzSourceMode {
+  FUZZ_SOURCE_MAPPED,
+  FUZZ_SOURCE_SEEKABLE,
+  FUZZ_SOURCE_SIZED_STREAM,
+  FUZZ_SOURCE_PIPE,
+};
+
+/** In-memory source that hands out short reads of pseudo-random length. */
+class FuzzSource : public ThumbSource {
+public:
+  FuzzSource(const std::vector<uint8_t> &data, eFuzzSourceMode mode,
+             uint32_t seed)
+      : _data(data), _mode(mode), _seed(seed | 1) {}
+
+  int64_t size() override {
+    return _mode <= FUZZ_SOURCE_SEEKABLE ? int64_t(_data.size()) : -1;
+  }
+
+  int64_t size_hint() override {
+    return _mode == FUZZ_SOURCE_PIPE ? -1 : int64_t(_data.size());
+  }
+
+  int64_t read_at(uint64_t offset, void *buffer, size_t len) override {
+    _pos = size_t(std::min<uint64_t>(offset, _data.size()));
+    return read(buffer, len);
+  }
+
+  int64_t read(void *buffer, size_t len) override {
+    _seed = _seed * 1664525u + 1013904223u;
+    size_t n = std::min({len, size_t(_seed >> 12) + 1, _data.size() - _pos});
+    memcpy(buffer, _data.data() + _pos, n);
+    _pos += n;
+    return int64_t(n);
+  }
+
+  const uint8_t *view(uint64_t offset, size_t len) override {
+    if (_mode != FUZZ_SOURCE_MAPPED || offset + len > _data.size()) {
+      return nullptr;
+    }
+    return _data.data() + offset;
+  }
+
+private:
+  const std::vector<uint8_t> &_data;
+  eFuzzSourceMode _mode;
+  uint32_t _seed;
+  size_t _pos = 0;
+};
+
+}  // namespace
+
+static bool same_trailer(const ThumbTrailer &a, const ThumbTrailer &b) {
+  return a.length == b.length && a.file_offset == b.file_offset &&
+         memcmp(a.data, b.data, a.length) == 0;
+}
+
+/** Unpack the prefix described at the top of the file into \a r_body. */
+static bool build_body(const uint8_t *data, size_t size, uint32_t *r_seed,
+                       std::vector<uint8_t> *r_body) {
+  if (size < 5) {
+    return false;
+  }
+  const uint8_t flags = data[0];
+  const size_t repeat = size_t(data[1]) | (size_t(data[2]) << 8);
+  const size_t unit_start = data[3];
+  const size_t unit_len = data[4];
+  data += 5;
+  size -= 5;
+  *r_seed = flags & 0x7f;
+
+  if (!(flags & 0x80) || unit_start + unit_len > size || unit_len == 0 ||
+      size + repeat * unit_len > amplified_max) {
+    r_body->assign(data, data + size);
+    return true;
+  }
+  r_body->reserve(size + repeat * unit_len);
+  r_body->assign(data, data + unit_start);
+  for (size_t i = 0; i <= repeat; i++) {
+    r_body->insert(r_body->end(), data + unit_start,
+                   data + unit_start + unit_len);
+  }
+  r_body->insert(r_body->end(), data + unit_start + unit_len, data + size);
+  return true;
+}
+
+static void check(bool condition) {
+  if (!condition) {
+    abort();
+  }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  std::vector<uint8_t> body;
+  uint32_t seed;
+  if (!build_body(data, size, &seed, &body)) {
+    return 0;
+  }
+
+  /* Tail search, searched in place and read into the buffer. */
+  ThumbBuffer mapped_buffer, read_buffer;
+  ThumbTrailer mapped = {}, seekable = {};
+  FuzzSource mapped_source(body, FUZZ_SOURCE_MAPPED, seed);
+  FuzzSource seekable_source(body, FUZZ_SOURCE_SEEKABLE, seed);
+  eThumbStatus mapped_status =
+      thumb_read_trailer(&mapped_source, mapped_buffer, &mapped);
+  eThumbStatus seekable_status =
+      thumb_read_trailer(&seekable_source, read_buffer, &seekable);
+  check(mapped_status == seekable_status);
+  check(mapped_status != THUMB_OK || same_trailer(mapped, seekable));
+
+  /* Sequential sources stream from the front but take the last tag just as
+   * the tail search does, however many there are. Binary places are walked
+   * the same way from both ends and must agree on the status too. */
+  const bool binary =
+      body.size() >= 8 && memcmp(body.data(), "<roblox!", 8) == 0;
+  for (eFuzzSourceMode mode : {FUZZ_SOURCE_SIZED_STREAM, FUZZ_SOURCE_PIPE}) {
+    ThumbBuffer buffer;
+    ThumbTrailer streamed = {};
+    FuzzSource source(body, mode, seed);
+    eThumbStatus status = thumb_read_trailer(&source, buffer, &streamed);
+    check((status == THUMB_OK) == (mapped_status == THUMB_OK));
+    check(status != THUMB_OK || same_trailer(streamed, mapped));
+    check(!binary || status == mapped_status);
+  }
+
+  if (mapped_status == THUMB_OK) {
+    /* Scaled as the shell handler asks for it, and at full size. Whatever
+     * decodes must probe to the size it decoded at. */
+    ThumbJpegInfo info;
+    const bool probed =
+        thumb_jpeg_probe(mapped.data, mapped.length, &info) == THUMB_OK;
+    Thumbnail thumb;
+    for (int cx : {256, 0}) {
+      if (thumb_jpeg_decode(mapped.data, mapped.length, cx, &thumb) ==
+          THUMB_OK) {
+        check(thumb.width > 0 && thumb.height > 0);
+        check(probed && !info.progressive);
+        check(cx != 0 || (thumb.width == info.width &&
+                          thumb.height == info.height));
+      }
+    }
+    /* Decoding straight to a size below the DCT scales fails exactly when
+     * the plain decode does. */
+    const bool plain =
+        thumb_jpeg_decode(mapped.data, mapped.length, fit_cx, &thumb) ==
+        THUMB_OK;
+    const bool fused =
+        thumb_jpeg_decode_fit(mapped.data, mapped.length, fit_cx, &thumb) ==
+        THUMB_OK;
+    check(plain == fused);
+    check(!fused || std::max(thumb.width, thumb.height) <= fit_cx);
+  }
+  return 0;
+}
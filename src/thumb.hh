@@ -0,0 +1,220 @@
+/** \file
+ * Shared thumbnail extraction logic.
+ *
+ * Everything in here is independent of the shell integration in
+ * `thumb_win32.cc`, so the same code path can be built and run on Linux.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "thumb_arena.hh"
+
+struct Thumbnail {
+  ThumbBuffer data;
+  int width;
+  int height;
+};
+
+enum eThumbStatus {
+  THUMB_OK = 0,
+  THUMB_READ_ERROR = 1,
+  THUMB_INVALID_FILE = 2,
+  THUMB_INVALID_THUMB = 3,
+  /** Valid image the built-in decoder doesn't handle, see `thumb_jpeg.hh`. */
+  THUMB_UNSUPPORTED = 4,
+};
+
+/** Short description of \a status for messages, like "not a place file". */
+const char *thumb_status_message(eThumbStatus status);
+
+/**
+ * Byte access to a place file.
+ *
+ * Seekable sources report their size and are read with #read_at, which only
+ * returns short at the end of the file. Sources that can't seek (pipes, some
+ * shell streams) report a size of -1 and are consumed front to back with
+ * #read. Both return the number of bytes read, or -1 on error.
+ *
+ * A sequential source may still know how long it is (#size_hint), which
+ * keeps reads from asking for more than is left. Sources backed
+ * by a mapping hand out pointers with #view instead of copying.
+ */
+class ThumbSource {
+public:
+  virtual ~ThumbSource() = default;
+
+  virtual int64_t size() = 0;
+  virtual int64_t size_hint() { return size(); }
+  virtual int64_t read_at(uint64_t offset, void *buffer, size_t len) = 0;
+  virtual int64_t read(void *buffer, size_t len) = 0;
+
+  /**
+   * Pointer to \a len bytes at \a offset that stays valid for the lifetime of
+   * the source, or null when the source isn't memory backed.
+   */
+  virtual const uint8_t *view(uint64_t /*offset*/, size_t /*len*/) {
+    return nullptr;
+  }
+};
+
+/**
+ * Read all of \a len bytes at \a offset of a seekable \a source:
+ * #THUMB_READ_ERROR when a read fails, #THUMB_INVALID_FILE when the source
+ * ends first.
+ */
+eThumbStatus thumb_source_read_exact(ThumbSource *source, uint64_t offset,
+                                     void *buffer, size_t len);
+
+/**
+ * The embedded JPEG as found by #thumb_read_trailer. It doesn't own anything:
+ * \a data points into the buffer filled by the extraction, or into the
+ * source's own mapping, and decoders read it from there without copying.
+ */
+struct ThumbTrailer {
+  const uint8_t *data;
+  size_t length;
+  /** Where the JPEG starts in the place file. */
+  uint64_t file_offset;
+};
+
+/**
+ * Find the JPEG appended after the closing `</roblox>` tag.
+ *
+ * Should the tag appear more than once, the last one counts, for every kind
+ * of source. Script sources are stored as CDATA, so the XML can hold the
+ * text literally, and the tail search below can only stop early if it
+ * takes the first tag it meets from the end.
+ *
+ * Seekable sources are read from the tail in a window that widens backward
+ * until the tag turns up, so the I/O is proportional to the thumbnail and not
+ * to the place. Files that don't start with `<roblox` are rejected before any
+ * tail reads. Binary places (`<roblox!`) are walked chunk by chunk instead,
+ * reading only the 16 byte chunk headers up to the END chunk, so the cost
+ * follows the chunk count and nothing is decompressed. Sequential sources are
+ * fed through a #ThumbStreamExtractor, which only holds on to the JPEG. On
+ * success \a r_trailer points at the JPEG, either inside \a buffer or inside
+ * the source's #ThumbSource::view; both must outlive it.
+ */
+eThumbStatus thumb_read_trailer(ThumbSource *source, ThumbBuffer &buffer,
+                                ThumbTrailer *r_trailer);
+
+/**
+ * Push-style trailer extraction for streams that arrive in pieces, like
+ * upload bodies. While looking for the closing tag only the last few bytes
+ * are kept, so a tag split across two pieces is still found; after it only
+ * the JPEG is, and a later tag in it restarts the JPEG behind that one, see
+ * #thumb_read_trailer. Memory use follows the size of the thumbnail, not
+ * the place.
+ * Binary places are followed through their chunk headers, with payloads
+ * dropped as they pass.
+ *
+ * Data is either copied in with #push, or read straight into the buffer
+ * through #reserve and #commit. Both return #THUMB_OK while the stream may
+ * still be a place, and #THUMB_INVALID_FILE as soon as it can't be.
+ */
+class ThumbStreamExtractor {
+public:
+  /** Collect into \a buffer, which the trailer ends up pointing into. */
+  explicit ThumbStreamExtractor(ThumbBuffer &buffer);
+
+  eThumbStatus push(const uint8_t *data, size_t len);
+  /** Room for up to \a len more bytes, valid until the next call. */
+  uint8_t *reserve(size_t len);
+  /** Take the first \a len bytes written to the space from #reserve. */
+  eThumbStatus commit(size_t len);
+
+  /** Call at the end of the stream to get the JPEG. */
+  eThumbStatus finish(ThumbTrailer *r_trailer);
+
+private:
+  enum eState {
+    STATE_HEADER,
+    STATE_SCAN,
+    STATE_GAP,
+    STATE_TRAILER,
+    STATE_INVALID,
+    /* Binary places. */
+    STATE_CHUNK_HEADER,
+    STATE_CHUNK_DATA,
+    STATE_END_GAP,
+  };
+
+  ThumbBuffer &_buffer;
+  /** Bytes at the front of #_buffer still needed: a partial tag or the JPEG. */
+  size_t _kept = 0;
+  /** Stream offset of the first byte in #_buffer. */
+  uint64_t _offset = 0;
+  /** Bytes left to drop: the gap after the closing tag, or a chunk payload. */
+  uint64_t _skip = 0;
+  /** The chunk being skipped is the END chunk. */
+  bool _end_chunk = false;
+  /** Set once the header shows a binary place. */
+  bool _binary = false;
+  eState _state = STATE_HEADER;
+};
+
+/**
+ * Scratch memory reused from one thumbnail to the next on the same thread, so
+ * that steady-state requests don't pay for allocating (and faulting in)
+ * their buffers every time.
+ */
+struct ThumbContext {
+  /** Trailer window or streamed JPEG, see #thumb_read_trailer. */
+  ThumbBuffer buffer;
+  /** Decoded pixels. */
+  Thumbnail pixels;
+  /** Compressed cache entries, see `thumb_cache.hh`. */
+  ThumbBuffer scratch;
+  /** Transient buffers of the request, see #thumb_arena. */
+  ThumbArena arena;
+};
+
+/**
+ * Borrows the calling thread's #ThumbContext for one request. When the lease
+ * ends, buffers that grew past what a typical thumbnail needs are released so
+ * one huge place doesn't keep its memory pinned to the thread.
+ */
+class ThumbContextLease {
+public:
+  ThumbContextLease();
+  ~ThumbContextLease();
+
+  ThumbContextLease(const ThumbContextLease &) = delete;
+  ThumbContextLease &operator=(const ThumbContextLease &) = delete;
+
+  ThumbContext *operator->() { return _context; }
+  ThumbContext &operator*() { return *_context; }
+
+private:
+  ThumbContext *_context;
+  ThumbArena *_outer_arena;
+};
+
+/**
+ * The arena of the calling thread's innermost #ThumbContextLease, or of the
+ * thread's own context when no lease is held. Callers open a
+ * #ThumbArenaScope on it for their scratch memory.
+ */
+ThumbArena &thumb_arena();
+
+/**
+ * Largest JPEG DCT scaling denominator (1, 2, 4 or 8) at which an image of
+ * \a width x \a height still covers \a cx pixels along its longest edge.
+ * Decoding at 1/N skips most of the IDCT and color conversion work.
+ */
+int thumb_scale_denominator(int width, int height, int cx);
+
+#ifndef _WIN32
+/** Open \a path for reading, or return null if it can't be opened. */
+std::unique_ptr<ThumbSource> thumb_source_open_file(const char *path);
+/**
+ * Map \a path into memory, or return null if it can't be mapped. Only the
+ * pages that are actually searched (normally the tail) get read from disk.
+ */
+std::unique_ptr<ThumbSource> thumb_source_map_file(const char *path);
+#endif
@@ -0,0 +1,100 @@
+/** \file
+ * Request arenas, see thumb_arena.hh.
+ */
+
+#include <algorithm>
+#include <new>
+
+#include "thumb_arena.hh"
+
+/* Under AddressSanitizer the unused part of the block, and the alignment
+ * padding behind every allocation, stay poisoned, so overruns inside the
+ * block are caught like heap overruns. */
+#if defined(__has_feature)
+#  if __has_feature(address_sanitizer)
+#    define THUMB_ARENA_ASAN 1
+#  endif
+#endif
+#if defined(__SANITIZE_ADDRESS__) && !defined(THUMB_ARENA_ASAN)
+#  define THUMB_ARENA_ASAN 1
+#endif
+
+#ifdef THUMB_ARENA_ASAN
+#  include <sanitizer/asan_interface.h>
+#  define ARENA_POISON(p, size) ASAN_POISON_MEMORY_REGION(p, size)
+#  define ARENA_UNPOISON(p, size) ASAN_UNPOISON_MEMORY_REGION(p, size)
+#else
+#  define ARENA_POISON(p, size) ((void)(p), (void)(size))
+#  define ARENA_UNPOISON(p, size) ((void)(p), (void)(size))
+#endif
+
+/* The block grows in steps of this much, so small differences between
+ * requests don't regrow it every time. */
+static constexpr size_t block_granularity = 64 * 1024;
+
+static size_t align_up(size_t size, size_t align) {
+  return (size + align - 1) & ~(align - 1);
+}
+
+static uint8_t *align_pointer(void *p) {
+  return reinterpret_cast<uint8_t *>(
+      align_up(reinterpret_cast<uintptr_t>(p), thumb_arena_align));
+}
+
+ThumbArena::~ThumbArena() {
+  while (_overflow) {
+    Overflow *prev = _overflow->prev;
+    ::operator delete(_overflow);
+    _overflow = prev;
+  }
+  release();
+}
+
+void *ThumbArena::alloc(size_t size) {
+  const size_t requested = size;
+  size = align_up(std::max<size_t>(size, 1), thumb_arena_align);
+  _in_use += size;
+  _peak = std::max(_peak, _in_use);
+  if (_block_size - _used >= size) {
+    void *p = _block + _used;
+    _used += size;
+    ARENA_UNPOISON(p, requested);
+    return p;
+  }
+  /* The header sits in front of the aligned data, in the slack the alignment
+   * needs anyway. */
+  void *raw = ::operator new(sizeof(Overflow) + thumb_arena_align + size);
+  uint8_t *data = align_pointer(static_cast<uint8_t *>(raw) + sizeof(Overflow));
+  Overflow *overflow = static_cast<Overflow *>(raw);
+  overflow->prev = _overflow;
+  _overflow = overflow;
+  return data;
+}
+
+void ThumbArena::rewind(size_t used, Overflow *overflow, size_t in_use) {
+  while (_overflow != overflow) {
+    Overflow *prev = _overflow->prev;
+    ::operator delete(_overflow);
+    _overflow = prev;
+  }
+  _used = used;
+  _in_use = in_use;
+  ARENA_POISON(_block + _used, _block_size - _used);
+  if (_in_use == 0 && _peak > _block_size) {
+    const size_t peak = _peak;
+    release();
+    _block_size = align_up(peak, block_granularity);
+    _block_raw = ::operator new(_block_size + thumb_arena_align);
+    _block = align_pointer(_block_raw);
+    ARENA_POISON(_block, _block_size);
+  }
+}
+
+void ThumbArena::release() {
+  ARENA_UNPOISON(_block, _block_size);
+  ::operator delete(_block_raw);
+  _block_raw = nullptr;
+  _block = nullptr;
+  _block_size = 0;
+  _peak = 0;
+}
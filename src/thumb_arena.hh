@@ -0,0 +1,120 @@
+/** \file
+ * Bump allocator for the transient buffers of one thumbnail request.
+ *
+ * The decoder and the resampler take their scratch memory from the arena of
+ * the thread's current #ThumbContextLease, see #thumb_arena. Memory is handed
+ * out uninitialized and only given back in bulk, when the #ThumbArenaScope
+ * it was allocated in ends. What doesn't fit into the arena's block goes to
+ * the heap; once the arena is empty again the block grows to the most that
+ * was in use at once, so a thread serving similar thumbnails stops touching
+ * the heap after its first request.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/** Alignment of every arena allocation, enough for any SIMD load. */
+static constexpr size_t thumb_arena_align = 64;
+
+class ThumbArena {
+public:
+  ThumbArena() = default;
+  ~ThumbArena();
+
+  ThumbArena(const ThumbArena &) = delete;
+  ThumbArena &operator=(const ThumbArena &) = delete;
+
+  /** \a size uninitialized bytes, aligned to #thumb_arena_align. */
+  void *alloc(size_t size);
+
+  template<typename T> T *alloc_array(size_t count) {
+    static_assert(std::is_trivially_destructible_v<T>,
+                  "Arena memory is released without running destructors");
+    return static_cast<T *>(alloc(count * sizeof(T)));
+  }
+
+  /** Size of the block, what the arena keeps between requests. */
+  size_t capacity() const { return _block_size; }
+
+  /** Free the block; the arena must be empty. */
+  void release();
+
+private:
+  friend class ThumbArenaScope;
+
+  /** Header of an allocation that didn't fit into the block. */
+  struct Overflow {
+    Overflow *prev;
+  };
+
+  void rewind(size_t used, Overflow *overflow, size_t in_use);
+
+  void *_block_raw = nullptr;
+  uint8_t *_block = nullptr;
+  size_t _block_size = 0;
+  /** Bytes handed out from the block. */
+  size_t _used = 0;
+  Overflow *_overflow = nullptr;
+  /** Bytes handed out, from the block and the heap together. */
+  size_t _in_use = 0;
+  /** Most bytes in use at once since the block last grew. */
+  size_t _peak = 0;
+};
+
+/**
+ * Gives back everything allocated from \a arena during its lifetime. Scopes
+ * nest like the calls that open them.
+ */
+class ThumbArenaScope {
+public:
+  explicit ThumbArenaScope(ThumbArena &arena)
+      : _arena(arena),
+        _used(arena._used),
+        _overflow(arena._overflow),
+        _in_use(arena._in_use) {}
+  ~ThumbArenaScope() { _arena.rewind(_used, _overflow, _in_use); }
+
+  ThumbArenaScope(const ThumbArenaScope &) = delete;
+  ThumbArenaScope &operator=(const ThumbArenaScope &) = delete;
+
+  ThumbArena &arena() { return _arena; }
+
+private:
+  ThumbArena &_arena;
+  size_t _used;
+  ThumbArena::Overflow *_overflow;
+  size_t _in_use;
+};
+
+/**
+ * Allocator for buffers that are always written before they are read:
+ * resizing constructs new elements without value-initializing them, so
+ * growing a byte buffer doesn't zero it first.
+ */
+template<typename T> struct ThumbUninitAllocator : std::allocator<T> {
+  template<typename U> struct rebind {
+    using other = ThumbUninitAllocator<U>;
+  };
+
+  ThumbUninitAllocator() = default;
+  template<typename U>
+  ThumbUninitAllocator(const ThumbUninitAllocator<U> &) noexcept {}
+
+  template<typename U> void construct(U *p) noexcept(
+      std::is_nothrow_default_constructible_v<U>) {
+    ::new (static_cast<void *>(p)) U;
+  }
+  template<typename U, typename... Args>
+  void construct(U *p, Args &&...args) {
+    ::new (static_cast<void *>(p)) U(std::forward<Args>(args)...);
+  }
+};
+
+/** Byte buffer that grows without zero filling. */
+using ThumbBuffer = std::vector<uint8_t, ThumbUninitAllocator<uint8_t>>;
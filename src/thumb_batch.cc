@@ -0,0 +1,414 @@
+/** \file
+ * Batch thumbnail generation for whole directory trees on Linux.
+ *
+ * `Kiseki.ThumbnailBatch [-j threads] [-s cx] [-S stats-file] [-m segment]
+ *  [-M manifest] <input-dir> <output-dir>`
+ * finds every `.rbxl` below the input directory and writes its thumbnail,
+ * fitted to cx and saved as a BMP, to the same relative path under the output
+ * directory. Each file goes through the same extract, decode and scale steps
+ * as the shell handler.
+ *
+ * Files are dealt out round-robin to per-worker queues. A worker takes from
+ * the front of its own queue and, once that is empty, steals from the back of
+ * the others, so a few huge places don't leave the other threads idle. At the
+ * end the throughput and the latency histograms from `thumb_stats.hh` are
+ * printed; `-S` also writes them to a file, and `-m` publishes them in a
+ * shared memory segment while the batch runs.
+ *
+ * With `-M` the batch keeps a manifest (`thumb_manifest.hh`) of every input
+ * and where its JPEG is. On the next run, files that haven't changed since
+ * are skipped when their output is already there at the same size, and
+ * otherwise read with one read of exactly the JPEG instead of a search.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
+#include "thumb.hh"
+#include "thumb_jpeg.hh"
+#include "thumb_manifest.hh"
+#include "thumb_resample.hh"
+#include "thumb_stats.hh"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct BatchFile {
+  fs::path input;
+  fs::path output;
+  /** Path below the input directory, the manifest key. */
+  std::string key;
+};
+
+/** The manifest of the previous run, and the one this run writes. */
+struct BatchManifest {
+  ThumbManifest previous;
+  ThumbManifestWriter next;
+  std::mutex lock;
+
+  void add(std::string_view key, const ThumbManifestEntry &entry) {
+    std::lock_guard<std::mutex> guard(lock);
+    next.add(key, entry);
+  }
+};
+
+/** Per-worker totals, summed once all workers are done. */
+struct BatchStats {
+  uint64_t files_ok = 0;
+  uint64_t files_failed = 0;
+  uint64_t place_bytes = 0;
+  uint64_t trailer_bytes = 0;
+  uint64_t steals = 0;
+  /** Unchanged files whose output was already there. */
+  uint64_t files_skipped = 0;
+  /** Trailers read from where the manifest said they are. */
+  uint64_t manifest_reads = 0;
+};
+
+/** Indices into the file list, owned by one worker but open to thieves. */
+struct WorkQueue {
+  std::mutex lock;
+  std::deque<size_t> items;
+};
+
+class WorkPool {
+public:
+  WorkPool(size_t workers, size_t items) : _queues(workers) {
+    for (size_t i = 0; i < items; i++) {
+      _queues[i % workers].items.push_back(i);
+    }
+  }
+
+  /** Next item for \a worker, or false once every queue is empty. */
+  bool next(size_t worker, size_t *r_item, bool *r_stolen) {
+    if (pop(_queues[worker], false, r_item)) {
+      *r_stolen = false;
+      return true;
+    }
+    for (size_t i = 1; i < _queues.size(); i++) {
+      if (pop(_queues[(worker + i) % _queues.size()], true, r_item)) {
+        *r_stolen = true;
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  static bool pop(WorkQueue &queue, bool back, size_t *r_item) {
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (queue.items.empty()) {
+      return false;
+    }
+    if (back) {
+      *r_item = queue.items.back();
+      queue.items.pop_back();
+    } else {
+      *r_item = queue.items.front();
+      queue.items.pop_front();
+    }
+    return true;
+  }
+
+  std::vector<WorkQueue> _queues;
+};
+
+}  // namespace
+
+static void put16(uint8_t *p, uint32_t value) {
+  p[0] = uint8_t(value);
+  p[1] = uint8_t(value >> 8);
+}
+
+static void put32(uint8_t *p, uint32_t value) {
+  put16(p, value);
+  put16(p + 2, value >> 16);
+}
+
+/**
+ * Write \a thumb as a 24-bit BMP. The thumbnail rows already have the BMP
+ * stride, they only have to go out bottom-up.
+ */
+static bool write_bmp(const fs::path &path, const Thumbnail &thumb) {
+  static constexpr uint32_t file_header_size = 14;
+  static constexpr uint32_t info_header_size = 40;
+  const size_t stride = thumb_bgr_stride(thumb.width);
+  const uint32_t pixels_size = uint32_t(stride * thumb.height);
+
+  uint8_t header[file_header_size + info_header_size] = {'B', 'M'};
+  put32(header + 2, file_header_size + info_header_size + pixels_size);
+  put32(header + 10, file_header_size + info_header_size);
+  uint8_t *info = header + file_header_size;
+  put32(info + 0, info_header_size);
+  put32(info + 4, uint32_t(thumb.width));
+  put32(info + 8, uint32_t(thumb.height));
+  put16(info + 12, 1);  /* Planes. */
+  put16(info + 14, 24); /* Bits per pixel. */
+  put32(info + 20, pixels_size);
+  put32(info + 24, 2835); /* 72 DPI. */
+  put32(info + 28, 2835);
+
+  FILE *out = fopen(path.c_str(), "wb");
+  if (!out) {
+    return false;
+  }
+  bool ok = fwrite(header, sizeof(header), 1, out) == 1;
+  for (int y = thumb.height - 1; ok && y >= 0; y--) {
+    ok = fwrite(thumb.data.data() + y * stride, stride, 1, out) == 1;
+  }
+  return fclose(out) == 0 && ok;
+}
+
+static bool process_file(const BatchFile &file, int cx,
+                         BatchManifest *manifest, BatchStats *stats) {
+  ThumbContextLease context;
+  ThumbStageTimer timer;
+
+  /* What the previous run found, if the file is still the same. */
+  ThumbFileStamp stamp;
+  const bool stamped =
+      manifest && thumb_file_stamp(file.input.c_str(), &stamp);
+  const ThumbManifestEntry *known =
+      stamped ? manifest->previous.find(file.key) : nullptr;
+  if (known && !(known->stamp == stamp)) {
+    known = nullptr;
+  }
+  if (known) {
+    std::error_code ec;
+    if (known->status != THUMB_OK ||
+        (manifest->previous.tag() == uint64_t(cx) &&
+         fs::exists(file.output, ec))) {
+      manifest->add(file.key, *known);
+      if (known->status != THUMB_OK) {
+        fprintf(stderr, "%s: %s\n", file.input.c_str(),
+                thumb_status_message(eThumbStatus(known->status)));
+        return false;
+      }
+      stats->files_skipped++;
+      return true;
+    }
+  }
+
+  /* A known trailer is one read, mapping the file wouldn't save anything. */
+  std::unique_ptr<ThumbSource> source =
+      known ? nullptr : thumb_source_map_file(file.input.c_str());
+  if (!source) {
+    source = thumb_source_open_file(file.input.c_str());
+  }
+  if (!source) {
+    fprintf(stderr, "%s: %s\n", file.input.c_str(), strerror(errno));
+    return false;
+  }
+  ThumbTrailer trailer;
+  eThumbStatus status = THUMB_INVALID_FILE;
+  if (known) {
+    status = thumb_read_manifest_trailer(source.get(), *known,
+                                         context->buffer, &trailer);
+    stats->manifest_reads += status == THUMB_OK;
+  }
+  /* Mapped files have no separate reads, page faults count as locating. */
+  if (status != THUMB_OK) {
+    status = thumb_read_trailer(source.get(), context->buffer, &trailer);
+  }
+  timer.lap(THUMB_STAGE_LOCATE);
+  thumb_stats_add(THUMB_COUNTER_FILE_BYTES,
+                  uint64_t(std::max<int64_t>(source->size(), 0)));
+  if (stamped) {
+    manifest->add(file.key, thumb_manifest_entry(stamp, status, &trailer));
+  }
+  /* Scaling to cx happens row by row inside the decode, and is timed with
+   * it. */
+  if (status == THUMB_OK) {
+    status = thumb_jpeg_decode_fit(trailer.data, trailer.length, cx,
+                                   &context->pixels);
+    timer.lap(THUMB_STAGE_DECODE);
+  }
+  if (status != THUMB_OK) {
+    fprintf(stderr, "%s: %s\n", file.input.c_str(), thumb_status_message(status));
+    return false;
+  }
+  stats->place_bytes += uint64_t(std::max<int64_t>(source->size(), 0));
+  stats->trailer_bytes += trailer.length;
+
+  std::error_code ec;
+  fs::create_directories(file.output.parent_path(), ec);
+  if (!write_bmp(file.output, context->pixels)) {
+    fprintf(stderr, "%s: %s\n", file.output.c_str(), strerror(errno));
+    return false;
+  }
+  timer.lap(THUMB_STAGE_OUTPUT);
+  return true;
+}
+
+static void worker_main(const std::vector<BatchFile> &files, WorkPool *pool,
+                        size_t worker, int cx, BatchManifest *manifest,
+                        BatchStats *stats) {
+  size_t item;
+  bool stolen;
+  while (pool->next(worker, &item, &stolen)) {
+    stats->steals += stolen;
+    thumb_stats_add(THUMB_COUNTER_REQUESTS);
+    if (process_file(files[item], cx, manifest, stats)) {
+      stats->files_ok++;
+    } else {
+      stats->files_failed++;
+      thumb_stats_add(THUMB_COUNTER_FAILURES);
+    }
+  }
+}
+
+static bool collect_files(const fs::path &input, const fs::path &output,
+                          std::vector<BatchFile> *r_files) {
+  std::error_code ec;
+  for (fs::recursive_directory_iterator it(input, ec), end; !ec && it != end;
+       it.increment(ec)) {
+    const fs::path &path = it->path();
+    std::error_code type_ec;
+    if (!it->is_regular_file(type_ec) || path.extension() != ".rbxl") {
+      continue;
+    }
+    BatchFile file;
+    file.input = path;
+    file.output = output / path.lexically_relative(input);
+    file.output.replace_extension(".bmp");
+    file.key = path.lexically_relative(input).generic_string();
+    r_files->push_back(std::move(file));
+  }
+  if (ec) {
+    fprintf(stderr, "%s: %s\n", input.c_str(), ec.message().c_str());
+    return false;
+  }
+  /* Directory order is arbitrary; sorting keeps runs comparable. */
+  std::sort(r_files->begin(), r_files->end(),
+            [](const BatchFile &a, const BatchFile &b) {
+              return a.input < b.input;
+            });
+  return true;
+}
+
+static void print_report(const BatchStats &total, size_t workers,
+                         double seconds, bool manifest) {
+  const uint64_t files = total.files_ok + total.files_failed;
+  printf("%llu files (%llu failed) on %zu threads in %.3f s\n",
+         (unsigned long long)files, (unsigned long long)total.files_failed,
+         workers, seconds);
+  printf("%.1f files/s, %.1f MB/s places, %.1f MB/s thumbnails\n",
+         double(files) / seconds, double(total.place_bytes) / seconds / 1e6,
+         double(total.trailer_bytes) / seconds / 1e6);
+  printf("%llu files stolen from other threads\n",
+         (unsigned long long)total.steals);
+  if (manifest) {
+    printf("%llu unchanged files skipped, %llu trailers read from the "
+           "manifest\n",
+           (unsigned long long)total.files_skipped,
+           (unsigned long long)total.manifest_reads);
+  }
+
+  printf("\n");
+  thumb_stats_write(*thumb_stats(), stdout);
+}
+
+static void usage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s [-j threads] [-s size] [-S stats-file] [-m segment] "
+          "[-M manifest] <input-dir> <output-dir>\n",
+          program);
+}
+
+int main(int argc, char *argv[]) {
+  size_t workers = std::max(1u, std::thread::hardware_concurrency());
+  int cx = 256;
+  const char *stats_path = nullptr;
+  const char *manifest_path = nullptr;
+  int opt;
+  while ((opt = getopt(argc, argv, "j:s:S:m:M:")) != -1) {
+    switch (opt) {
+    case 'j':
+      workers = size_t(std::max(1, atoi(optarg)));
+      break;
+    case 's':
+      cx = atoi(optarg);
+      break;
+    case 'S':
+      stats_path = optarg;
+      break;
+    case 'm':
+      if (!thumb_stats_share(optarg)) {
+        fprintf(stderr, "%s: can't map statistics segment\n", optarg);
+        return 1;
+      }
+      break;
+    case 'M':
+      manifest_path = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (argc - optind != 2 || cx <= 0) {
+    usage(argv[0]);
+    return 1;
+  }
+  const fs::path input = argv[optind];
+  const fs::path output = argv[optind + 1];
+
+  std::vector<BatchFile> files;
+  if (!collect_files(input, output, &files)) {
+    return 1;
+  }
+  workers = std::max<size_t>(1, std::min(workers, files.size()));
+
+  /* A missing manifest opens empty, the first run builds it. */
+  std::unique_ptr<BatchManifest> manifest;
+  if (manifest_path) {
+    manifest = std::make_unique<BatchManifest>();
+    manifest->previous = ThumbManifest(thumb_source_map_file(manifest_path));
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  WorkPool pool(workers, files.size());
+  std::vector<BatchStats> stats(workers);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < workers; i++) {
+    threads.emplace_back(worker_main, std::cref(files), &pool, i, cx,
+                         manifest.get(), &stats[i]);
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  const double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+
+  BatchStats total;
+  for (const BatchStats &s : stats) {
+    total.files_ok += s.files_ok;
+    total.files_failed += s.files_failed;
+    total.place_bytes += s.place_bytes;
+    total.trailer_bytes += s.trailer_bytes;
+    total.steals += s.steals;
+    total.files_skipped += s.files_skipped;
+    total.manifest_reads += s.manifest_reads;
+  }
+  print_report(total, workers, seconds, manifest != nullptr);
+  if (manifest && !manifest->next.write(manifest_path, uint64_t(cx))) {
+    fprintf(stderr, "%s: can't write manifest\n", manifest_path);
+  }
+  if (stats_path && !thumb_stats_dump(stats_path)) {
+    perror(stats_path);
+  }
+  return total.files_failed ? 2 : 0;
+}
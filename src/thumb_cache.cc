@@ -0,0 +1,589 @@
+/** \file
+ * On-disk thumbnail cache, see thumb_cache.hh.
+ *
+ * An entry file is named after its key and holds a fixed header followed by
+ * the pixel rows, in the thumbnail's own padded stride, as one LZ4 block.
+ * Entries are written under a temporary name and renamed into place, so a
+ * reader never sees half an entry.
+ *
+ * Lookups and stores build entry paths in fixed buffers and go through the
+ * native file handles, they don't touch the heap; only the directory scans
+ * of the constructor and of eviction do.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+#ifdef _WIN32
+#  include <windows.h>
+#else
+#  include <fcntl.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+#include "thumb_cache.hh"
+#include "thumb_hash.hh"
+#include "thumb_resample.hh"
+
+namespace fs = std::filesystem;
+
+static constexpr uint32_t entry_magic = 0x4d48544b; /* "KTHM" */
+static constexpr uint32_t entry_version = 1;
+static const char entry_extension[] = ".kthumb";
+
+/* Anything claiming to be larger is a broken entry. */
+static constexpr uint32_t entry_max_pixels_bytes = 64 * 1024 * 1024;
+
+/* Longest entry path, a cache in a directory that leaves no room for the
+ * names stays empty. */
+static constexpr size_t entry_path_max = 1024;
+
+/* Eviction goes below the limit by a margin, so a full cache doesn't list
+ * the directory on every store. */
+static constexpr uint64_t evict_target_percent = 75;
+
+namespace {
+
+struct EntryHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t hash;
+  uint64_t length;
+  int32_t cx;
+  int32_t width;
+  int32_t height;
+  uint32_t raw_size;
+  uint32_t packed_size;
+  uint32_t reserved;
+};
+
+}  // namespace
+
+static_assert(sizeof(EntryHeader) == 48, "entry header must not be padded");
+
+using path_char = fs::path::value_type;
+
+/* -------------------------------------------------------------------- */
+/** \name Entry Files
+ * \{ */
+
+namespace {
+
+/** An entry file on its native handle, unlike a stream it opens without
+ * allocating a buffer. */
+class EntryFile {
+public:
+  EntryFile() = default;
+  EntryFile(const EntryFile &) = delete;
+  EntryFile &operator=(const EntryFile &) = delete;
+  ~EntryFile() { close(); }
+
+  /** Open an existing entry for reading and #touch. */
+  bool open(const path_char *path);
+  /** Create \a path for writing, failing when it already exists. */
+  bool create(const path_char *path);
+  /** Read or write exactly \a size bytes. */
+  bool read(void *data, size_t size);
+  bool write(const void *data, size_t size);
+  /** Set the modification time to now. */
+  void touch();
+  bool close();
+
+private:
+#ifdef _WIN32
+  HANDLE _handle = INVALID_HANDLE_VALUE;
+#else
+  int _fd = -1;
+#endif
+};
+
+}  // namespace
+
+#ifdef _WIN32
+
+bool EntryFile::open(const path_char *path) {
+  /* Sharing delete lets a store rename over an entry being read. */
+  _handle = CreateFileW(path, GENERIC_READ | FILE_WRITE_ATTRIBUTES,
+                        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                        nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  return _handle != INVALID_HANDLE_VALUE;
+}
+
+bool EntryFile::create(const path_char *path) {
+  _handle = CreateFileW(path, GENERIC_WRITE, 0, nullptr, CREATE_NEW,
+                        FILE_ATTRIBUTE_NORMAL, nullptr);
+  return _handle != INVALID_HANDLE_VALUE;
+}
+
+bool EntryFile::read(void *data, size_t size) {
+  uint8_t *p = static_cast<uint8_t *>(data);
+  while (size) {
+    DWORD chunk = DWORD(std::min<size_t>(size, 1 << 30)), done = 0;
+    if (!ReadFile(_handle, p, chunk, &done, nullptr) || !done) {
+      return false;
+    }
+    p += done;
+    size -= done;
+  }
+  return true;
+}
+
+bool EntryFile::write(const void *data, size_t size) {
+  const uint8_t *p = static_cast<const uint8_t *>(data);
+  while (size) {
+    DWORD chunk = DWORD(std::min<size_t>(size, 1 << 30)), done = 0;
+    if (!WriteFile(_handle, p, chunk, &done, nullptr) || !done) {
+      return false;
+    }
+    p += done;
+    size -= done;
+  }
+  return true;
+}
+
+void EntryFile::touch() {
+  FILETIME now;
+  GetSystemTimeAsFileTime(&now);
+  SetFileTime(_handle, nullptr, nullptr, &now);
+}
+
+bool EntryFile::close() {
+  bool ok = true;
+  if (_handle != INVALID_HANDLE_VALUE) {
+    ok = CloseHandle(_handle) != 0;
+    _handle = INVALID_HANDLE_VALUE;
+  }
+  return ok;
+}
+
+/** Size of the file at \a path, 0 when there is none. */
+static uint64_t entry_file_size(const path_char *path) {
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if (!GetFileAttributesExW(path, GetFileExInfoStandard, &data)) {
+    return 0;
+  }
+  return (uint64_t(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+}
+
+static bool entry_file_rename(const path_char *from, const path_char *to) {
+  return MoveFileExW(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+}
+
+static void entry_file_remove(const path_char *path) { DeleteFileW(path); }
+
+#else
+
+bool EntryFile::open(const path_char *path) {
+  _fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  return _fd >= 0;
+}
+
+bool EntryFile::create(const path_char *path) {
+  _fd = ::open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  return _fd >= 0;
+}
+
+bool EntryFile::read(void *data, size_t size) {
+  uint8_t *p = static_cast<uint8_t *>(data);
+  while (size) {
+    ssize_t done = ::read(_fd, p, size);
+    if (done < 0 && errno == EINTR) {
+      continue;
+    }
+    if (done <= 0) {
+      return false;
+    }
+    p += done;
+    size -= size_t(done);
+  }
+  return true;
+}
+
+bool EntryFile::write(const void *data, size_t size) {
+  const uint8_t *p = static_cast<const uint8_t *>(data);
+  while (size) {
+    ssize_t done = ::write(_fd, p, size);
+    if (done < 0 && errno == EINTR) {
+      continue;
+    }
+    if (done <= 0) {
+      return false;
+    }
+    p += done;
+    size -= size_t(done);
+  }
+  return true;
+}
+
+void EntryFile::touch() { futimens(_fd, nullptr); }
+
+bool EntryFile::close() {
+  bool ok = true;
+  if (_fd >= 0) {
+    ok = ::close(_fd) == 0;
+    _fd = -1;
+  }
+  return ok;
+}
+
+/** Size of the file at \a path, 0 when there is none. */
+static uint64_t entry_file_size(const path_char *path) {
+  struct stat st;
+  return stat(path, &st) == 0 ? uint64_t(st.st_size) : 0;
+}
+
+static bool entry_file_rename(const path_char *from, const path_char *to) {
+  return rename(from, to) == 0;
+}
+
+static void entry_file_remove(const path_char *path) { unlink(path); }
+
+#endif
+
+/** \} */
+
+static inline uint32_t read32(const uint8_t *p) {
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+/* -------------------------------------------------------------------- */
+/** \name LZ4 Block
+ *
+ * The LZ4 block format: a token with the literal and match lengths, the
+ * literals, then a 16-bit back reference. The compressor is the greedy
+ * single-probe one from LZ4's fast mode, which does well on the flat sky
+ * and ground of place screenshots. The decompressor checks every length
+ * against both buffers, entries on disk aren't trusted.
+ * \{ */
+
+static constexpr int lz4_hash_bits = 12;
+static constexpr size_t lz4_min_match = 4;
+/* The format requires the last 5 bytes to be literals, and no match to
+ * start in the last 12. */
+static constexpr size_t lz4_last_literals = 5;
+static constexpr size_t lz4_match_find_limit = 12;
+static constexpr size_t lz4_max_offset = 65535;
+
+static size_t lz4_bound(size_t len) {
+  return len + len / 255 + 16;
+}
+
+static uint8_t *lz4_put_length(uint8_t *op, size_t len) {
+  for (; len >= 255; len -= 255) {
+    *op++ = 255;
+  }
+  *op++ = uint8_t(len);
+  return op;
+}
+
+/** Write one sequence; a \a match_len of zero ends the block. */
+static uint8_t *lz4_put_sequence(uint8_t *op, const uint8_t *literals,
+                                 size_t literal_len, size_t offset,
+                                 size_t match_len) {
+  uint8_t *token = op++;
+  *token = uint8_t(std::min<size_t>(literal_len, 15) << 4);
+  if (literal_len >= 15) {
+    op = lz4_put_length(op, literal_len - 15);
+  }
+  memcpy(op, literals, literal_len);
+  op += literal_len;
+  if (match_len == 0) {
+    return op;
+  }
+
+  *op++ = uint8_t(offset);
+  *op++ = uint8_t(offset >> 8);
+  size_t extra = match_len - lz4_min_match;
+  *token |= uint8_t(std::min<size_t>(extra, 15));
+  if (extra >= 15) {
+    op = lz4_put_length(op, extra - 15);
+  }
+  return op;
+}
+
+/** Compress into \a dst, which must hold #lz4_bound bytes. */
+static size_t lz4_compress(const uint8_t *src, size_t len, uint8_t *dst) {
+  uint32_t table[1 << lz4_hash_bits] = {};
+  const uint8_t *ip = src;
+  const uint8_t *anchor = src;
+  const uint8_t *end = src + len;
+  uint8_t *op = dst;
+
+  if (len > lz4_match_find_limit) {
+    const uint8_t *match_limit = end - lz4_last_literals;
+    const uint8_t *find_limit = end - lz4_match_find_limit;
+    while (ip < find_limit) {
+      const uint32_t sequence = read32(ip);
+      const uint32_t h = (sequence * 2654435761u) >> (32 - lz4_hash_bits);
+      const uint8_t *ref = src + table[h];
+      table[h] = uint32_t(ip - src);
+      if (ref >= ip || size_t(ip - ref) > lz4_max_offset ||
+          read32(ref) != sequence) {
+        ip++;
+        continue;
+      }
+
+      size_t match_len = lz4_min_match;
+      while (ip + match_len < match_limit && ip[match_len] == ref[match_len]) {
+        match_len++;
+      }
+      op = lz4_put_sequence(op, anchor, size_t(ip - anchor), size_t(ip - ref),
+                            match_len);
+      ip += match_len;
+      anchor = ip;
+    }
+  }
+  op = lz4_put_sequence(op, anchor, size_t(end - anchor), 0, 0);
+  return size_t(op - dst);
+}
+
+static bool lz4_get_length(const uint8_t *&ip, const uint8_t *end,
+                           size_t *len) {
+  uint8_t byte;
+  do {
+    if (ip >= end) {
+      return false;
+    }
+    byte = *ip++;
+    *len += byte;
+  } while (byte == 255);
+  return true;
+}
+
+/** Decompress exactly \a dst_len bytes, or fail. */
+static bool lz4_decompress(const uint8_t *src, size_t len, uint8_t *dst,
+                           size_t dst_len) {
+  const uint8_t *ip = src;
+  const uint8_t *end = src + len;
+  uint8_t *op = dst;
+  uint8_t *out_end = dst + dst_len;
+
+  while (ip < end) {
+    const uint8_t token = *ip++;
+    size_t literal_len = token >> 4;
+    if (literal_len == 15 && !lz4_get_length(ip, end, &literal_len)) {
+      return false;
+    }
+    if (literal_len > size_t(end - ip) || literal_len > size_t(out_end - op)) {
+      return false;
+    }
+    memcpy(op, ip, literal_len);
+    ip += literal_len;
+    op += literal_len;
+    if (ip == end) {
+      break; /* Last sequence, literals only. */
+    }
+
+    if (end - ip < 2) {
+      return false;
+    }
+    const size_t offset = size_t(ip[0]) | (size_t(ip[1]) << 8);
+    ip += 2;
+    size_t match_len = token & 15;
+    if (match_len == 15 && !lz4_get_length(ip, end, &match_len)) {
+      return false;
+    }
+    match_len += lz4_min_match;
+    if (offset == 0 || offset > size_t(op - dst) ||
+        match_len > size_t(out_end - op)) {
+      return false;
+    }
+    const uint8_t *ref = op - offset;
+    if (offset >= match_len) {
+      memcpy(op, ref, match_len);
+      op += match_len;
+    } else {
+      /* Overlapping copy, repeats the last `offset` bytes. */
+      for (size_t i = 0; i < match_len; i++) {
+        *op++ = ref[i];
+      }
+    }
+  }
+  return op == out_end;
+}
+
+/** \} */
+
+ThumbCacheKey thumb_cache_key(const ThumbTrailer &trailer, int cx) {
+  return {thumb_hash64(trailer.data, trailer.length), trailer.length, cx};
+}
+
+ThumbCache::ThumbCache(const fs::path &directory, uint64_t max_bytes)
+    : _directory(directory), _prefix((directory / "").native()),
+      _max_bytes(max_bytes) {
+  std::error_code ec;
+  fs::create_directories(_directory, ec);
+
+  uint64_t total = 0;
+  for (fs::directory_iterator it(_directory, ec), end; !ec && it != end;
+       it.increment(ec)) {
+    if (it->path().extension() == entry_extension) {
+      std::error_code size_ec;
+      uint64_t size = it->file_size(size_ec);
+      total += size_ec ? 0 : size;
+    }
+  }
+  _bytes = total;
+}
+
+bool ThumbCache::entry_path(const ThumbCacheKey &key, uint64_t temp,
+                            path_char *r_path) const {
+  char name[96];
+  int len = snprintf(name, sizeof(name), "%016llx-%llx-%d%s",
+                     (unsigned long long)key.hash,
+                     (unsigned long long)key.length, key.cx, entry_extension);
+  if (temp) {
+    len += snprintf(name + len, sizeof(name) - size_t(len), ".tmp%llx",
+                    (unsigned long long)temp);
+  }
+  if (_prefix.size() + size_t(len) >= entry_path_max) {
+    return false;
+  }
+  /* The name is ASCII, copying widens it for Windows paths. */
+  std::copy(_prefix.begin(), _prefix.end(), r_path);
+  std::copy(name, name + len + 1, r_path + _prefix.size());
+  return true;
+}
+
+bool ThumbCache::lookup(const ThumbCacheKey &key, ThumbBuffer &scratch,
+                        Thumbnail *thumb) {
+  path_char path[entry_path_max];
+  EntryFile in;
+  EntryHeader header;
+  if (!entry_path(key, 0, path) || !in.open(path) ||
+      !in.read(&header, sizeof(header))) {
+    return false;
+  }
+  if (header.magic != entry_magic || header.version != entry_version ||
+      header.hash != key.hash || header.length != key.length ||
+      header.cx != key.cx || header.width <= 0 || header.height <= 0 ||
+      header.raw_size > entry_max_pixels_bytes ||
+      header.raw_size != thumb_bgr_stride(header.width) * header.height ||
+      header.packed_size > lz4_bound(header.raw_size)) {
+    return false;
+  }
+
+  scratch.resize(header.packed_size);
+  if (!in.read(scratch.data(), header.packed_size)) {
+    return false;
+  }
+  thumb->data.resize(header.raw_size);
+  if (!lz4_decompress(scratch.data(), scratch.size(), thumb->data.data(),
+                      thumb->data.size())) {
+    return false;
+  }
+  thumb->width = header.width;
+  thumb->height = header.height;
+
+  /* Eviction goes by modification time, keep recently used entries. */
+  in.touch();
+  return true;
+}
+
+void ThumbCache::store(const ThumbCacheKey &key, const Thumbnail &thumb,
+                       ThumbBuffer &scratch) {
+  EntryHeader header = {};
+  header.magic = entry_magic;
+  header.version = entry_version;
+  header.hash = key.hash;
+  header.length = key.length;
+  header.cx = key.cx;
+  header.width = thumb.width;
+  header.height = thumb.height;
+  header.raw_size = uint32_t(thumb.data.size());
+  if (thumb.data.size() > entry_max_pixels_bytes) {
+    return;
+  }
+
+  scratch.resize(sizeof(header) + lz4_bound(thumb.data.size()));
+  header.packed_size = uint32_t(lz4_compress(
+      thumb.data.data(), thumb.data.size(), scratch.data() + sizeof(header)));
+  memcpy(scratch.data(), &header, sizeof(header));
+  const size_t entry_size = sizeof(header) + header.packed_size;
+
+  /* Unique per thread and call, other processes may share the directory.
+   * Never 0, which names the entry itself. */
+  const uint64_t temp_id =
+      (std::hash<std::thread::id>()(std::this_thread::get_id()) ^
+       uint64_t(std::chrono::steady_clock::now().time_since_epoch().count())) |
+      1;
+  path_char path[entry_path_max], temp[entry_path_max];
+  if (!entry_path(key, 0, path) || !entry_path(key, temp_id, temp)) {
+    return;
+  }
+
+  {
+    EntryFile out;
+    if (!out.create(temp)) {
+      return;
+    }
+    if (!out.write(scratch.data(), entry_size) || !out.close()) {
+      out.close();
+      entry_file_remove(temp);
+      return;
+    }
+  }
+  /* Another thread or process may have stored the same entry already. */
+  const uint64_t replaced = entry_file_size(path);
+  if (!entry_file_rename(temp, path)) {
+    entry_file_remove(temp);
+    return;
+  }
+
+  if ((_bytes += entry_size - replaced) > _max_bytes) {
+    evict();
+  }
+}
+
+void ThumbCache::evict() {
+  std::unique_lock<std::mutex> lock(_evict_lock, std::try_to_lock);
+  if (!lock) {
+    return; /* Another thread is already at it. */
+  }
+
+  struct Entry {
+    fs::file_time_type time;
+    uint64_t size;
+    fs::path path;
+  };
+  std::vector<Entry> entries;
+  uint64_t total = 0;
+  std::error_code ec;
+  for (fs::directory_iterator it(_directory, ec), end; !ec && it != end;
+       it.increment(ec)) {
+    if (it->path().extension() != entry_extension) {
+      continue;
+    }
+    std::error_code entry_ec;
+    Entry entry;
+    entry.size = it->file_size(entry_ec);
+    entry.time = it->last_write_time(entry_ec);
+    if (entry_ec) {
+      continue;
+    }
+    entry.path = it->path();
+    total += entry.size;
+    entries.push_back(std::move(entry));
+  }
+
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry &a, const Entry &b) { return a.time < b.time; });
+  const uint64_t target = _max_bytes / 100 * evict_target_percent;
+  for (const Entry &entry : entries) {
+    if (total <= target) {
+      break;
+    }
+    if (fs::remove(entry.path, ec)) {
+      total -= entry.size;
+    }
+  }
+  _bytes = total;
+}
@@ -0,0 +1,70 @@
+/** \file
+ * Persistent cache of decoded thumbnails.
+ *
+ * Entries are keyed by a hash of the embedded JPEG and the requested size,
+ * so a place whose thumbnail didn't change is served without decoding it
+ * again, even after it was edited elsewhere or renamed. Each entry is one
+ * file holding the final, already scaled pixels, compressed with an LZ4
+ * block; a hit costs a file read, a decompress and a hash of the trailer.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <vector>
+
+#include "thumb.hh"
+
+struct ThumbCacheKey {
+  /** #thumb_hash64 of the JPEG. */
+  uint64_t hash;
+  uint64_t length;
+  /** Requested size, entries hold the thumbnail after fitting it to cx. */
+  int cx;
+};
+
+ThumbCacheKey thumb_cache_key(const ThumbTrailer &trailer, int cx);
+
+/**
+ * A directory of cache entries, bounded to roughly \a max_bytes. When a store
+ * goes over the limit the least recently used entries are removed; hits
+ * refresh an entry's modification time. Safe to share between threads, and
+ * between processes using the same directory.
+ */
+class ThumbCache {
+public:
+  ThumbCache(const std::filesystem::path &directory, uint64_t max_bytes);
+
+  /**
+   * Fill \a thumb from the entry for \a key. \a scratch holds the compressed
+   * data, pass the same vector every time to avoid reallocating it.
+   */
+  bool lookup(const ThumbCacheKey &key, ThumbBuffer &scratch,
+              Thumbnail *thumb);
+  void store(const ThumbCacheKey &key, const Thumbnail &thumb,
+             ThumbBuffer &scratch);
+
+  /** Total size of the entries, as far as this process knows. */
+  uint64_t size_bytes() const { return _bytes; }
+
+private:
+  /**
+   * Write the path of the entry for \a key to \a r_path, which holds
+   * `entry_path_max` characters. A non-zero \a temp names the file the entry
+   * is written to before it is renamed into place. False when the path
+   * doesn't fit.
+   */
+  bool entry_path(const ThumbCacheKey &key, uint64_t temp,
+                  std::filesystem::path::value_type *r_path) const;
+  void evict();
+
+  std::filesystem::path _directory;
+  /** The directory with a trailing separator, in native characters. */
+  std::filesystem::path::string_type _prefix;
+  uint64_t _max_bytes;
+  std::atomic<uint64_t> _bytes{0};
+  std::mutex _evict_lock;
+};
@@ -0,0 +1,51 @@
+/** \file
+ * Per-thread scratch reuse, see #ThumbContext.
+ */
+
+#include "thumb.hh"
+
+/* Enough for the tail window plus a 4K screenshot; anything bigger is given
+ * back when the lease ends. */
+static constexpr size_t context_keep_bytes = 64 * 1024 * 1024;
+
+static thread_local ThumbContext thread_context;
+static thread_local bool thread_context_leased = false;
+/* Arena of the innermost lease on this thread, if any. */
+static thread_local ThumbArena *thread_arena = nullptr;
+
+static void trim(ThumbBuffer &buffer) {
+  if (buffer.capacity() > context_keep_bytes) {
+    ThumbBuffer().swap(buffer);
+  }
+}
+
+ThumbArena &thumb_arena() {
+  return thread_arena ? *thread_arena : thread_context.arena;
+}
+
+ThumbContextLease::ThumbContextLease() : _outer_arena(thread_arena) {
+  /* A nested lease (a re-entrant call on the same thread) gets a private
+   * context instead of clobbering the outer one. */
+  if (thread_context_leased) {
+    _context = new ThumbContext();
+  } else {
+    thread_context_leased = true;
+    _context = &thread_context;
+  }
+  thread_arena = &_context->arena;
+}
+
+ThumbContextLease::~ThumbContextLease() {
+  thread_arena = _outer_arena;
+  if (_context != &thread_context) {
+    delete _context;
+    return;
+  }
+  trim(thread_context.buffer);
+  trim(thread_context.pixels.data);
+  trim(thread_context.scratch);
+  if (thread_context.arena.capacity() > context_keep_bytes) {
+    thread_context.arena.release();
+  }
+  thread_context_leased = false;
+}
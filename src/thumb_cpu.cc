@@ -0,0 +1,33 @@
+/** \file
+ * Runtime selection of the pixel kernels, see thumb_cpu.hh.
+ */
+
+#include <atomic>
+
+#include "thumb_cpu.hh"
+
+static std::atomic<int> simd_cap{THUMB_SIMD_AVX2};
+
+static eThumbSimdLevel detect_simd_level() {
+#ifdef THUMB_X86_64
+  if (thumb_cpu_has_avx2()) {
+    return THUMB_SIMD_AVX2;
+  }
+  if (thumb_cpu_has_ssse3()) {
+    return THUMB_SIMD_SSSE3;
+  }
+  return THUMB_SIMD_SSE2;
+#else
+  return THUMB_SIMD_SCALAR;
+#endif
+}
+
+eThumbSimdLevel thumb_simd_level() {
+  static const eThumbSimdLevel detected = detect_simd_level();
+  int cap = simd_cap.load(std::memory_order_relaxed);
+  return detected < cap ? detected : eThumbSimdLevel(cap);
+}
+
+void thumb_simd_set_cap(eThumbSimdLevel cap) {
+  simd_cap.store(cap, std::memory_order_relaxed);
+}
@@ -0,0 +1,115 @@
+/** \file
+ * CPU feature detection and helpers shared by the SIMD kernels.
+ *
+ * SSE2 is assumed on x86-64. Wider instruction sets are compiled per
+ * function with #THUMB_TARGET_AVX2 and friends and selected at runtime, so
+ * the binaries still run on older machines.
+ *
+ * AVX2 kernels that hand the end of a row to a narrower kernel clear the
+ * upper register halves first with `_mm256_zeroupper`. The narrower kernels
+ * are legacy SSE code, which runs every instruction with a penalty while
+ * the halves are dirty, and compilers don't always clear them before a
+ * tail call.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#  define THUMB_X86_64 1
+#  include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#  include <intrin.h>
+/* MSVC accepts any intrinsic without per-function target flags. */
+#  define THUMB_TARGET_SSSE3
+#  define THUMB_TARGET_AVX2
+#else
+#  define THUMB_TARGET_SSSE3 __attribute__((target("ssse3")))
+#  define THUMB_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#ifdef THUMB_X86_64
+inline bool thumb_cpu_has_avx2() {
+#  ifdef _MSC_VER
+  static const bool has_avx2 = [] {
+    int info[4];
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) {
+      return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+  }();
+  return has_avx2;
+#  else
+  return __builtin_cpu_supports("avx2");
+#  endif
+}
+
+inline bool thumb_cpu_has_ssse3() {
+#  ifdef _MSC_VER
+  static const bool has_ssse3 = [] {
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 9)) != 0;
+  }();
+  return has_ssse3;
+#  else
+  return __builtin_cpu_supports("ssse3");
+#  endif
+}
+#endif
+
+enum eThumbSimdLevel {
+  THUMB_SIMD_SCALAR = 0,
+  THUMB_SIMD_SSE2 = 1,
+  THUMB_SIMD_SSSE3 = 2,
+  THUMB_SIMD_AVX2 = 3,
+};
+
+/** Best instruction set the pixel kernels may use on this machine. */
+eThumbSimdLevel thumb_simd_level();
+
+/**
+ * Cap #thumb_simd_level, so benchmarks can time the scalar and narrower
+ * kernels on the same machine.
+ */
+void thumb_simd_set_cap(eThumbSimdLevel cap);
+
+/** Index of the lowest set bit; \a mask must not be zero. */
+inline unsigned thumb_ctz(uint32_t mask) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return unsigned(index);
+#else
+  return unsigned(__builtin_ctz(mask));
+#endif
+}
+
+/** Index of the highest set bit; \a mask must not be zero. */
+inline unsigned thumb_highest_bit(uint32_t mask) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanReverse(&index, mask);
+  return unsigned(index);
+#else
+  return 31u - unsigned(__builtin_clz(mask));
+#endif
+}
+
+/** Index of the highest set bit; \a mask must not be zero. */
+inline unsigned thumb_highest_bit64(uint64_t mask) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanReverse64(&index, mask);
+  return unsigned(index);
+#else
+  return 63u - unsigned(__builtin_clzll(mask));
+#endif
+}
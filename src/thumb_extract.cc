@@ -0,0 +1,450 @@
+/** \file
+ * Locating the JPEG trailer of a place file.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "thumb.hh"
+#include "thumb_scan.hh"
+
+static const char roblox_header[] = "<roblox";
+static const char roblox_end_tag[] = "</roblox>";
+
+static constexpr size_t header_len = sizeof(roblox_header) - 1;
+static constexpr size_t end_tag_len = sizeof(roblox_end_tag) - 1;
+
+/* The closing tag is followed by a single null byte before the JPEG. */
+static constexpr size_t trailer_gap = 1;
+
+/* Binary places start with "<roblox!" and a 32 byte file header, followed by
+ * chunks (INST, PROP, PRNT, META, ...) with a 16 byte header each: the name,
+ * the compressed and uncompressed payload lengths and a reserved word. A
+ * compressed length of zero means the payload is stored as is. The END chunk
+ * closes the file, and the JPEG is appended after it, optionally behind the
+ * same null byte XML places use. */
+static const char binary_magic[] = "<roblox!";
+static constexpr size_t binary_magic_len = sizeof(binary_magic) - 1;
+static constexpr size_t binary_header_len = 32;
+static constexpr size_t chunk_header_len = 16;
+static const char end_chunk_name[4] = {'E', 'N', 'D', '\0'};
+
+/* First tail window; big enough for most thumbnails in a single read. */
+static constexpr size_t tail_window_initial = 256 * 1024;
+
+/* Sequential reads start small, so a non-place is rejected cheaply, and
+ * double up to the maximum block size. The block is all the memory spent on
+ * the XML part of a streamed place. */
+static constexpr size_t ingest_block_min = 64 * 1024;
+static constexpr size_t ingest_block_max = 1024 * 1024;
+
+/* Largest piece of a ThumbStreamExtractor::push copied in at once. */
+static constexpr size_t push_slice = 64 * 1024;
+
+/**
+ * Cut \a buffer down to \a size bytes. Unlike `resize` this never grows it,
+ * so GCC doesn't warn (-Wstringop-overflow) about a reallocation it can't
+ * rule out when it sees the buffer is only a few bytes long.
+ */
+static void truncate_buffer(ThumbBuffer &buffer, size_t size) {
+  buffer.erase(buffer.begin() + ptrdiff_t(size), buffer.end());
+}
+
+const char *thumb_status_message(eThumbStatus status) {
+  switch (status) {
+  case THUMB_OK:
+    return "ok";
+  case THUMB_READ_ERROR:
+    return "read error";
+  case THUMB_INVALID_FILE:
+    return "not a place file";
+  case THUMB_INVALID_THUMB:
+    return "place has no thumbnail";
+  case THUMB_UNSUPPORTED:
+    return "unsupported thumbnail format";
+  }
+  return "unknown error";
+}
+
+eThumbStatus thumb_source_read_exact(ThumbSource *source, uint64_t offset,
+                                     void *buffer, size_t len) {
+  uint8_t *dst = static_cast<uint8_t *>(buffer);
+  while (len > 0) {
+    int64_t n = source->read_at(offset, dst, len);
+    if (n < 0) {
+      return THUMB_READ_ERROR;
+    }
+    if (n == 0) {
+      return THUMB_INVALID_FILE;
+    }
+    dst += n;
+    offset += uint64_t(n);
+    len -= size_t(n);
+  }
+  return THUMB_OK;
+}
+
+static bool has_roblox_header(const uint8_t *data, size_t len) {
+  return len >= header_len && memcmp(data, roblox_header, header_len) == 0;
+}
+
+static bool is_binary_place(const uint8_t *data, size_t len) {
+  return len >= binary_magic_len &&
+         memcmp(data, binary_magic, binary_magic_len) == 0;
+}
+
+static uint32_t read_le32(const uint8_t *p) {
+  return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) |
+         (uint32_t(p[3]) << 24);
+}
+
+/** Payload length of the chunk whose header is at \a header. */
+static uint64_t chunk_payload_len(const uint8_t *header, bool *r_is_end) {
+  const uint32_t compressed = read_le32(header + 4);
+  const uint32_t uncompressed = read_le32(header + 8);
+  *r_is_end = memcmp(header, end_chunk_name, sizeof(end_chunk_name)) == 0;
+  return compressed ? compressed : uncompressed;
+}
+
+/**
+ * Set \a r_trailer from the closing \a tag found in \a window, which holds
+ * the end of the file starting at \a window_offset.
+ */
+static eThumbStatus trailer_after_tag(const uint8_t *window, size_t window_len,
+                                      uint64_t window_offset,
+                                      const uint8_t *tag,
+                                      ThumbTrailer *r_trailer) {
+  size_t start = size_t(tag - window) + end_tag_len + trailer_gap;
+  if (start >= window_len) {
+    return THUMB_INVALID_THUMB; /* No data after the closing tag. */
+  }
+  r_trailer->data = window + start;
+  r_trailer->length = window_len - start;
+  r_trailer->file_offset = window_offset + start;
+  return THUMB_OK;
+}
+
+/**
+ * Read \a head_len bytes at \a offset in front of what \a buffer holds. The
+ * buffer widens in place, so once its capacity has grown to the usual window
+ * size this no longer allocates.
+ */
+static eThumbStatus prepend_window(ThumbSource *source, ThumbBuffer &buffer,
+                                   uint64_t offset, size_t head_len) {
+  const size_t old_size = buffer.size();
+  buffer.resize(head_len + old_size);
+  memmove(buffer.data() + head_len, buffer.data(), old_size);
+  return thumb_source_read_exact(source, offset, buffer.data(), head_len);
+}
+
+/**
+ * Hop from chunk header to chunk header up to the END chunk, reading 16 bytes
+ * per chunk and never the (compressed) payloads, then take what follows as
+ * the JPEG.
+ */
+static eThumbStatus read_trailer_binary(ThumbSource *source,
+                                        uint64_t file_size,
+                                        ThumbBuffer &buffer,
+                                        ThumbTrailer *r_trailer) {
+  uint64_t offset = binary_header_len;
+  bool is_end = false;
+  while (!is_end) {
+    uint8_t header[chunk_header_len];
+    if (offset + chunk_header_len > file_size) {
+      return THUMB_INVALID_FILE; /* Truncated, or no END chunk. */
+    }
+    eThumbStatus status =
+        thumb_source_read_exact(source, offset, header, chunk_header_len);
+    if (status != THUMB_OK) {
+      return status;
+    }
+    offset += chunk_header_len + chunk_payload_len(header, &is_end);
+  }
+  if (offset > file_size) {
+    return THUMB_INVALID_FILE;
+  }
+
+  size_t len = size_t(file_size - offset);
+  const uint8_t *data = len ? source->view(offset, len) : nullptr;
+  if (len && !data) {
+    buffer.resize(len);
+    eThumbStatus status =
+        thumb_source_read_exact(source, offset, buffer.data(), len);
+    if (status != THUMB_OK) {
+      return status;
+    }
+    data = buffer.data();
+  }
+  if (len && data[0] == 0) {
+    data += trailer_gap;
+    offset += trailer_gap;
+    len -= trailer_gap;
+  }
+  if (len == 0) {
+    return THUMB_INVALID_THUMB; /* Nothing after the END chunk. */
+  }
+  r_trailer->data = data;
+  r_trailer->length = len;
+  r_trailer->file_offset = offset;
+  return THUMB_OK;
+}
+
+static eThumbStatus read_trailer_tail(ThumbSource *source, uint64_t file_size,
+                                      ThumbBuffer &buffer,
+                                      ThumbTrailer *r_trailer) {
+  uint8_t header[binary_magic_len];
+  const size_t head_len = size_t(std::min<uint64_t>(file_size, sizeof(header)));
+  if (file_size < header_len) {
+    return THUMB_INVALID_FILE; /* Too short to be a place. */
+  }
+  eThumbStatus status = thumb_source_read_exact(source, 0, header, head_len);
+  if (status != THUMB_OK) {
+    return status;
+  }
+  if (!has_roblox_header(header, head_len)) {
+    return THUMB_INVALID_FILE;
+  }
+  if (is_binary_place(header, head_len)) {
+    return read_trailer_binary(source, file_size, buffer, r_trailer);
+  }
+
+  /* The window always covers the file range [window_start, file_size). Every
+   * round prepends an older slice of the file and only searches that slice,
+   * plus enough of the previous window to catch a tag straddling the seam.
+   * Mapped sources are searched in place, everything else is read into
+   * `buffer`. */
+  uint64_t window_start = file_size;
+  size_t grow = tail_window_initial;
+  const bool mapped = source->view(file_size, 0) != nullptr;
+  buffer.clear();
+
+  while (window_start > 0) {
+    size_t head_len = size_t(std::min<uint64_t>(grow, window_start));
+    uint64_t new_start = window_start - head_len;
+    size_t window_len = size_t(file_size - new_start);
+    const uint8_t *window;
+    if (mapped) {
+      window = source->view(new_start, window_len);
+      if (!window) {
+        return THUMB_READ_ERROR;
+      }
+    } else {
+      status = prepend_window(source, buffer, new_start, head_len);
+      if (status != THUMB_OK) {
+        return status;
+      }
+      window = buffer.data();
+    }
+    window_start = new_start;
+
+    size_t search_len = std::min(window_len, head_len + end_tag_len - 1);
+    const uint8_t *tag =
+        thumb_find_last(window, search_len, roblox_end_tag, end_tag_len);
+    if (tag) {
+      return trailer_after_tag(window, window_len, window_start, tag,
+                               r_trailer);
+    }
+    grow *= 2;
+  }
+  return THUMB_INVALID_FILE; /* Closing tag not found. */
+}
+
+ThumbStreamExtractor::ThumbStreamExtractor(ThumbBuffer &buffer)
+    : _buffer(buffer) {
+  _buffer.clear();
+}
+
+uint8_t *ThumbStreamExtractor::reserve(size_t len) {
+  _buffer.resize(_kept + len);
+  return _buffer.data() + _kept;
+}
+
+eThumbStatus ThumbStreamExtractor::commit(size_t len) {
+  if (_state == STATE_INVALID) {
+    return THUMB_INVALID_FILE;
+  }
+  const size_t size = _kept + len;
+  uint8_t *data = _buffer.data();
+
+  /* Forget the first `n` bytes of the buffer, keeping the rest. Nothing is
+   * moved while the JPEG comes in, or every commit would copy all of it. */
+  auto discard = [&](size_t n) {
+    if (n > 0) {
+      memmove(data, data + n, size - n);
+      _offset += n;
+    }
+    _kept = size - n;
+    truncate_buffer(_buffer, _kept);
+  };
+
+  /* Skip the next `len` bytes of a binary place, then expect a chunk
+   * header, or the JPEG after the END chunk. */
+  auto skip_payload = [&](uint64_t len) {
+    _skip = len;
+    _state = len ? STATE_CHUNK_DATA
+                 : _end_chunk ? STATE_END_GAP : STATE_CHUNK_HEADER;
+  };
+
+  if (_state == STATE_HEADER) {
+    /* One byte more than the XML header tells the two formats apart. */
+    if (size < binary_magic_len) {
+      _kept = size;
+      truncate_buffer(_buffer, _kept);
+      return THUMB_OK;
+    }
+    if (!has_roblox_header(data, size)) {
+      _state = STATE_INVALID;
+      _kept = 0;
+      _buffer.clear();
+      return THUMB_INVALID_FILE;
+    }
+    if (is_binary_place(data, size)) {
+      _binary = true;
+      _end_chunk = false;
+      skip_payload(binary_header_len);
+    } else {
+      _state = STATE_SCAN;
+    }
+  }
+
+  size_t pos = 0;
+  size_t from =
+      _state == STATE_SCAN ? 0 : _kept - std::min(_kept, end_tag_len - 1);
+  bool searched = false;
+  for (;;) {
+    if (!searched &&
+        (_state == STATE_SCAN || (_state == STATE_TRAILER && !_binary))) {
+      /* The JPEG of an XML place is searched as well, since the last
+       * closing tag wins (see #thumb_read_trailer). Only the new bytes are,
+       * plus enough of the old ones to catch a tag cut in two. */
+      searched = true;
+      const uint8_t *tag = thumb_find_last(data + from, size - from,
+                                           roblox_end_tag, end_tag_len);
+      if (tag) {
+        pos = size_t(tag - data) + end_tag_len;
+        _skip = trailer_gap;
+        _state = STATE_GAP;
+      } else if (_state == STATE_SCAN) {
+        /* Hold on to what could be the start of a tag cut in two. */
+        discard(size - std::min(size, end_tag_len - 1));
+        return THUMB_OK;
+      }
+    }
+    if (_state != STATE_GAP) {
+      break;
+    }
+    size_t n = size_t(std::min<uint64_t>(_skip, size - pos));
+    pos += n;
+    _skip -= n;
+    if (_skip > 0) {
+      break;
+    }
+    /* A gap left over from the previous commit: what follows it here has
+     * not been searched for a later tag yet. */
+    _state = STATE_TRAILER;
+    from = pos;
+  }
+
+  /* Binary places: payloads are dropped as they stream past, only a chunk
+   * header cut in two is kept until the rest arrives. */
+  while (pos < size) {
+    if (_state == STATE_CHUNK_DATA) {
+      size_t n = size_t(std::min<uint64_t>(_skip, size - pos));
+      pos += n;
+      skip_payload(_skip - n);
+    } else if (_state == STATE_CHUNK_HEADER) {
+      if (size - pos < chunk_header_len) {
+        break;
+      }
+      uint64_t len = chunk_payload_len(data + pos, &_end_chunk);
+      pos += chunk_header_len;
+      skip_payload(len);
+    } else if (_state == STATE_END_GAP) {
+      pos += data[pos] == 0 ? trailer_gap : 0;
+      _state = STATE_TRAILER;
+    } else {
+      break;
+    }
+  }
+  /* In the trailer state everything from here on is JPEG. */
+  discard(pos);
+  return THUMB_OK;
+}
+
+eThumbStatus ThumbStreamExtractor::push(const uint8_t *data, size_t len) {
+  /* Copied over in slices, so a caller handing in the whole place at once
+   * doesn't make the buffer grow to its size. */
+  while (len > 0) {
+    size_t n = std::min(len, push_slice);
+    memcpy(reserve(n), data, n);
+    eThumbStatus status = commit(n);
+    if (status != THUMB_OK) {
+      return status;
+    }
+    data += n;
+    len -= n;
+  }
+  return THUMB_OK;
+}
+
+eThumbStatus ThumbStreamExtractor::finish(ThumbTrailer *r_trailer) {
+  switch (_state) {
+  case STATE_TRAILER:
+    if (_kept == 0) {
+      return THUMB_INVALID_THUMB;
+    }
+    r_trailer->data = _buffer.data();
+    r_trailer->length = _kept;
+    r_trailer->file_offset = _offset;
+    return THUMB_OK;
+  case STATE_GAP:
+  case STATE_END_GAP:
+    return THUMB_INVALID_THUMB; /* No data after the closing tag. */
+  default:
+    return THUMB_INVALID_FILE; /* Not a place, or closing tag not found. */
+  }
+}
+
+/**
+ * Stream a sequential source through a #ThumbStreamExtractor, reading
+ * straight into its buffer. Reads never ask for more than the size hint
+ * says is left (plus one byte to see the end of the stream).
+ */
+static eThumbStatus read_trailer_sequential(ThumbSource *source,
+                                            ThumbBuffer &buffer,
+                                            ThumbTrailer *r_trailer) {
+  ThumbStreamExtractor extractor(buffer);
+  const int64_t hint = source->size_hint();
+  uint64_t consumed = 0;
+  size_t block = ingest_block_min;
+
+  for (;;) {
+    size_t want = block;
+    if (hint >= 0 && consumed <= uint64_t(hint)) {
+      want = size_t(std::min<uint64_t>(block, uint64_t(hint) - consumed + 1));
+    }
+    int64_t n = source->read(extractor.reserve(want), want);
+    if (n < 0) {
+      return THUMB_READ_ERROR;
+    }
+    eThumbStatus status = extractor.commit(size_t(n));
+    if (status != THUMB_OK) {
+      return status;
+    }
+    if (n == 0) {
+      break;
+    }
+    consumed += uint64_t(n);
+    block = std::min(block * 2, ingest_block_max);
+  }
+  return extractor.finish(r_trailer);
+}
+
+eThumbStatus thumb_read_trailer(ThumbSource *source, ThumbBuffer &buffer,
+                                ThumbTrailer *r_trailer) {
+  int64_t file_size = source->size();
+  if (file_size < 0) {
+    return read_trailer_sequential(source, buffer, r_trailer);
+  }
+  return read_trailer_tail(source, uint64_t(file_size), buffer, r_trailer);
+}
@@ -0,0 +1,91 @@
+/** \file
+ * XXH64, see thumb_hash.hh. Four independent lanes consume 32 bytes per
+ * round, which keeps the multipliers busy; the tail is mixed in 8, 4 and 1
+ * byte steps. Input is read as little endian.
+ */
+
+#include <cstring>
+
+#include "thumb_hash.hh"
+
+static constexpr uint64_t prime1 = 0x9E3779B185EBCA87ull;
+static constexpr uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+static constexpr uint64_t prime3 = 0x165667B19E3779F9ull;
+static constexpr uint64_t prime4 = 0x85EBCA77C2B2AE63ull;
+static constexpr uint64_t prime5 = 0x27D4EB2F165667C5ull;
+
+static inline uint64_t rotl(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const uint8_t *p) {
+  uint64_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static inline uint32_t read32(const uint8_t *p) {
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static inline uint64_t lane_round(uint64_t acc, uint64_t input) {
+  acc += input * prime2;
+  return rotl(acc, 31) * prime1;
+}
+
+static inline uint64_t merge(uint64_t acc, uint64_t lane) {
+  acc ^= lane_round(0, lane);
+  return acc * prime1 + prime4;
+}
+
+uint64_t thumb_hash64(const void *data, size_t len, uint64_t seed) {
+  const uint8_t *p = static_cast<const uint8_t *>(data);
+  const uint8_t *end = p + len;
+  uint64_t h;
+
+  if (len >= 32) {
+    uint64_t v1 = seed + prime1 + prime2;
+    uint64_t v2 = seed + prime2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - prime1;
+    const uint8_t *limit = end - 32;
+    do {
+      v1 = lane_round(v1, read64(p));
+      v2 = lane_round(v2, read64(p + 8));
+      v3 = lane_round(v3, read64(p + 16));
+      v4 = lane_round(v4, read64(p + 24));
+      p += 32;
+    } while (p <= limit);
+    h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+    h = merge(h, v1);
+    h = merge(h, v2);
+    h = merge(h, v3);
+    h = merge(h, v4);
+  } else {
+    h = seed + prime5;
+  }
+  h += uint64_t(len);
+
+  for (; p + 8 <= end; p += 8) {
+    h ^= lane_round(0, read64(p));
+    h = rotl(h, 27) * prime1 + prime4;
+  }
+  if (p + 4 <= end) {
+    h ^= uint64_t(read32(p)) * prime1;
+    h = rotl(h, 23) * prime2 + prime3;
+    p += 4;
+  }
+  for (; p < end; p++) {
+    h ^= *p * prime5;
+    h = rotl(h, 11) * prime1;
+  }
+
+  h ^= h >> 33;
+  h *= prime2;
+  h ^= h >> 29;
+  h *= prime3;
+  h ^= h >> 32;
+  return h;
+}
@@ -0,0 +1,14 @@
+/** \file
+ * Fast non-cryptographic hashing of trailer bytes.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * 64-bit hash of \a len bytes at \a data. Produces the same values as XXH64,
+ * so keys can be checked against the reference implementation.
+ */
+uint64_t thumb_hash64(const void *data, size_t len, uint64_t seed = 0);
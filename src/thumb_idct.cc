@@ -0,0 +1,598 @@
+/** \file
+ * Inverse DCT kernels, see thumb_idct.hh.
+ *
+ * Full size blocks use the accurate integer IDCT from the IJG code
+ * (Loeffler, Ligtenberg and Moschytz, 13-bit constants). Reduced sizes only
+ * use the lowest N x N coefficients, transformed with an N-point IDCT
+ * matrix, which is what decoding at 1/2 and 1/4 scale amounts to.
+ */
+
+#include "thumb_cpu.hh"
+#include "thumb_idct.hh"
+
+static inline uint8_t clamp_u8(int64_t x) {
+  return uint8_t(x < 0 ? 0 : (x > 255 ? 255 : x));
+}
+
+/* -------------------------------------------------------------------- */
+/** \name Scalar
+ * \{ */
+
+static constexpr int const_bits = 13;
+static constexpr int pass1_bits = 2;
+
+#define FIX(x) int32_t((x) * (1 << const_bits) + 0.5)
+
+static inline int32_t descale(int32_t x, int n) {
+  return (x + (1 << (n - 1))) >> n;
+}
+
+static void idct_8x8(const int16_t *coef, uint8_t *out, size_t stride) {
+  int32_t ws[64];
+
+  for (int col = 0; col < 8; col++) {
+    const int16_t *in = coef + col;
+    int32_t *w = ws + col;
+    if (!in[8] && !in[16] && !in[24] && !in[32] && !in[40] && !in[48] &&
+        !in[56]) {
+      int32_t dc = in[0] * (1 << pass1_bits);
+      for (int row = 0; row < 8; row++) {
+        w[row * 8] = dc;
+      }
+      continue;
+    }
+
+    int32_t z2 = in[16], z3 = in[48];
+    int32_t z1 = (z2 + z3) * FIX(0.541196100);
+    int32_t tmp2 = z1 + z3 * -FIX(1.847759065);
+    int32_t tmp3 = z1 + z2 * FIX(0.765366865);
+    z2 = in[0];
+    z3 = in[32];
+    int32_t tmp0 = (z2 + z3) * (1 << const_bits);
+    int32_t tmp1 = (z2 - z3) * (1 << const_bits);
+    int32_t tmp10 = tmp0 + tmp3, tmp13 = tmp0 - tmp3;
+    int32_t tmp11 = tmp1 + tmp2, tmp12 = tmp1 - tmp2;
+
+    tmp0 = in[56];
+    tmp1 = in[40];
+    tmp2 = in[24];
+    tmp3 = in[8];
+    z1 = tmp0 + tmp3;
+    z2 = tmp1 + tmp2;
+    z3 = tmp0 + tmp2;
+    int32_t z4 = tmp1 + tmp3;
+    int32_t z5 = (z3 + z4) * FIX(1.175875602);
+    tmp0 *= FIX(0.298631336);
+    tmp1 *= FIX(2.053119869);
+    tmp2 *= FIX(3.072711026);
+    tmp3 *= FIX(1.501321110);
+    z1 *= -FIX(0.899976223);
+    z2 *= -FIX(2.562915447);
+    z3 = z3 * -FIX(1.961570560) + z5;
+    z4 = z4 * -FIX(0.390180644) + z5;
+    tmp0 += z1 + z3;
+    tmp1 += z2 + z4;
+    tmp2 += z2 + z3;
+    tmp3 += z1 + z4;
+
+    const int shift = const_bits - pass1_bits;
+    w[0] = descale(tmp10 + tmp3, shift);
+    w[56] = descale(tmp10 - tmp3, shift);
+    w[8] = descale(tmp11 + tmp2, shift);
+    w[48] = descale(tmp11 - tmp2, shift);
+    w[16] = descale(tmp12 + tmp1, shift);
+    w[40] = descale(tmp12 - tmp1, shift);
+    w[24] = descale(tmp13 + tmp0, shift);
+    w[32] = descale(tmp13 - tmp0, shift);
+  }
+
+  for (int row = 0; row < 8; row++) {
+    const int32_t *w = ws + row * 8;
+    uint8_t *o = out + row * stride;
+    const int shift = const_bits + pass1_bits + 3;
+    /* Fold the +128 level shift into the rounding term. Garbage input can
+     * exceed 32 bits here, valid data never does. */
+    const int64_t bias = (int64_t(128) << shift) + (1 << (shift - 1));
+
+    int64_t z2 = w[2], z3 = w[6];
+    int64_t z1 = (z2 + z3) * FIX(0.541196100);
+    int64_t tmp2 = z1 + z3 * -FIX(1.847759065);
+    int64_t tmp3 = z1 + z2 * FIX(0.765366865);
+    int64_t tmp0 = (w[0] + w[4]) * (1 << const_bits) + bias;
+    int64_t tmp1 = (w[0] - w[4]) * (1 << const_bits) + bias;
+    int64_t tmp10 = tmp0 + tmp3, tmp13 = tmp0 - tmp3;
+    int64_t tmp11 = tmp1 + tmp2, tmp12 = tmp1 - tmp2;
+
+    tmp0 = w[7];
+    tmp1 = w[5];
+    tmp2 = w[3];
+    tmp3 = w[1];
+    z1 = tmp0 + tmp3;
+    z2 = tmp1 + tmp2;
+    z3 = tmp0 + tmp2;
+    int64_t z4 = tmp1 + tmp3;
+    int64_t z5 = (z3 + z4) * FIX(1.175875602);
+    tmp0 *= FIX(0.298631336);
+    tmp1 *= FIX(2.053119869);
+    tmp2 *= FIX(3.072711026);
+    tmp3 *= FIX(1.501321110);
+    z1 *= -FIX(0.899976223);
+    z2 *= -FIX(2.562915447);
+    z3 = z3 * -FIX(1.961570560) + z5;
+    z4 = z4 * -FIX(0.390180644) + z5;
+    tmp0 += z1 + z3;
+    tmp1 += z2 + z4;
+    tmp2 += z2 + z3;
+    tmp3 += z1 + z4;
+
+    o[0] = clamp_u8((tmp10 + tmp3) >> shift);
+    o[7] = clamp_u8((tmp10 - tmp3) >> shift);
+    o[1] = clamp_u8((tmp11 + tmp2) >> shift);
+    o[6] = clamp_u8((tmp11 - tmp2) >> shift);
+    o[2] = clamp_u8((tmp12 + tmp1) >> shift);
+    o[5] = clamp_u8((tmp12 - tmp1) >> shift);
+    o[3] = clamp_u8((tmp13 + tmp0) >> shift);
+    o[4] = clamp_u8((tmp13 - tmp0) >> shift);
+  }
+}
+
+/**
+ * `C(u) / 2 * cos((2i + 1) u pi / 2N)` for the N-point IDCTs, in
+ * #const_bits fixed point. With C(0) = 1/sqrt(2) this gives the same DC gain
+ * as the 8-point transform.
+ */
+static const int32_t idct4_matrix[4][4] = {
+    {FIX(0.353553391), FIX(0.461939766), FIX(0.353553391), FIX(0.191341716)},
+    {FIX(0.353553391), FIX(0.191341716), -FIX(0.353553391), -FIX(0.461939766)},
+    {FIX(0.353553391), -FIX(0.191341716), -FIX(0.353553391), FIX(0.461939766)},
+    {FIX(0.353553391), -FIX(0.461939766), FIX(0.353553391), -FIX(0.191341716)},
+};
+
+static const int32_t idct2_matrix[2][2] = {
+    {FIX(0.353553391), FIX(0.353553391)},
+    {FIX(0.353553391), -FIX(0.353553391)},
+};
+
+template<int N>
+static void idct_reduced(const int16_t *coef, const int32_t (*matrix)[N],
+                         uint8_t *out, size_t stride) {
+  int32_t ws[N][N];
+  for (int col = 0; col < N; col++) {
+    for (int row = 0; row < N; row++) {
+      int32_t sum = 0;
+      for (int v = 0; v < N; v++) {
+        sum += matrix[row][v] * coef[v * 8 + col];
+      }
+      ws[row][col] = descale(sum, const_bits - pass1_bits);
+    }
+  }
+
+  const int shift = const_bits + pass1_bits;
+  const int64_t bias = (int64_t(128) << shift) + (1 << (shift - 1));
+  for (int row = 0; row < N; row++) {
+    uint8_t *o = out + row * stride;
+    for (int col = 0; col < N; col++) {
+      int64_t sum = bias;
+      for (int u = 0; u < N; u++) {
+        sum += matrix[col][u] * ws[row][u];
+      }
+      o[col] = clamp_u8(sum >> shift);
+    }
+  }
+}
+
+static void idct_1x1(const int16_t *coef, uint8_t *out, size_t /*stride*/) {
+  out[0] = clamp_u8(((coef[0] + 4) >> 3) + 128);
+}
+
+/** \} */
+
+#ifdef THUMB_X86_64
+
+/* -------------------------------------------------------------------- */
+/** \name SSE2 and AVX2
+ *
+ * The 8x8 transform with a whole row of the block per register: the first
+ * pass works down the columns of eight rows at once, the block is
+ * transposed, and the second pass does the same for the rows. Every
+ * rotation is rewritten as a sum of two products, e.g.
+ * `(z2 + z3) * c1 + z2 * c2 = z2 * (c1 + c2) + z3 * c1`, which `pmaddwd`
+ * computes from interleaved 16-bit pairs exactly. AVX2 transforms two
+ * horizontally adjacent blocks at once, one per 128-bit lane, since the
+ * lane-local shuffles of a single block cost more than they save.
+ *
+ * Between the passes the samples are narrowed to 16 bits. Blocks whose
+ * first pass leaves #simd_pass1_limit, which takes coefficients no encoder
+ * produces, go to the scalar kernel: their second pass needs more than the
+ * 32 bits the vector one has.
+ * \{ */
+
+/**
+ * Largest first pass result the vector second pass takes. Pair sums stay
+ * within 16 bits, and the most any second pass term gains over its inputs,
+ * 61214 with the 13-bit constants, keeps everything within 32.
+ */
+static constexpr int simd_pass1_limit = 16383;
+
+/** Coefficients of a pmaddwd pair, \a a for the low word. */
+static inline __m128i pair_const(int32_t a, int32_t b) {
+  return _mm_set1_epi32(
+      int32_t(uint32_t(uint16_t(a)) | (uint32_t(uint16_t(b)) << 16)));
+}
+
+/* The pair coefficients of both passes, see the scalar code for the terms
+ * they come from. */
+#define EVEN_TMP3 \
+  FIX(0.541196100) + FIX(0.765366865), FIX(0.541196100)
+#define EVEN_TMP2 \
+  FIX(0.541196100), FIX(0.541196100) - FIX(1.847759065)
+#define ODD_Z3 FIX(1.175875602) - FIX(1.961570560), FIX(1.175875602)
+#define ODD_Z4 FIX(1.175875602), FIX(1.175875602) - FIX(0.390180644)
+#define ODD_TMP0 FIX(0.298631336) - FIX(0.899976223), -FIX(0.899976223)
+#define ODD_TMP3 -FIX(0.899976223), FIX(1.501321110) - FIX(0.899976223)
+#define ODD_TMP1 FIX(2.053119869) - FIX(2.562915447), -FIX(2.562915447)
+#define ODD_TMP2 -FIX(2.562915447), FIX(3.072711026) - FIX(2.562915447)
+
+namespace {
+
+/** Eight 32-bit lanes in two registers. */
+struct Wide128 {
+  __m128i lo, hi;
+};
+
+inline Wide128 operator+(Wide128 a, Wide128 b) {
+  return {_mm_add_epi32(a.lo, b.lo), _mm_add_epi32(a.hi, b.hi)};
+}
+
+inline Wide128 operator-(Wide128 a, Wide128 b) {
+  return {_mm_sub_epi32(a.lo, b.lo), _mm_sub_epi32(a.hi, b.hi)};
+}
+
+}  // namespace
+
+static inline Wide128 madd_sse2(__m128i a, __m128i b, __m128i k) {
+  return {_mm_madd_epi16(_mm_unpacklo_epi16(a, b), k),
+          _mm_madd_epi16(_mm_unpackhi_epi16(a, b), k)};
+}
+
+/** \a v times `1 << const_bits`, sign extended. */
+static inline Wide128 widen_sse2(__m128i v, __m128i bias) {
+  const __m128i zero = _mm_setzero_si128();
+  const int shift = 16 - const_bits;
+  return {_mm_add_epi32(_mm_srai_epi32(_mm_unpacklo_epi16(zero, v), shift),
+                        bias),
+          _mm_add_epi32(_mm_srai_epi32(_mm_unpackhi_epi16(zero, v), shift),
+                        bias)};
+}
+
+template<int Shift> static inline __m128i narrow_sse2(Wide128 v) {
+  return _mm_packs_epi32(_mm_srai_epi32(v.lo, Shift),
+                         _mm_srai_epi32(v.hi, Shift));
+}
+
+/**
+ * One 1-D pass over registers \a x, lane i of each holding one line of the
+ * block: `(x + bias) >> Shift` of the transform, narrowed to 16 bits.
+ */
+template<int Shift>
+static inline void idct_pass_sse2(__m128i x[8], __m128i bias) {
+  const Wide128 tmp3 = madd_sse2(x[2], x[6], pair_const(EVEN_TMP3));
+  const Wide128 tmp2 = madd_sse2(x[2], x[6], pair_const(EVEN_TMP2));
+  const Wide128 tmp0 = widen_sse2(_mm_add_epi16(x[0], x[4]), bias);
+  const Wide128 tmp1 = widen_sse2(_mm_sub_epi16(x[0], x[4]), bias);
+  const Wide128 tmp10 = tmp0 + tmp3, tmp13 = tmp0 - tmp3;
+  const Wide128 tmp11 = tmp1 + tmp2, tmp12 = tmp1 - tmp2;
+
+  const __m128i z3 = _mm_add_epi16(x[7], x[3]);
+  const __m128i z4 = _mm_add_epi16(x[5], x[1]);
+  const Wide128 z3r = madd_sse2(z3, z4, pair_const(ODD_Z3));
+  const Wide128 z4r = madd_sse2(z3, z4, pair_const(ODD_Z4));
+  const Wide128 odd0 = madd_sse2(x[7], x[1], pair_const(ODD_TMP0)) + z3r;
+  const Wide128 odd3 = madd_sse2(x[7], x[1], pair_const(ODD_TMP3)) + z4r;
+  const Wide128 odd1 = madd_sse2(x[5], x[3], pair_const(ODD_TMP1)) + z4r;
+  const Wide128 odd2 = madd_sse2(x[5], x[3], pair_const(ODD_TMP2)) + z3r;
+
+  x[0] = narrow_sse2<Shift>(tmp10 + odd3);
+  x[7] = narrow_sse2<Shift>(tmp10 - odd3);
+  x[1] = narrow_sse2<Shift>(tmp11 + odd2);
+  x[6] = narrow_sse2<Shift>(tmp11 - odd2);
+  x[2] = narrow_sse2<Shift>(tmp12 + odd1);
+  x[5] = narrow_sse2<Shift>(tmp12 - odd1);
+  x[3] = narrow_sse2<Shift>(tmp13 + odd0);
+  x[4] = narrow_sse2<Shift>(tmp13 - odd0);
+}
+
+static inline void transpose_8x8_epi16(__m128i x[8]) {
+  const __m128i a0 = _mm_unpacklo_epi16(x[0], x[1]);
+  const __m128i a1 = _mm_unpackhi_epi16(x[0], x[1]);
+  const __m128i a2 = _mm_unpacklo_epi16(x[2], x[3]);
+  const __m128i a3 = _mm_unpackhi_epi16(x[2], x[3]);
+  const __m128i a4 = _mm_unpacklo_epi16(x[4], x[5]);
+  const __m128i a5 = _mm_unpackhi_epi16(x[4], x[5]);
+  const __m128i a6 = _mm_unpacklo_epi16(x[6], x[7]);
+  const __m128i a7 = _mm_unpackhi_epi16(x[6], x[7]);
+  const __m128i b0 = _mm_unpacklo_epi32(a0, a2);
+  const __m128i b1 = _mm_unpackhi_epi32(a0, a2);
+  const __m128i b2 = _mm_unpacklo_epi32(a1, a3);
+  const __m128i b3 = _mm_unpackhi_epi32(a1, a3);
+  const __m128i b4 = _mm_unpacklo_epi32(a4, a6);
+  const __m128i b5 = _mm_unpackhi_epi32(a4, a6);
+  const __m128i b6 = _mm_unpacklo_epi32(a5, a7);
+  const __m128i b7 = _mm_unpackhi_epi32(a5, a7);
+  x[0] = _mm_unpacklo_epi64(b0, b4);
+  x[1] = _mm_unpackhi_epi64(b0, b4);
+  x[2] = _mm_unpacklo_epi64(b1, b5);
+  x[3] = _mm_unpackhi_epi64(b1, b5);
+  x[4] = _mm_unpacklo_epi64(b2, b6);
+  x[5] = _mm_unpackhi_epi64(b2, b6);
+  x[6] = _mm_unpacklo_epi64(b3, b7);
+  x[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+static inline bool within_pass1_limit(const __m128i x[8]) {
+  __m128i high = x[0], low = x[0];
+  for (int i = 1; i < 8; i++) {
+    high = _mm_max_epi16(high, x[i]);
+    low = _mm_min_epi16(low, x[i]);
+  }
+  const __m128i outside = _mm_or_si128(
+      _mm_cmpgt_epi16(high, _mm_set1_epi16(simd_pass1_limit)),
+      _mm_cmplt_epi16(low, _mm_set1_epi16(-simd_pass1_limit - 1)));
+  return _mm_movemask_epi8(outside) == 0;
+}
+
+static inline void load_block(const int16_t *coef, __m128i x[8]) {
+  for (int i = 0; i < 8; i++) {
+    x[i] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(coef + i * 8));
+  }
+}
+
+/** Transpose the second pass output back to rows and store it clamped. */
+static inline void store_block(__m128i x[8], uint8_t *out, size_t stride) {
+  transpose_8x8_epi16(x);
+  for (int i = 0; i < 8; i += 2) {
+    const __m128i rows = _mm_packus_epi16(x[i], x[i + 1]);
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(out + i * stride), rows);
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(out + (i + 1) * stride),
+                     _mm_srli_si128(rows, 8));
+  }
+}
+
+static constexpr int pass2_shift = const_bits + pass1_bits + 3;
+/** Rounding of both passes; the second also undoes the level shift. */
+static constexpr int32_t pass1_bias = 1 << (const_bits - pass1_bits - 1);
+static constexpr int32_t pass2_bias = (128 << pass2_shift) +
+                                      (1 << (pass2_shift - 1));
+
+static void idct_8x8_sse2(const int16_t *coef, uint8_t *out, size_t stride) {
+  __m128i x[8];
+  load_block(coef, x);
+  idct_pass_sse2<const_bits - pass1_bits>(x, _mm_set1_epi32(pass1_bias));
+  if (!within_pass1_limit(x)) {
+    idct_8x8(coef, out, stride);
+    return;
+  }
+  transpose_8x8_epi16(x);
+  idct_pass_sse2<pass2_shift>(x, _mm_set1_epi32(pass2_bias));
+  store_block(x, out, stride);
+}
+
+namespace {
+
+/** Eight 32-bit lanes of each of two blocks. */
+struct Wide256 {
+  __m256i lo, hi;
+};
+
+}  // namespace
+
+THUMB_TARGET_AVX2 static inline Wide256 add_avx2(Wide256 a, Wide256 b) {
+  return {_mm256_add_epi32(a.lo, b.lo), _mm256_add_epi32(a.hi, b.hi)};
+}
+
+THUMB_TARGET_AVX2 static inline Wide256 sub_avx2(Wide256 a, Wide256 b) {
+  return {_mm256_sub_epi32(a.lo, b.lo), _mm256_sub_epi32(a.hi, b.hi)};
+}
+
+THUMB_TARGET_AVX2
+static inline Wide256 madd_avx2(__m256i a, __m256i b, __m128i k) {
+  const __m256i pair = _mm256_broadcastsi128_si256(k);
+  return {_mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), pair),
+          _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), pair)};
+}
+
+THUMB_TARGET_AVX2
+static inline Wide256 widen_avx2(__m256i v, __m256i bias) {
+  const __m256i zero = _mm256_setzero_si256();
+  const int shift = 16 - const_bits;
+  return {_mm256_add_epi32(
+              _mm256_srai_epi32(_mm256_unpacklo_epi16(zero, v), shift), bias),
+          _mm256_add_epi32(
+              _mm256_srai_epi32(_mm256_unpackhi_epi16(zero, v), shift),
+              bias)};
+}
+
+template<int Shift>
+THUMB_TARGET_AVX2 static inline __m256i narrow_avx2(Wide256 v) {
+  return _mm256_packs_epi32(_mm256_srai_epi32(v.lo, Shift),
+                            _mm256_srai_epi32(v.hi, Shift));
+}
+
+template<int Shift>
+THUMB_TARGET_AVX2 static inline void idct_pass_avx2(__m256i x[8],
+                                                    __m256i bias) {
+  const Wide256 tmp3 = madd_avx2(x[2], x[6], pair_const(EVEN_TMP3));
+  const Wide256 tmp2 = madd_avx2(x[2], x[6], pair_const(EVEN_TMP2));
+  const Wide256 tmp0 = widen_avx2(_mm256_add_epi16(x[0], x[4]), bias);
+  const Wide256 tmp1 = widen_avx2(_mm256_sub_epi16(x[0], x[4]), bias);
+  const Wide256 tmp10 = add_avx2(tmp0, tmp3), tmp13 = sub_avx2(tmp0, tmp3);
+  const Wide256 tmp11 = add_avx2(tmp1, tmp2), tmp12 = sub_avx2(tmp1, tmp2);
+
+  const __m256i z3 = _mm256_add_epi16(x[7], x[3]);
+  const __m256i z4 = _mm256_add_epi16(x[5], x[1]);
+  const Wide256 z3r = madd_avx2(z3, z4, pair_const(ODD_Z3));
+  const Wide256 z4r = madd_avx2(z3, z4, pair_const(ODD_Z4));
+  const Wide256 odd0 =
+      add_avx2(madd_avx2(x[7], x[1], pair_const(ODD_TMP0)), z3r);
+  const Wide256 odd3 =
+      add_avx2(madd_avx2(x[7], x[1], pair_const(ODD_TMP3)), z4r);
+  const Wide256 odd1 =
+      add_avx2(madd_avx2(x[5], x[3], pair_const(ODD_TMP1)), z4r);
+  const Wide256 odd2 =
+      add_avx2(madd_avx2(x[5], x[3], pair_const(ODD_TMP2)), z3r);
+
+  x[0] = narrow_avx2<Shift>(add_avx2(tmp10, odd3));
+  x[7] = narrow_avx2<Shift>(sub_avx2(tmp10, odd3));
+  x[1] = narrow_avx2<Shift>(add_avx2(tmp11, odd2));
+  x[6] = narrow_avx2<Shift>(sub_avx2(tmp11, odd2));
+  x[2] = narrow_avx2<Shift>(add_avx2(tmp12, odd1));
+  x[5] = narrow_avx2<Shift>(sub_avx2(tmp12, odd1));
+  x[3] = narrow_avx2<Shift>(add_avx2(tmp13, odd0));
+  x[4] = narrow_avx2<Shift>(sub_avx2(tmp13, odd0));
+}
+
+THUMB_TARGET_AVX2
+static inline void transpose_8x8_epi16_avx2(__m256i x[8]) {
+  const __m256i a0 = _mm256_unpacklo_epi16(x[0], x[1]);
+  const __m256i a1 = _mm256_unpackhi_epi16(x[0], x[1]);
+  const __m256i a2 = _mm256_unpacklo_epi16(x[2], x[3]);
+  const __m256i a3 = _mm256_unpackhi_epi16(x[2], x[3]);
+  const __m256i a4 = _mm256_unpacklo_epi16(x[4], x[5]);
+  const __m256i a5 = _mm256_unpackhi_epi16(x[4], x[5]);
+  const __m256i a6 = _mm256_unpacklo_epi16(x[6], x[7]);
+  const __m256i a7 = _mm256_unpackhi_epi16(x[6], x[7]);
+  const __m256i b0 = _mm256_unpacklo_epi32(a0, a2);
+  const __m256i b1 = _mm256_unpackhi_epi32(a0, a2);
+  const __m256i b2 = _mm256_unpacklo_epi32(a1, a3);
+  const __m256i b3 = _mm256_unpackhi_epi32(a1, a3);
+  const __m256i b4 = _mm256_unpacklo_epi32(a4, a6);
+  const __m256i b5 = _mm256_unpackhi_epi32(a4, a6);
+  const __m256i b6 = _mm256_unpacklo_epi32(a5, a7);
+  const __m256i b7 = _mm256_unpackhi_epi32(a5, a7);
+  x[0] = _mm256_unpacklo_epi64(b0, b4);
+  x[1] = _mm256_unpackhi_epi64(b0, b4);
+  x[2] = _mm256_unpacklo_epi64(b1, b5);
+  x[3] = _mm256_unpackhi_epi64(b1, b5);
+  x[4] = _mm256_unpacklo_epi64(b2, b6);
+  x[5] = _mm256_unpackhi_epi64(b2, b6);
+  x[6] = _mm256_unpacklo_epi64(b3, b7);
+  x[7] = _mm256_unpackhi_epi64(b3, b7);
+}
+
+THUMB_TARGET_AVX2
+static void idct_8x8_pair_avx2(const int16_t *coef, uint8_t *out,
+                               size_t stride) {
+  __m256i x[8];
+  for (int i = 0; i < 8; i++) {
+    x[i] = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(coef + i * 8))),
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(coef + 64 + i * 8)),
+        1);
+  }
+  idct_pass_avx2<const_bits - pass1_bits>(x, _mm256_set1_epi32(pass1_bias));
+
+  __m256i high = x[0], low = x[0];
+  for (int i = 1; i < 8; i++) {
+    high = _mm256_max_epi16(high, x[i]);
+    low = _mm256_min_epi16(low, x[i]);
+  }
+  const __m256i outside = _mm256_or_si256(
+      _mm256_cmpgt_epi16(high, _mm256_set1_epi16(simd_pass1_limit)),
+      _mm256_cmpgt_epi16(_mm256_set1_epi16(-simd_pass1_limit - 1), low));
+  if (_mm256_movemask_epi8(outside) != 0) {
+    _mm256_zeroupper();
+    idct_8x8(coef, out, stride);
+    idct_8x8(coef + 64, out + 8, stride);
+    return;
+  }
+
+  transpose_8x8_epi16_avx2(x);
+  idct_pass_avx2<pass2_shift>(x, _mm256_set1_epi32(pass2_bias));
+  transpose_8x8_epi16_avx2(x);
+  for (int i = 0; i < 8; i += 2) {
+    /* Rows i and i + 1 of both blocks, then each row's two halves next to
+     * each other. */
+    const __m256i rows = _mm256_permute4x64_epi64(
+        _mm256_packus_epi16(x[i], x[i + 1]), 0xd8);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i * stride),
+                     _mm256_castsi256_si128(rows));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + (i + 1) * stride),
+                     _mm256_extracti128_si256(rows, 1));
+  }
+}
+
+#undef EVEN_TMP3
+#undef EVEN_TMP2
+#undef ODD_Z3
+#undef ODD_Z4
+#undef ODD_TMP0
+#undef ODD_TMP3
+#undef ODD_TMP1
+#undef ODD_TMP2
+
+/** \} */
+
+#endif
+
+#undef FIX
+
+ThumbIdctFn thumb_idct(int block_size) {
+  switch (block_size) {
+  case 8: {
+#ifdef THUMB_X86_64
+    /* AVX2 only pays off for block pairs, see #thumb_idct_pair. */
+    if (thumb_simd_level() >= THUMB_SIMD_SSE2) {
+      return idct_8x8_sse2;
+    }
+#endif
+    return idct_8x8;
+  }
+  case 4:
+    return [](const int16_t *coef, uint8_t *out, size_t stride) {
+      idct_reduced<4>(coef, idct4_matrix, out, stride);
+    };
+  case 2:
+    return [](const int16_t *coef, uint8_t *out, size_t stride) {
+      idct_reduced<2>(coef, idct2_matrix, out, stride);
+    };
+  default:
+    return idct_1x1;
+  }
+}
+
+ThumbIdctFn thumb_idct_pair(int block_size) {
+  switch (block_size) {
+  case 8:
+#ifdef THUMB_X86_64
+    if (thumb_simd_level() >= THUMB_SIMD_AVX2) {
+      return idct_8x8_pair_avx2;
+    }
+    if (thumb_simd_level() >= THUMB_SIMD_SSE2) {
+      return [](const int16_t *coef, uint8_t *out, size_t stride) {
+        idct_8x8_sse2(coef, out, stride);
+        idct_8x8_sse2(coef + 64, out + 8, stride);
+      };
+    }
+#endif
+    return [](const int16_t *coef, uint8_t *out, size_t stride) {
+      idct_8x8(coef, out, stride);
+      idct_8x8(coef + 64, out + 8, stride);
+    };
+  case 4:
+    return [](const int16_t *coef, uint8_t *out, size_t stride) {
+      idct_reduced<4>(coef, idct4_matrix, out, stride);
+      idct_reduced<4>(coef + 64, idct4_matrix, out + 4, stride);
+    };
+  case 2:
+    return [](const int16_t *coef, uint8_t *out, size_t stride) {
+      idct_reduced<2>(coef, idct2_matrix, out, stride);
+      idct_reduced<2>(coef + 64, idct2_matrix, out + 2, stride);
+    };
+  default:
+    return [](const int16_t *coef, uint8_t *out, size_t stride) {
+      idct_1x1(coef, out, stride);
+      idct_1x1(coef + 64, out + 1, stride);
+    };
+  }
+}
@@ -0,0 +1,29 @@
+/** \file
+ * Inverse DCT kernels of the JPEG decoder.
+ *
+ * Each kernel turns one block of dequantized coefficients, in natural order
+ * and within the +-4095 the decoder clamps them to, into level shifted
+ * samples written \a stride bytes apart. The 8x8 transform has an SSE2
+ * version and an AVX2 one for pairs of blocks next to the scalar one,
+ * picked by #thumb_simd_level and matching it bit for bit; the reduced
+ * sizes used for scaled decodes are scalar only.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+using ThumbIdctFn = void (*)(const int16_t *coef, uint8_t *out, size_t stride);
+
+/**
+ * IDCT producing \a block_size x \a block_size samples per block: 8 for a
+ * full size decode, 4, 2 or 1 for decoding at 1/2, 1/4 and 1/8 scale.
+ */
+ThumbIdctFn thumb_idct(int block_size);
+
+/**
+ * IDCT of two horizontally adjacent blocks, the second one's coefficients
+ * at `coef + 64` and its samples at `out + block_size`.
+ */
+ThumbIdctFn thumb_idct_pair(int block_size);
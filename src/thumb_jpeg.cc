@@ -0,0 +1,972 @@
+/** \file
+ * Baseline JPEG decoder, see thumb_jpeg.hh.
+ *
+ * The scan is decoded one MCU row at a time: every block is entropy decoded,
+ * run through an integer IDCT (thumb_idct.hh) straight into a per-component
+ * strip of samples (at 8, 4, 2 or 1 pixels per block edge depending on the
+ * scale), and each finished strip is upsampled and color converted
+ * (thumb_ycc.hh) into the output rows, or into a #ThumbResampler that scales
+ * them down while they are still in cache. Huffman codes up to #huff_fast_bits
+ * long are resolved with a single table lookup; longer ones fall back to the
+ * canonical code ranges. Large scans with restart intervals are split into
+ * row ranges across threads.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <numeric>
+#include <vector>
+
+#include "thumb_idct.hh"
+#include "thumb_jpeg.hh"
+#include "thumb_pool.hh"
+#include "thumb_resample.hh"
+#include "thumb_ycc.hh"
+
+static constexpr int huff_fast_bits = 9;
+static constexpr int max_components = 3;
+static constexpr int coef_limit = 4095;
+/* Larger images are left to the platform decoder. */
+static constexpr int64_t max_pixels = int64_t(1) << 26;
+/* Zero padding tolerated at the end of a scan; the bit reader looks up to
+ * 8 bytes ahead, and some encoders cut the last byte short. */
+static constexpr size_t scan_padding_max = 16;
+
+/* Natural order index of each zig-zag position. */
+static const uint8_t dezigzag[64] = {
+    0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6,  7,  14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+namespace {
+
+struct HuffTable {
+  bool defined = false;
+  /* `(length << 8) | symbol` for codes of up to huff_fast_bits, else 0. */
+  uint16_t fast[1 << huff_fast_bits];
+  /* Canonical code ranges per length for the longer codes. */
+  int32_t maxcode[17];
+  int32_t mincode[17];
+  int valptr[17];
+  uint8_t values[256];
+};
+
+struct Component {
+  int id;
+  int h, v;
+  int tq;
+  int td, ta;
+  int dc_pred;
+  /* Samples of the current MCU row, `stride x (v * block_size)`, in the
+   * request arena. */
+  uint8_t *strip;
+  size_t stride;
+};
+
+/**
+ * Entropy coded bits, MSB first in a 64-bit accumulator. Stuffed zero bytes
+ * are dropped; on reaching a marker (or the end of the data) the reader
+ * keeps feeding zero bits, which is how truncated files are decoded.
+ */
+struct BitReader {
+  const uint8_t *p;
+  const uint8_t *end;
+  uint64_t acc;
+  int bits;
+  bool at_marker;
+  /** Zero bytes fed in because a marker or the end of the data was hit. */
+  size_t padded;
+
+  void fill() {
+    while (bits <= 56) {
+      uint64_t byte = 0;
+      if (!at_marker && p < end) {
+        byte = *p;
+        if (byte != 0xFF) {
+          p++;
+        } else if (p + 1 < end && p[1] == 0x00) {
+          p += 2;
+        } else {
+          at_marker = true;
+          byte = 0;
+          padded++;
+        }
+      } else {
+        padded++;
+      }
+      acc |= byte << (56 - bits);
+      bits += 8;
+    }
+  }
+
+  uint32_t peek(int n) const { return uint32_t(acc >> (64 - n)); }
+
+  void consume(int n) {
+    acc <<= n;
+    bits -= n;
+  }
+};
+
+struct JpegDecoder {
+  const uint8_t *data;
+  const uint8_t *end;
+  const uint8_t *p;
+
+  uint16_t quant[4][64];
+  bool quant_defined[4];
+  HuffTable dc[4];
+  HuffTable ac[4];
+
+  Component comp[max_components];
+  int ncomp = 0;
+  int width = 0, height = 0;
+  int hmax = 1, vmax = 1;
+  int restart_interval = 0;
+  bool rgb = false;
+  bool have_frame = false;
+
+  /* Output scale: each 8x8 block becomes block_size x block_size pixels. */
+  int block_size = 8;
+  int out_width = 0, out_height = 0;
+  int mcus_x = 0, mcus_y = 0;
+
+  ThumbIdctFn idct = nullptr;
+  /** For components with two blocks per MCU row, mostly 4:2:x luma. */
+  ThumbIdctFn idct_pair = nullptr;
+  /** Set for YCbCr with full resolution luma, see #convert_rows. */
+  ThumbYccRowFn ycc_row = nullptr;
+
+  /** Takes the output rows instead of the thumbnail when set. */
+  ThumbResampler *resampler = nullptr;
+  /** Row the layouts without #ycc_row convert into for #resampler. */
+  uint8_t *bgr_row = nullptr;
+};
+
+}  // namespace
+
+static inline int read_u16(const uint8_t *p) {
+  return (p[0] << 8) | p[1];
+}
+
+/* -------------------------------------------------------------------- */
+/** \name Markers
+ * \{ */
+
+static bool build_huff(HuffTable *table, const uint8_t counts[16],
+                       const uint8_t *values, int total) {
+  memset(table->fast, 0, sizeof(table->fast));
+  memcpy(table->values, values, total);
+
+  int code = 0, k = 0;
+  for (int len = 1; len <= 16; len++) {
+    table->valptr[len] = k;
+    table->mincode[len] = code;
+    for (int i = 0; i < counts[len - 1]; i++, k++, code++) {
+      if (code >= (1 << len)) {
+        return false; /* Over-subscribed code lengths. */
+      }
+      if (len <= huff_fast_bits) {
+        /* Every lookup index that starts with this code resolves to it. */
+        int shift = huff_fast_bits - len;
+        uint16_t entry = uint16_t((len << 8) | values[k]);
+        for (int fill = 0; fill < (1 << shift); fill++) {
+          table->fast[(code << shift) | fill] = entry;
+        }
+      }
+    }
+    table->maxcode[len] = counts[len - 1] ? code - 1 : -1;
+    code <<= 1;
+  }
+  table->defined = true;
+  return true;
+}
+
+static eThumbStatus parse_dqt(JpegDecoder *dec, const uint8_t *seg, int len) {
+  while (len > 0) {
+    int precision = seg[0] >> 4, id = seg[0] & 15;
+    int need = 1 + (precision ? 128 : 64);
+    if (id > 3 || precision > 1 || len < need) {
+      return THUMB_INVALID_THUMB;
+    }
+    for (int k = 0; k < 64; k++) {
+      dec->quant[id][dezigzag[k]] =
+          uint16_t(precision ? read_u16(seg + 1 + k * 2) : seg[1 + k]);
+    }
+    dec->quant_defined[id] = true;
+    seg += need;
+    len -= need;
+  }
+  return THUMB_OK;
+}
+
+static eThumbStatus parse_dht(JpegDecoder *dec, const uint8_t *seg, int len) {
+  while (len > 0) {
+    if (len < 17) {
+      return THUMB_INVALID_THUMB;
+    }
+    int table_class = seg[0] >> 4, id = seg[0] & 15;
+    int total = 0;
+    for (int i = 0; i < 16; i++) {
+      total += seg[1 + i];
+    }
+    if (table_class > 1 || id > 3 || total > 256 || len < 17 + total) {
+      return THUMB_INVALID_THUMB;
+    }
+    HuffTable *table = table_class ? &dec->ac[id] : &dec->dc[id];
+    if (!build_huff(table, seg + 1, seg + 17, total)) {
+      return THUMB_INVALID_THUMB;
+    }
+    seg += 17 + total;
+    len -= 17 + total;
+  }
+  return THUMB_OK;
+}
+
+static eThumbStatus parse_sof(JpegDecoder *dec, const uint8_t *seg, int len) {
+  /* Only hierarchical files have more than one frame, and those are never
+   * handled here; a second header would also disagree with the probe. */
+  if (len < 6 || dec->have_frame) {
+    return THUMB_INVALID_THUMB;
+  }
+  int precision = seg[0];
+  dec->height = read_u16(seg + 1);
+  dec->width = read_u16(seg + 3);
+  dec->ncomp = seg[5];
+  if (precision != 8 || dec->height == 0 || dec->width == 0 ||
+      (dec->ncomp != 1 && dec->ncomp != 3)) {
+    /* 12-bit, DNL defined heights and CMYK. */
+    return THUMB_UNSUPPORTED;
+  }
+  if (len < 6 + dec->ncomp * 3) {
+    return THUMB_INVALID_THUMB;
+  }
+
+  dec->hmax = dec->vmax = 1;
+  for (int i = 0; i < dec->ncomp; i++) {
+    Component &c = dec->comp[i];
+    const uint8_t *spec = seg + 6 + i * 3;
+    c.id = spec[0];
+    c.h = spec[1] >> 4;
+    c.v = spec[1] & 15;
+    c.tq = spec[2];
+    if (c.h < 1 || c.v < 1 || c.tq > 3) {
+      return THUMB_INVALID_THUMB;
+    }
+    if (c.h > 2 || c.v > 2) {
+      return THUMB_UNSUPPORTED;
+    }
+    dec->hmax = std::max(dec->hmax, c.h);
+    dec->vmax = std::max(dec->vmax, c.v);
+  }
+  if (dec->ncomp == 1) {
+    /* A single component scan is never interleaved, one block per MCU. */
+    dec->comp[0].h = dec->comp[0].v = 1;
+    dec->hmax = dec->vmax = 1;
+  }
+  dec->have_frame = true;
+  return THUMB_OK;
+}
+
+static eThumbStatus parse_sos(JpegDecoder *dec, const uint8_t *seg, int len) {
+  if (!dec->have_frame || len < 1) {
+    return THUMB_INVALID_THUMB;
+  }
+  int count = seg[0];
+  if (len < 4 + count * 2) {
+    return THUMB_INVALID_THUMB;
+  }
+  if (count != dec->ncomp) {
+    /* Baseline files that spread the components over several scans. */
+    return THUMB_UNSUPPORTED;
+  }
+  for (int i = 0; i < count; i++) {
+    int id = seg[1 + i * 2], tables = seg[2 + i * 2];
+    Component *c = nullptr;
+    for (int j = 0; j < dec->ncomp; j++) {
+      if (dec->comp[j].id == id) {
+        c = &dec->comp[j];
+      }
+    }
+    if (!c || (tables >> 4) > 3 || (tables & 15) > 3) {
+      return THUMB_INVALID_THUMB;
+    }
+    c->td = tables >> 4;
+    c->ta = tables & 15;
+    if (!dec->dc[c->td].defined || !dec->ac[c->ta].defined ||
+        !dec->quant_defined[c->tq]) {
+      return THUMB_INVALID_THUMB;
+    }
+  }
+  const uint8_t *spectral = seg + 1 + count * 2;
+  if (spectral[0] != 0 || spectral[1] != 63 || spectral[2] != 0) {
+    return THUMB_INVALID_THUMB;
+  }
+  return THUMB_OK;
+}
+
+/**
+ * Step \a *p over the next marker and, unless it stands alone, its segment,
+ * which goes to \a r_seg and \a r_len. Returns the marker, or -1 when the
+ * data ends first or the segment runs past it.
+ */
+static int next_marker(const uint8_t **p, const uint8_t *end,
+                       const uint8_t **r_seg, int *r_len) {
+  const uint8_t *q = *p;
+  while (q < end && *q != 0xFF) {
+    q++;
+  }
+  while (q < end && *q == 0xFF) {
+    q++;
+  }
+  if (q >= end) {
+    return -1;
+  }
+  int marker = *q++;
+  *r_seg = nullptr;
+  *r_len = 0;
+  if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7) ||
+      marker == 0xD9) {
+    *p = q;
+    return marker;
+  }
+  if (end - q < 2 || read_u16(q) < 2 || read_u16(q) > end - q) {
+    return -1;
+  }
+  *r_seg = q + 2;
+  *r_len = read_u16(q) - 2;
+  *p = q + read_u16(q);
+  return marker;
+}
+
+/** Read the markers up to the first scan, leaving `dec->p` on its data. */
+static eThumbStatus parse_headers(JpegDecoder *dec) {
+  const uint8_t *p = dec->data;
+  const uint8_t *end = dec->end;
+  if (end - p < 2 || p[0] != 0xFF || p[1] != 0xD8) {
+    /* Not a JPEG at all, let the platform decoder have a look. */
+    return THUMB_UNSUPPORTED;
+  }
+  p += 2;
+
+  for (;;) {
+    const uint8_t *seg;
+    int len;
+    int marker = next_marker(&p, end, &seg, &len);
+    if (marker < 0 || marker == 0xD9) {
+      return THUMB_INVALID_THUMB; /* No scan. */
+    }
+    if (!seg) {
+      continue; /* Standalone markers. */
+    }
+
+    eThumbStatus status = THUMB_OK;
+    switch (marker) {
+    case 0xC0: /* Baseline. */
+    case 0xC1: /* Extended sequential, Huffman. */
+      status = parse_sof(dec, seg, len);
+      break;
+    case 0xC2: case 0xC3: case 0xC5: case 0xC6: case 0xC7:
+    case 0xC9: case 0xCA: case 0xCB: case 0xCD: case 0xCE: case 0xCF:
+      /* Progressive, lossless, hierarchical and arithmetic coding. */
+      return THUMB_UNSUPPORTED;
+    case 0xC4:
+      status = parse_dht(dec, seg, len);
+      break;
+    case 0xDB:
+      status = parse_dqt(dec, seg, len);
+      break;
+    case 0xDD:
+      if (len < 2) {
+        return THUMB_INVALID_THUMB;
+      }
+      dec->restart_interval = read_u16(seg);
+      break;
+    case 0xEE:
+      /* Adobe: a transform flag of 0 means the components are RGB. */
+      if (len >= 12 && memcmp(seg, "Adobe", 5) == 0) {
+        dec->rgb = seg[11] == 0;
+      }
+      break;
+    case 0xDA:
+      status = parse_sos(dec, seg, len);
+      if (status == THUMB_OK) {
+        dec->p = seg + len;
+      }
+      return status;
+    default:
+      break;
+    }
+    if (status != THUMB_OK) {
+      return status;
+    }
+  }
+}
+
+/** \} */
+
+/* -------------------------------------------------------------------- */
+/** \name Probe
+ * \{ */
+
+/** Any frame header, SOF0 to SOF15 except DHT, JPG and DAC in between. */
+static bool is_sof(int marker) {
+  return marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 &&
+         marker != 0xC8 && marker != 0xCC;
+}
+
+static eThumbStatus parse_frame_info(int marker, const uint8_t *seg, int len,
+                                     ThumbJpegInfo *r_info) {
+  if (len < 6 || len < 6 + seg[5] * 3 || seg[5] == 0) {
+    return THUMB_INVALID_THUMB;
+  }
+  ThumbJpegInfo info;
+  info.precision = seg[0];
+  info.height = read_u16(seg + 1);
+  info.width = read_u16(seg + 3);
+  info.components = seg[5];
+  if (info.width == 0) {
+    return THUMB_INVALID_THUMB;
+  }
+  if (info.height == 0) {
+    /* Defined later by a DNL segment, after the first scan. */
+    return THUMB_UNSUPPORTED;
+  }
+  int hmax = 1, vmax = 1, hmin = 4, vmin = 4;
+  for (int i = 0; i < info.components; i++) {
+    const int h = seg[7 + i * 3] >> 4, v = seg[7 + i * 3] & 15;
+    if (h < 1 || h > 4 || v < 1 || v > 4) {
+      return THUMB_INVALID_THUMB;
+    }
+    hmax = std::max(hmax, h);
+    vmax = std::max(vmax, v);
+    hmin = std::min(hmin, h);
+    vmin = std::min(vmin, v);
+  }
+  info.subsample_x = hmax / hmin;
+  info.subsample_y = vmax / vmin;
+  /* The low two bits tell the process apart: sequential, progressive,
+   * lossless; bit 3 is arithmetic coding. */
+  info.progressive = (marker & 3) == 2;
+  info.arithmetic = (marker & 8) != 0;
+  *r_info = info;
+  return THUMB_OK;
+}
+
+eThumbStatus thumb_jpeg_probe(const uint8_t *data, size_t len,
+                              ThumbJpegInfo *r_info) {
+  const uint8_t *p = data;
+  const uint8_t *end = data + len;
+  if (end - p < 2 || p[0] != 0xFF || p[1] != 0xD8) {
+    return THUMB_UNSUPPORTED;
+  }
+  p += 2;
+
+  for (;;) {
+    const uint8_t *seg;
+    int seg_len;
+    int marker = next_marker(&p, end, &seg, &seg_len);
+    if (marker < 0 || marker == 0xD9 || marker == 0xDA) {
+      return THUMB_INVALID_THUMB; /* No frame header before the scan. */
+    }
+    if (seg && is_sof(marker)) {
+      return parse_frame_info(marker, seg, seg_len, r_info);
+    }
+  }
+}
+
+/** \} */
+
+/* -------------------------------------------------------------------- */
+/** \name Entropy Decoding
+ * \{ */
+
+static inline int decode_huff(BitReader &br, const HuffTable &table) {
+  uint16_t entry = table.fast[br.peek(huff_fast_bits)];
+  if (entry) {
+    br.consume(entry >> 8);
+    return entry & 0xFF;
+  }
+  for (int len = huff_fast_bits + 1; len <= 16; len++) {
+    int32_t code = int32_t(br.peek(len));
+    if (code <= table.maxcode[len]) {
+      br.consume(len);
+      return table.values[table.valptr[len] + code - table.mincode[len]];
+    }
+  }
+  return -1;
+}
+
+static inline int receive_extend(BitReader &br, int s) {
+  int value = int(br.peek(s));
+  br.consume(s);
+  return value < (1 << (s - 1)) ? value - (1 << s) + 1 : value;
+}
+
+/**
+ * Dequantize a coefficient. Valid 8-bit data stays within about +-2200;
+ * clamping to 12 bits plus sign keeps the IDCT from overflowing on garbage.
+ */
+static inline int16_t dequantize(int value, int quant) {
+  int64_t x = int64_t(value) * quant;
+  x = std::min<int64_t>(x, coef_limit);
+  return int16_t(std::max<int64_t>(x, -coef_limit));
+}
+
+/** Decode one block into \a coef in natural order, dequantized. */
+static bool decode_block(BitReader &br, const HuffTable &dc,
+                         const HuffTable &ac, const uint16_t *quant,
+                         int *dc_pred, int16_t coef[64]) {
+  memset(coef, 0, sizeof(int16_t) * 64);
+
+  /* A full accumulator holds any code plus its extra bits. */
+  br.fill();
+  int s = decode_huff(br, dc);
+  if (s < 0 || s > 11) {
+    return false;
+  }
+  if (s) {
+    /* Wraps like the 16-bit predictor of other decoders on broken files. */
+    *dc_pred = int16_t(*dc_pred + receive_extend(br, s));
+  }
+  coef[0] = dequantize(*dc_pred, quant[0]);
+
+  for (int k = 1; k < 64;) {
+    if (br.bits < 32) {
+      br.fill();
+    }
+    int rs = decode_huff(br, ac);
+    if (rs < 0) {
+      return false;
+    }
+    int run = rs >> 4;
+    s = rs & 15;
+    if (s == 0) {
+      if (run != 15) {
+        break; /* End of block. */
+      }
+      k += 16;
+      continue;
+    }
+    k += run;
+    if (k > 63) {
+      return false;
+    }
+    int pos = dezigzag[k];
+    coef[pos] = dequantize(receive_extend(br, s), quant[pos]);
+    k++;
+  }
+  return true;
+}
+
+/** Skip to the data after the next RSTn marker. */
+static void process_restart(JpegDecoder *dec, BitReader &br) {
+  const uint8_t *p = br.p;
+  while (p + 1 < br.end) {
+    if (p[0] == 0xFF && p[1] >= 0xD0 && p[1] <= 0xD7) {
+      p += 2;
+      br.padded = 0;
+      break;
+    }
+    if (p[0] == 0xFF && p[1] != 0x00 && p[1] != 0xFF) {
+      break; /* Some other marker, decode the rest as zeros. */
+    }
+    p++;
+  }
+  br.p = p;
+  br.acc = 0;
+  br.bits = 0;
+  br.at_marker = false;
+  for (int i = 0; i < dec->ncomp; i++) {
+    dec->comp[i].dc_pred = 0;
+  }
+}
+
+/** \} */
+
+/* -------------------------------------------------------------------- */
+/** \name Color Conversion
+ * \{ */
+
+/**
+ * Write output rows [\a y0, \a y1) from the strips of one MCU row. Chroma is
+ * replicated up to the luma resolution. With a resampler, #ycc_row writes
+ * BGRX straight into its row and other layouts go through #bgr_row.
+ */
+static void convert_rows(const JpegDecoder *dec, int y0, int y1,
+                         Thumbnail *thumb) {
+  const int width = dec->out_width;
+  const size_t out_stride = thumb_bgr_stride(width);
+  const int mcu_height = dec->vmax * dec->block_size;
+
+  for (int y = y0; y < y1; y++) {
+    const int ly = y % mcu_height;
+    uint8_t *out;
+    if (!dec->resampler) {
+      out = thumb->data.data() + size_t(y) * out_stride;
+    } else if (dec->ycc_row) {
+      out = dec->resampler->row();
+    } else {
+      out = dec->bgr_row;
+    }
+
+    const uint8_t *rows[max_components];
+    int xshift[max_components];
+    for (int i = 0; i < dec->ncomp; i++) {
+      const Component &c = dec->comp[i];
+      rows[i] = c.strip + size_t(ly * c.v / dec->vmax) * c.stride;
+      xshift[i] = dec->hmax / c.h - 1;
+    }
+
+    if (dec->ncomp == 1) {
+      for (int x = 0; x < width; x++) {
+        out[x * 3 + 0] = out[x * 3 + 1] = out[x * 3 + 2] = rows[0][x];
+      }
+    } else if (dec->rgb) {
+      for (int x = 0; x < width; x++) {
+        out[x * 3 + 0] = rows[2][x >> xshift[2]];
+        out[x * 3 + 1] = rows[1][x >> xshift[1]];
+        out[x * 3 + 2] = rows[0][x >> xshift[0]];
+      }
+    } else if (dec->ycc_row) {
+      dec->ycc_row(rows[0], rows[1], rows[2], out, width);
+    } else {
+      for (int x = 0; x < width; x++) {
+        ThumbChromaOffsets chroma(rows[1][x >> xshift[1]],
+                                  rows[2][x >> xshift[2]]);
+        chroma.put(out + x * 3, rows[0][x >> xshift[0]]);
+      }
+    }
+
+    if (dec->resampler && dec->ycc_row) {
+      dec->resampler->push();
+    } else if (dec->resampler) {
+      dec->resampler->push_bgr(out);
+    }
+  }
+}
+
+/** \} */
+
+/* -------------------------------------------------------------------- */
+/** \name Scan
+ *
+ * With restart markers the entropy coded data falls into intervals that
+ * each start from fresh DC predictions at a byte boundary. Large scans whose
+ * intervals line up with MCU rows are indexed by their RSTn markers and
+ * decoded in chunks of rows on the worker pool: every chunk has its own
+ * strips and bit reader and writes only its own output rows, so the result
+ * is the same as decoding it in one go.
+ * \{ */
+
+/** Scans with fewer MCUs than this aren't worth handing to other threads. */
+static constexpr int parallel_min_mcus = 4096;
+/** Chunks per thread, so uneven intervals still balance out. */
+static constexpr int parallel_chunks_per_thread = 4;
+
+static void alloc_strips(JpegDecoder *dec, ThumbArena &arena) {
+  const int bs = dec->block_size;
+  for (int i = 0; i < dec->ncomp; i++) {
+    Component &c = dec->comp[i];
+    c.stride = size_t(dec->mcus_x) * c.h * bs;
+    c.strip = arena.alloc_array<uint8_t>(c.stride * c.v * bs);
+  }
+}
+
+/**
+ * Decode MCU rows [\a my0, \a my1) from entropy coded data starting at \a p,
+ * which must be the start of the scan or of a restart interval.
+ */
+static eThumbStatus decode_rows(JpegDecoder *dec, const uint8_t *p, int my0,
+                                int my1, Thumbnail *thumb) {
+  const ThumbIdctFn idct = dec->idct;
+  const ThumbIdctFn idct_pair = dec->idct_pair;
+  const int bs = dec->block_size;
+  for (int i = 0; i < dec->ncomp; i++) {
+    dec->comp[i].dc_pred = 0;
+  }
+
+  BitReader br = {p, dec->end, 0, 0, false, 0};
+  int restarts_left = dec->restart_interval;
+  alignas(32) int16_t coef[128];
+  const int mcu_height = dec->vmax * bs;
+
+  for (int my = my0; my < my1; my++) {
+    for (int mx = 0; mx < dec->mcus_x; mx++) {
+      if (dec->restart_interval) {
+        if (restarts_left == 0) {
+          process_restart(dec, br);
+          restarts_left = dec->restart_interval;
+        }
+        restarts_left--;
+      }
+      for (int i = 0; i < dec->ncomp; i++) {
+        Component &c = dec->comp[i];
+        const uint16_t *quant = dec->quant[c.tq];
+        for (int by = 0; by < c.v; by++) {
+          uint8_t *row = c.strip + size_t(by * bs) * c.stride +
+                         size_t(mx * c.h) * bs;
+          if (c.h == 2) {
+            if (!decode_block(br, dec->dc[c.td], dec->ac[c.ta], quant,
+                              &c.dc_pred, coef) ||
+                !decode_block(br, dec->dc[c.td], dec->ac[c.ta], quant,
+                              &c.dc_pred, coef + 64)) {
+              return THUMB_INVALID_THUMB;
+            }
+            idct_pair(coef, row, c.stride);
+            continue;
+          }
+          for (int bx = 0; bx < c.h; bx++) {
+            if (!decode_block(br, dec->dc[c.td], dec->ac[c.ta], quant,
+                              &c.dc_pred, coef)) {
+              return THUMB_INVALID_THUMB;
+            }
+            idct(coef, row + size_t(bx) * bs, c.stride);
+          }
+        }
+      }
+    }
+    /* Past the end of the entropy coded data everything decodes from zeros;
+     * stop instead of spending a full decode on a header that promises far
+     * more pixels than the file holds. The platform decoder still gets to
+     * show the part that is there. */
+    if (br.padded > scan_padding_max) {
+      return THUMB_UNSUPPORTED;
+    }
+    int y0 = my * mcu_height;
+    convert_rows(dec, y0, std::min(y0 + mcu_height, dec->out_height), thumb);
+  }
+  return THUMB_OK;
+}
+
+/**
+ * Find where each of the \a count restart intervals of the scan starts.
+ * False unless all their RSTn markers are there, in sequence; such a scan is
+ * left to the sequential path, which copes with broken ones.
+ */
+static bool index_restarts(const JpegDecoder *dec, const uint8_t **r_starts,
+                           int count) {
+  const uint8_t *p = dec->p;
+  r_starts[0] = p;
+  for (int found = 1; found < count;) {
+    p = static_cast<const uint8_t *>(memchr(p, 0xFF, size_t(dec->end - p)));
+    if (!p || dec->end - p < 2) {
+      return false;
+    }
+    if (p[1] == 0x00 || p[1] == 0xFF) {
+      p++; /* Stuffed byte or fill. */
+      continue;
+    }
+    if (p[1] != 0xD0 + ((found - 1) & 7)) {
+      return false;
+    }
+    p += 2;
+    r_starts[found++] = p;
+  }
+  return true;
+}
+
+namespace {
+
+struct ParallelScan {
+  const JpegDecoder *dec;
+  const uint8_t **starts;
+  Thumbnail *thumb;
+  int rows_per_chunk;
+  std::atomic<bool> failed{false};
+
+  void decode_chunk(int chunk) {
+    if (failed.load(std::memory_order_relaxed)) {
+      return;
+    }
+    const int my0 = chunk * rows_per_chunk;
+    const int my1 = std::min(my0 + rows_per_chunk, dec->mcus_y);
+    const int64_t interval = int64_t(my0) * dec->mcus_x /
+                             dec->restart_interval;
+
+    ThumbArenaScope scope(thumb_arena());
+    JpegDecoder local = *dec;
+    alloc_strips(&local, scope.arena());
+    if (decode_rows(&local, starts[interval], my0, my1, thumb) != THUMB_OK) {
+      failed.store(true, std::memory_order_relaxed);
+    }
+  }
+};
+
+}  // namespace
+
+/**
+ * MCU rows per chunk when the scan qualifies for decoding on \a threads
+ * threads, otherwise 0.
+ */
+static int parallel_rows_per_chunk(const JpegDecoder *dec, int threads) {
+  const int64_t mcus = int64_t(dec->mcus_x) * dec->mcus_y;
+  if (threads < 2 || dec->restart_interval == 0 || mcus < parallel_min_mcus) {
+    return 0;
+  }
+  /* Chunks start at rows whose first MCU begins an interval. */
+  const int ri = dec->restart_interval;
+  const int row_period = ri / std::gcd(dec->mcus_x, ri);
+  const int groups = (dec->mcus_y + row_period - 1) / row_period;
+  if (groups < 2) {
+    return 0;
+  }
+  const int chunks = std::min(groups, threads * parallel_chunks_per_thread);
+  return (groups + chunks - 1) / chunks * row_period;
+}
+
+/**
+ * Decode the scan on the worker pool, see the section comment. False when
+ * it doesn't qualify, before anything was decoded.
+ */
+static bool decode_scan_parallel(JpegDecoder *dec, Thumbnail *thumb,
+                                 eThumbStatus *r_status) {
+  const int threads = thumb_pool_threads();
+  const int rows_per_chunk = parallel_rows_per_chunk(dec, threads);
+  if (rows_per_chunk == 0) {
+    return false;
+  }
+
+  const int64_t mcus = int64_t(dec->mcus_x) * dec->mcus_y;
+  const int ri = dec->restart_interval;
+  const int intervals = int((mcus + ri - 1) / ri);
+  ThumbArena &arena = thumb_arena();
+  ThumbArenaScope scope(arena);
+  const uint8_t **starts = arena.alloc_array<const uint8_t *>(intervals);
+  if (!index_restarts(dec, starts, intervals)) {
+    return false;
+  }
+
+  ParallelScan scan;
+  scan.dec = dec;
+  scan.starts = starts;
+  scan.thumb = thumb;
+  scan.rows_per_chunk = rows_per_chunk;
+  thumb_parallel_for((dec->mcus_y + rows_per_chunk - 1) / rows_per_chunk,
+                     threads, [&](int chunk) { scan.decode_chunk(chunk); });
+  *r_status = scan.failed.load() ? THUMB_INVALID_THUMB : THUMB_OK;
+  return true;
+}
+
+static eThumbStatus decode_scan(JpegDecoder *dec, Thumbnail *thumb) {
+  eThumbStatus status;
+  if (decode_scan_parallel(dec, thumb, &status)) {
+    return status;
+  }
+  alloc_strips(dec, thumb_arena());
+  return decode_rows(dec, dec->p, 0, dec->mcus_y, thumb);
+}
+
+/** \} */
+
+/**
+ * Parse the headers of \a data and set \a dec up to decode it at the scale
+ * #thumb_jpeg_decode picks for \a cx.
+ */
+static eThumbStatus start_decode(JpegDecoder *dec, const uint8_t *data,
+                                 size_t len, int cx) {
+  dec->data = data;
+  dec->end = data + len;
+  memset(dec->quant_defined, 0, sizeof(dec->quant_defined));
+
+  eThumbStatus status = parse_headers(dec);
+  if (status != THUMB_OK) {
+    return status;
+  }
+
+  if (int64_t(dec->width) * dec->height > max_pixels) {
+    return THUMB_UNSUPPORTED;
+  }
+
+  int denominator =
+      cx > 0 ? thumb_scale_denominator(dec->width, dec->height, cx) : 1;
+  dec->block_size = 8 / denominator;
+  dec->out_width = (dec->width + denominator - 1) / denominator;
+  dec->out_height = (dec->height + denominator - 1) / denominator;
+  dec->mcus_x = (dec->width + dec->hmax * 8 - 1) / (dec->hmax * 8);
+  dec->mcus_y = (dec->height + dec->vmax * 8 - 1) / (dec->vmax * 8);
+  dec->idct = thumb_idct(dec->block_size);
+  dec->idct_pair = thumb_idct_pair(dec->block_size);
+  /* 4:4:4, 4:2:2 and 4:2:0; other layouts take the generic path. */
+  if (dec->ncomp == 3 && !dec->rgb && dec->comp[0].h == dec->hmax &&
+      dec->comp[1].h == dec->comp[2].h) {
+    dec->ycc_row =
+        thumb_ycc_row<THUMB_PIXEL_BGR24>(dec->hmax / dec->comp[1].h - 1);
+  }
+
+  /* Every block takes at least two bits, a DC code and an end of block. A
+   * frame header claiming more blocks than that is rejected before the
+   * output is allocated. */
+  int64_t blocks = 0;
+  for (int i = 0; i < dec->ncomp; i++) {
+    blocks += int64_t(dec->comp[i].h) * dec->comp[i].v;
+  }
+  blocks *= int64_t(dec->mcus_x) * dec->mcus_y;
+  if (int64_t(dec->end - dec->p) * 4 < blocks) {
+    return THUMB_INVALID_THUMB;
+  }
+  return THUMB_OK;
+}
+
+/** Decode the whole frame into \a thumb at the scale set up. */
+static eThumbStatus decode_frame(JpegDecoder *dec, Thumbnail *thumb) {
+  thumb->width = dec->out_width;
+  thumb->height = dec->out_height;
+  thumb->data.resize(thumb_bgr_stride(dec->out_width) * dec->out_height);
+
+  ThumbArenaScope scope(thumb_arena());
+  return decode_scan(dec, thumb);
+}
+
+eThumbStatus thumb_jpeg_decode(const uint8_t *data, size_t len, int cx,
+                               Thumbnail *thumb) {
+  JpegDecoder dec;
+  eThumbStatus status = start_decode(&dec, data, len, cx);
+  if (status != THUMB_OK) {
+    return status;
+  }
+  return decode_frame(&dec, thumb);
+}
+
+eThumbStatus thumb_jpeg_decode_fit(const uint8_t *data, size_t len, int cx,
+                                   Thumbnail *thumb) {
+  JpegDecoder dec;
+  eThumbStatus status = start_decode(&dec, data, len, cx);
+  if (status != THUMB_OK) {
+    return status;
+  }
+
+  int width, height;
+  thumb_fit_size(dec.out_width, dec.out_height, cx, &width, &height);
+  if ((width == dec.out_width && height == dec.out_height) ||
+      parallel_rows_per_chunk(&dec, thumb_pool_threads()) != 0) {
+    /* Nothing to scale, or the scan is split across threads, whose rows
+     * arrive out of order. */
+    status = decode_frame(&dec, thumb);
+    if (status == THUMB_OK) {
+      thumb_fit_to(thumb, cx);
+    }
+    return status;
+  }
+
+  thumb->width = width;
+  thumb->height = height;
+  thumb->data.resize(thumb_bgr_stride(width) * height);
+
+  ThumbArenaScope scope(thumb_arena());
+  ThumbArena &arena = scope.arena();
+  ThumbResampler resampler(arena, dec.out_width, dec.out_height,
+                           thumb->data.data(), width, height,
+                           thumb_bgr_stride(width));
+  dec.resampler = &resampler;
+  if (dec.ycc_row) {
+    dec.ycc_row =
+        thumb_ycc_row<THUMB_PIXEL_BGRA32>(dec.hmax / dec.comp[1].h - 1);
+  } else {
+    dec.bgr_row = arena.alloc_array<uint8_t>(size_t(dec.out_width) * 3);
+  }
+  alloc_strips(&dec, arena);
+  return decode_rows(&dec, dec.p, 0, dec.mcus_y, thumb);
+}
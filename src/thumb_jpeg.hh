@@ -0,0 +1,64 @@
+/** \file
+ * Built-in baseline JPEG decoder for place trailers.
+ *
+ * Covers what Kiseki writes: 8-bit baseline/extended Huffman JPEGs with one
+ * (grayscale) or three (YCbCr) components, any sampling up to 2x2, with or
+ * without restart intervals. Progressive, arithmetic coded, 12-bit and CMYK
+ * files, as well as scans cut short, are reported as #THUMB_UNSUPPORTED so
+ * the caller can fall back to the platform decoder.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "thumb.hh"
+
+/**
+ * Decode \a data into \a thumb as BGR24 rows padded to 4 bytes, the layout
+ * the resampler and cache work on; `thumb_pack.hh` turns it into the shell's
+ * output. When \a cx is non-zero the image is decoded at the DCT scale picked
+ * by #thumb_scale_denominator, so its longest edge still covers \a cx.
+ * Large images with restart markers are decoded on up to
+ * #thumb_pool_threads threads.
+ */
+eThumbStatus thumb_jpeg_decode(const uint8_t *data, size_t len, int cx,
+                               Thumbnail *thumb);
+
+/**
+ * #thumb_jpeg_decode followed by #thumb_fit_to, with the same result, but
+ * fused: each MCU row is resampled right after it is color converted, so
+ * the frame at decode scale is never written out. Scans that go to the
+ * worker pool are still decoded whole and scaled afterwards.
+ */
+eThumbStatus thumb_jpeg_decode_fit(const uint8_t *data, size_t len, int cx,
+                                   Thumbnail *thumb);
+
+/** The frame header fields #thumb_jpeg_probe reports. */
+struct ThumbJpegInfo {
+  int width, height;
+  /** 1 for grayscale, 3 for YCbCr (or RGB), 4 for CMYK (or YCCK). */
+  int components;
+  /** Bits per sample, 8 for nearly everything. */
+  int precision;
+  /**
+   * How much the most subsampled component is reduced against the full
+   * resolution one: 2x2 for 4:2:0, 2x1 for 4:2:2, 1x1 for 4:4:4 and
+   * grayscale.
+   */
+  int subsample_x, subsample_y;
+  bool progressive;
+  /** Arithmetic instead of Huffman coded. */
+  bool arithmetic;
+};
+
+/**
+ * Read the size and format of \a data without decoding it: only the markers
+ * up to the first frame header are walked, which takes well under a
+ * microsecond for what Kiseki writes. \a data only has to reach the end of
+ * that header, so a prefix of the trailer does as well. Files that are no
+ * JPEG at all are #THUMB_UNSUPPORTED, like in #thumb_jpeg_decode.
+ */
+eThumbStatus thumb_jpeg_probe(const uint8_t *data, size_t len,
+                              ThumbJpegInfo *r_info);
@@ -0,0 +1,242 @@
+/** \file
+ * Trailer manifests, see thumb_manifest.hh.
+ *
+ * File layout, all little endian as written by the host:
+ *
+ *   header       64 bytes, see #ManifestHeader
+ *   entries      count x #ThumbManifestEntry, sorted by path hash, then path
+ *   paths        the paths, back to back, without terminators
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+#include "thumb_hash.hh"
+#include "thumb_manifest.hh"
+
+namespace fs = std::filesystem;
+
+static constexpr uint32_t manifest_magic = 0x464d544b; /* "KTMF" */
+static constexpr uint32_t manifest_version = 1;
+
+namespace {
+
+struct ManifestHeader {
+  uint32_t magic;
+  uint32_t version;
+  /** sizeof(ThumbManifestEntry), in case it ever grows. */
+  uint32_t entry_size;
+  uint32_t reserved;
+  uint64_t count;
+  uint64_t paths_size;
+  uint64_t tag;
+  uint64_t reserved2[3];
+};
+
+}  // namespace
+
+static_assert(sizeof(ManifestHeader) == 64, "header keeps entries aligned");
+
+/* -------------------------------------------------------------------- */
+/** \name Reading
+ * \{ */
+
+ThumbManifest::ThumbManifest(std::unique_ptr<ThumbSource> source) {
+  const int64_t size = source ? source->size() : -1;
+  if (size < int64_t(sizeof(ManifestHeader))) {
+    return;
+  }
+  const uint8_t *data = source->view(0, size_t(size));
+  if (!data) {
+    _copy.resize((size_t(size) + 7) / 8);
+    if (thumb_source_read_exact(source.get(), 0, _copy.data(),
+                                size_t(size)) != THUMB_OK) {
+      return;
+    }
+    data = reinterpret_cast<const uint8_t *>(_copy.data());
+  }
+
+  ManifestHeader header;
+  memcpy(&header, data, sizeof(header));
+  const uint64_t body = uint64_t(size) - sizeof(header);
+  if (header.magic != manifest_magic || header.version != manifest_version ||
+      header.entry_size != sizeof(ThumbManifestEntry) ||
+      header.count > body / sizeof(ThumbManifestEntry) ||
+      header.paths_size != body - header.count * sizeof(ThumbManifestEntry)) {
+    _copy.clear();
+    return;
+  }
+  _entries = reinterpret_cast<const ThumbManifestEntry *>(data +
+                                                          sizeof(header));
+  _count = size_t(header.count);
+  _paths = reinterpret_cast<const char *>(_entries + _count);
+  _paths_size = header.paths_size;
+  _tag = header.tag;
+  _source = std::move(source);
+}
+
+std::string_view ThumbManifest::path(const ThumbManifestEntry &entry) const {
+  /* Entries come from disk, keep them inside the path table. */
+  if (entry.path_offset > _paths_size ||
+      entry.path_length > _paths_size - entry.path_offset) {
+    return {};
+  }
+  return {_paths + entry.path_offset, entry.path_length};
+}
+
+const ThumbManifestEntry *ThumbManifest::find(std::string_view path) const {
+  const uint64_t hash = thumb_hash64(path.data(), path.size());
+  const ThumbManifestEntry *it = std::lower_bound(
+      begin(), end(), hash,
+      [](const ThumbManifestEntry &entry, uint64_t value) {
+        return entry.path_hash < value;
+      });
+  for (; it != end() && it->path_hash == hash; ++it) {
+    if (this->path(*it) == path) {
+      return it;
+    }
+  }
+  return nullptr;
+}
+
+/** \} */
+
+/* -------------------------------------------------------------------- */
+/** \name Writing
+ * \{ */
+
+void ThumbManifestWriter::add(std::string_view path,
+                              const ThumbManifestEntry &entry) {
+  ThumbManifestEntry &added = _entries.emplace_back(entry);
+  added.path_hash = thumb_hash64(path.data(), path.size());
+  added.path_offset = _paths.size();
+  added.path_length = uint32_t(path.size());
+  _paths.append(path);
+}
+
+bool ThumbManifestWriter::write(const char *path, uint64_t tag) const {
+  auto entry_path = [&](const ThumbManifestEntry &entry) {
+    return std::string_view(_paths).substr(entry.path_offset,
+                                           entry.path_length);
+  };
+  std::vector<ThumbManifestEntry> sorted = _entries;
+  std::sort(sorted.begin(), sorted.end(),
+            [&](const ThumbManifestEntry &a, const ThumbManifestEntry &b) {
+              if (a.path_hash != b.path_hash) {
+                return a.path_hash < b.path_hash;
+              }
+              return entry_path(a) < entry_path(b);
+            });
+  /* The same path added twice keeps its last entry. */
+  std::string paths;
+  paths.reserve(_paths.size());
+  size_t count = 0;
+  for (size_t i = 0; i < sorted.size(); i++) {
+    if (i + 1 < sorted.size() &&
+        sorted[i + 1].path_hash == sorted[i].path_hash &&
+        entry_path(sorted[i + 1]) == entry_path(sorted[i])) {
+      continue;
+    }
+    ThumbManifestEntry entry = sorted[i];
+    const std::string_view name = entry_path(entry);
+    entry.path_offset = paths.size();
+    paths.append(name);
+    sorted[count++] = entry;
+  }
+  sorted.resize(count);
+
+  ManifestHeader header = {};
+  header.magic = manifest_magic;
+  header.version = manifest_version;
+  header.entry_size = sizeof(ThumbManifestEntry);
+  header.count = count;
+  header.paths_size = paths.size();
+  header.tag = tag;
+
+  const fs::path target(path);
+  fs::path temp = target;
+  temp += ".tmp" +
+          std::to_string(std::hash<std::thread::id>()(
+                             std::this_thread::get_id()) ^
+                         uint64_t(std::chrono::steady_clock::now()
+                                      .time_since_epoch()
+                                      .count()));
+  std::error_code ec;
+  {
+    std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(sorted.data()),
+              std::streamsize(count * sizeof(ThumbManifestEntry)));
+    out.write(paths.data(), std::streamsize(paths.size()));
+    if (!out.flush()) {
+      out.close();
+      fs::remove(temp, ec);
+      return false;
+    }
+  }
+  fs::rename(temp, target, ec);
+  if (ec) {
+    fs::remove(temp, ec);
+    return false;
+  }
+  return true;
+}
+
+/** \} */
+
+/* -------------------------------------------------------------------- */
+/** \name Using Entries
+ * \{ */
+
+ThumbManifestEntry thumb_manifest_entry(const ThumbFileStamp &stamp,
+                                        eThumbStatus status,
+                                        const ThumbTrailer *trailer) {
+  ThumbManifestEntry entry = {};
+  entry.status = uint32_t(status);
+  entry.stamp = stamp;
+  if (status == THUMB_OK) {
+    entry.jpeg_offset = trailer->file_offset;
+    entry.jpeg_length = trailer->length;
+    entry.jpeg_hash = thumb_hash64(trailer->data, trailer->length);
+  }
+  return entry;
+}
+
+eThumbStatus thumb_read_manifest_trailer(ThumbSource *source,
+                                         const ThumbManifestEntry &entry,
+                                         ThumbBuffer &buffer,
+                                         ThumbTrailer *r_trailer) {
+  if (entry.status != THUMB_OK) {
+    return entry.status <= THUMB_UNSUPPORTED ? eThumbStatus(entry.status)
+                                             : THUMB_INVALID_FILE;
+  }
+  const int64_t size = source->size();
+  if (entry.jpeg_length == 0 || entry.jpeg_length > SIZE_MAX ||
+      (size >= 0 && (entry.jpeg_offset > uint64_t(size) ||
+                     entry.jpeg_length > uint64_t(size) - entry.jpeg_offset))) {
+    return THUMB_INVALID_FILE;
+  }
+  const size_t length = size_t(entry.jpeg_length);
+  const uint8_t *data = source->view(entry.jpeg_offset, length);
+  if (!data) {
+    buffer.resize(length);
+    eThumbStatus status = thumb_source_read_exact(source, entry.jpeg_offset,
+                                                  buffer.data(), length);
+    if (status != THUMB_OK) {
+      return status;
+    }
+    data = buffer.data();
+  }
+  if (thumb_hash64(data, length) != entry.jpeg_hash) {
+    return THUMB_INVALID_FILE;
+  }
+  *r_trailer = {data, length, entry.jpeg_offset};
+  return THUMB_OK;
+}
+
+/** \} */
@@ -0,0 +1,138 @@
+/** \file
+ * Persistent manifest of where each place's thumbnail lives.
+ *
+ * Re-thumbnailing an archive searches every file for its trailer again, even
+ * when nothing changed. A manifest remembers, per path, the file's size,
+ * modification time and identity together with what the extraction found:
+ * the JPEG's offset, length and hash, or why there wasn't one. A file whose
+ * stamp still matches is either skipped outright or read with a single
+ * #ThumbSource::read_at of exactly its JPEG.
+ *
+ * On disk a manifest is a header, a table of fixed-size entries sorted by
+ * path hash, and the paths themselves. It is used straight from a mapping;
+ * opening one doesn't parse it, and a lookup is a binary search over the
+ * entries, so millions of files cost O(log n) page touches per lookup.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "thumb.hh"
+
+/** What identifies one version of a file, as far as the manifest cares. */
+struct ThumbFileStamp {
+  uint64_t size;
+  int64_t mtime_ns;
+  uint64_t device;
+  uint64_t inode;
+};
+
+inline bool operator==(const ThumbFileStamp &a, const ThumbFileStamp &b) {
+  return a.size == b.size && a.mtime_ns == b.mtime_ns &&
+         a.device == b.device && a.inode == b.inode;
+}
+
+/** One file, as stored on disk. */
+struct ThumbManifestEntry {
+  /** #thumb_hash64 of the path, the sort key. */
+  uint64_t path_hash;
+  /** Where the path is in the manifest's path table. */
+  uint64_t path_offset;
+  uint32_t path_length;
+  /**
+   * #eThumbStatus of the extraction. Files without a usable trailer are
+   * remembered too, so they aren't searched again either.
+   */
+  uint32_t status;
+  ThumbFileStamp stamp;
+  /** The JPEG's range in the file and #thumb_hash64 of its bytes. */
+  uint64_t jpeg_offset;
+  uint64_t jpeg_length;
+  uint64_t jpeg_hash;
+};
+
+static_assert(sizeof(ThumbManifestEntry) == 80,
+              "manifest entries are stored as is");
+
+/**
+ * A manifest opened from a source, normally a mapped file. Entries are read
+ * in place from #ThumbSource::view when the source has one, and from a copy
+ * otherwise. A missing, damaged or foreign file opens as an empty manifest.
+ */
+class ThumbManifest {
+public:
+  ThumbManifest() = default;
+  explicit ThumbManifest(std::unique_ptr<ThumbSource> source);
+
+  /** Entry for \a path, or null. */
+  const ThumbManifestEntry *find(std::string_view path) const;
+  std::string_view path(const ThumbManifestEntry &entry) const;
+
+  size_t size() const { return _count; }
+  const ThumbManifestEntry *begin() const { return _entries; }
+  const ThumbManifestEntry *end() const { return _entries + _count; }
+
+  /**
+   * Whatever the writer recorded alongside the entries, e.g. the thumbnail
+   * size a batch produced, so it can tell whether its outputs still apply.
+   */
+  uint64_t tag() const { return _tag; }
+
+private:
+  std::unique_ptr<ThumbSource> _source;
+  /** Holds the file when the source can't be viewed in place. */
+  std::vector<uint64_t> _copy;
+  const ThumbManifestEntry *_entries = nullptr;
+  size_t _count = 0;
+  const char *_paths = nullptr;
+  uint64_t _paths_size = 0;
+  uint64_t _tag = 0;
+};
+
+/** Collects entries in any order and writes them out sorted. */
+class ThumbManifestWriter {
+public:
+  /** Add \a path; the path fields of \a entry are filled in on #write. */
+  void add(std::string_view path, const ThumbManifestEntry &entry);
+
+  /**
+   * Write the manifest to \a path through a temporary file, so readers
+   * never see half of it. False if it couldn't be written.
+   */
+  bool write(const char *path, uint64_t tag) const;
+
+  size_t size() const { return _entries.size(); }
+
+private:
+  std::vector<ThumbManifestEntry> _entries;
+  std::string _paths;
+};
+
+/**
+ * The entry for a file read by a fresh extraction: \a status and, when that
+ * is #THUMB_OK, the range and hash of \a trailer.
+ */
+ThumbManifestEntry thumb_manifest_entry(const ThumbFileStamp &stamp,
+                                        eThumbStatus status,
+                                        const ThumbTrailer *trailer);
+
+/**
+ * Read the JPEG \a entry points at with one read, into \a buffer or straight
+ * from the source's #ThumbSource::view. Bytes that no longer hash to what
+ * the entry recorded make it #THUMB_INVALID_FILE; the caller falls back to
+ * #thumb_read_trailer then.
+ */
+eThumbStatus thumb_read_manifest_trailer(ThumbSource *source,
+                                         const ThumbManifestEntry &entry,
+                                         ThumbBuffer &buffer,
+                                         ThumbTrailer *r_trailer);
+
+#ifndef _WIN32
+/** Stamp of the file at \a path, false if it can't be stat'ed. */
+bool thumb_file_stamp(const char *path, ThumbFileStamp *r_stamp);
+#endif
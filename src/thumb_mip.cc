@@ -0,0 +1,219 @@
+/** \file
+ * Mip pyramids, see thumb_mip.hh.
+ */
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <iterator>
+#include <utility>
+
+#include "thumb_mip.hh"
+#include "thumb_resample.hh"
+
+/* -------------------------------------------------------------------- */
+/** \name Building
+ * \{ */
+
+/**
+ * Halve \a src with a 2x2 box filter, rounding to nearest. An odd last row or
+ * column is averaged with itself.
+ */
+static void box_halve(const Thumbnail &src, Thumbnail *dst) {
+  dst->width = (src.width + 1) / 2;
+  dst->height = (src.height + 1) / 2;
+  const size_t src_stride = thumb_bgr_stride(src.width);
+  const size_t dst_stride = thumb_bgr_stride(dst->width);
+  dst->data.resize(dst_stride * dst->height);
+
+  /* Pixel pairs that lie completely inside the row; the odd one is
+   * handled after the loop. */
+  const int pairs = src.width / 2;
+  for (int y = 0; y < dst->height; y++) {
+    const uint8_t *a = src.data.data() + size_t(2 * y) * src_stride;
+    const uint8_t *b = 2 * y + 1 < src.height ? a + src_stride : a;
+    uint8_t *q = dst->data.data() + size_t(y) * dst_stride;
+    for (int x = 0; x < pairs; x++) {
+      for (int c = 0; c < 3; c++) {
+        q[c] = uint8_t((a[c] + a[c + 3] + b[c] + b[c + 3] + 2) >> 2);
+      }
+      a += 6;
+      b += 6;
+      q += 3;
+    }
+    if (src.width & 1) {
+      for (int c = 0; c < 3; c++) {
+        q[c] = uint8_t((a[c] + b[c] + 1) >> 1);
+      }
+    }
+  }
+}
+
+void thumb_pyramid_build(Thumbnail *image, ThumbPyramid *r_pyramid) {
+  /* Count the levels first, so a recycled pyramid halves into the buffers it
+   * already has. */
+  size_t count = 1;
+  for (int width = image->width, height = image->height;
+       std::max(width, height) > thumb_mip_bottom; count++) {
+    width = (width + 1) / 2;
+    height = (height + 1) / 2;
+  }
+  std::vector<Thumbnail> &levels = r_pyramid->levels;
+  levels.resize(count);
+  std::swap(levels.front(), *image);
+  const int longest = std::max(levels.front().width, levels.front().height);
+  r_pyramid->max_cx = longest < thumb_mip_top ? INT_MAX : longest;
+
+  for (size_t i = 1; i < count; i++) {
+    box_halve(levels[i - 1], &levels[i]);
+  }
+}
+
+size_t ThumbPyramid::size_bytes() const {
+  size_t size = 0;
+  for (const Thumbnail &level : levels) {
+    size += level.data.size();
+  }
+  return size;
+}
+
+/** \} */
+
+/* -------------------------------------------------------------------- */
+/** \name Serving
+ * \{ */
+
+bool thumb_pyramid_fit(const ThumbPyramid &pyramid, int cx, Thumbnail *thumb) {
+  if (pyramid.levels.empty() || cx > pyramid.max_cx) {
+    return false;
+  }
+  /* The smallest level whose longest edge still covers cx; the top level
+   * when cx is larger than the image itself. */
+  const Thumbnail *level = &pyramid.levels.front();
+  for (const Thumbnail &candidate : pyramid.levels) {
+    if (std::max(candidate.width, candidate.height) < cx) {
+      break;
+    }
+    level = &candidate;
+  }
+
+  int width, height;
+  thumb_fit_size(level->width, level->height, cx, &width, &height);
+  const size_t stride = thumb_bgr_stride(width);
+  thumb->width = width;
+  thumb->height = height;
+  thumb->data.resize(stride * height);
+  if (width == level->width && height == level->height) {
+    memcpy(thumb->data.data(), level->data.data(), thumb->data.size());
+  } else {
+    thumb_resample_bgr(level->data.data(), level->width, level->height,
+                       thumb_bgr_stride(level->width), thumb->data.data(),
+                       width, height, stride);
+  }
+  return true;
+}
+
+/** \} */
+
+/* -------------------------------------------------------------------- */
+/** \name Cache
+ * \{ */
+
+std::shared_ptr<const ThumbPyramid> ThumbPyramidCache::lookup(
+    uint64_t hash, uint64_t length) {
+  std::lock_guard<std::mutex> guard(_lock);
+  auto found = _index.find(hash);
+  if (found == _index.end() || found->second->length != length) {
+    return nullptr;
+  }
+  _entries.splice(_entries.begin(), _entries, found->second);
+  return found->second->pyramid;
+}
+
+bool ThumbPyramidCache::note_miss(uint64_t hash, uint64_t length) {
+  std::lock_guard<std::mutex> guard(_lock);
+  for (const Miss &miss : _misses) {
+    if (miss.hash == hash && miss.length == length) {
+      return true;
+    }
+  }
+  _misses[_next_miss] = {hash, length};
+  _next_miss = (_next_miss + 1) % miss_history;
+  return false;
+}
+
+std::shared_ptr<ThumbPyramid> ThumbPyramidCache::acquire() {
+  {
+    std::lock_guard<std::mutex> guard(_lock);
+    for (std::shared_ptr<const ThumbPyramid> &spare : _spare_pyramids) {
+      /* Pyramids still being served from can't be written to. */
+      if (spare && spare.use_count() == 1) {
+        return std::const_pointer_cast<ThumbPyramid>(std::move(spare));
+      }
+    }
+  }
+  return std::make_shared<ThumbPyramid>();
+}
+
+void ThumbPyramidCache::drop(std::list<Entry>::iterator entry,
+                             std::list<Entry> &dropped) {
+  _bytes -= entry->pyramid->size_bytes();
+  _spare_nodes.push_back(_index.extract(entry->hash));
+  for (std::shared_ptr<const ThumbPyramid> &spare : _spare_pyramids) {
+    if (!spare) {
+      spare = std::move(entry->pyramid);
+      break;
+    }
+  }
+  dropped.splice(dropped.end(), _entries, entry);
+}
+
+void ThumbPyramidCache::insert(uint64_t hash, uint64_t length,
+                               std::shared_ptr<const ThumbPyramid> pyramid) {
+  const size_t size = pyramid->size_bytes();
+  /* Dropped entries are released outside the lock, a pyramid can be a few
+   * megabytes. Their list nodes are kept for the next insert. */
+  std::list<Entry> dropped;
+  {
+    std::lock_guard<std::mutex> guard(_lock);
+    auto found = _index.find(hash);
+    if (found != _index.end()) {
+      drop(found->second, dropped);
+    }
+    if (_spare_entries.empty()) {
+      _entries.push_front({hash, length, std::move(pyramid)});
+    } else {
+      _entries.splice(_entries.begin(), _spare_entries,
+                      _spare_entries.begin());
+      _entries.front().hash = hash;
+      _entries.front().length = length;
+      _entries.front().pyramid = std::move(pyramid);
+    }
+    if (_spare_nodes.empty()) {
+      _index.emplace(hash, _entries.begin());
+    } else {
+      auto node = std::move(_spare_nodes.back());
+      _spare_nodes.pop_back();
+      node.key() = hash;
+      node.mapped() = _entries.begin();
+      _index.insert(std::move(node));
+    }
+    _bytes += size;
+    /* The newest entry stays even when it alone is over the limit. */
+    while (_bytes > _max_bytes && _entries.size() > 1) {
+      drop(std::prev(_entries.end()), dropped);
+    }
+  }
+  for (Entry &entry : dropped) {
+    entry.pyramid.reset();
+  }
+  std::lock_guard<std::mutex> guard(_lock);
+  _spare_entries.splice(_spare_entries.end(), dropped);
+}
+
+size_t ThumbPyramidCache::size_bytes() const {
+  std::lock_guard<std::mutex> guard(_lock);
+  return _bytes;
+}
+
+/** \} */
@@ -0,0 +1,125 @@
+/** \file
+ * Mip pyramids of decoded thumbnails.
+ *
+ * Explorer asks for the same place at several sizes (icons, tiles, the
+ * preview pane), each through its own #IThumbnailProvider call. Instead of
+ * reading and decoding the JPEG for every one of them, the second request
+ * for a JPEG decodes at the DCT scale covering #thumb_mip_top and halves
+ * that with a 2x2 box filter down to #thumb_mip_bottom. The pyramid is kept
+ * in memory, and any later request up to the top level is one resample from
+ * the nearest level at or above its size. The first request takes the
+ * fused decode at its own size, most places are only ever shown at one;
+ * requests at or above the top build from their own decode right away.
+ *
+ * The decoded image itself is the top level: fitting it to exactly
+ * #thumb_mip_top first would cost a full-size Lanczos pass, several times
+ * what all the box levels below it take together.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "thumb.hh"
+
+/** Largest cx served from pyramids, sizes above it are decoded directly. */
+static constexpr int thumb_mip_top = 1024;
+/** Levels stop halving once their longest edge is this or less. */
+static constexpr int thumb_mip_bottom = 64;
+
+struct ThumbPyramid {
+  /** Largest first, each level half the size of the one before it. */
+  std::vector<Thumbnail> levels;
+  /**
+   * Largest cx the pyramid serves: the top level's longest edge, or
+   * unbounded when that is below #thumb_mip_top; a decode covering the top
+   * only stops short of it when the image is smaller.
+   */
+  int max_cx;
+
+  /** Memory held by the levels. */
+  size_t size_bytes() const;
+};
+
+/**
+ * Build the levels from \a image, which must come from a decode covering
+ * #thumb_mip_top or the largest size the pyramid is to serve. The pixels
+ * move into the top level, and \a image gets the buffer of the pyramid's
+ * previous top level back; rebuilding a recycled pyramid doesn't allocate.
+ */
+void thumb_pyramid_build(Thumbnail *image, ThumbPyramid *r_pyramid);
+
+/**
+ * Fill \a thumb with \a pyramid fitted to \a cx, resampled from the smallest
+ * level that still covers it. False, leaving \a thumb alone, when cx is above
+ * what the pyramid serves.
+ */
+bool thumb_pyramid_fit(const ThumbPyramid &pyramid, int cx, Thumbnail *thumb);
+
+/**
+ * In-memory pyramids keyed by the JPEG they were decoded from, bounded to
+ * roughly \a max_bytes by dropping the least recently used. Safe to share
+ * between threads; a pyramid handed out stays valid after it is dropped.
+ */
+class ThumbPyramidCache {
+public:
+  explicit ThumbPyramidCache(size_t max_bytes) : _max_bytes(max_bytes) {}
+
+  /** Pyramid for the JPEG with #thumb_hash64 \a hash, or null. */
+  std::shared_ptr<const ThumbPyramid> lookup(uint64_t hash, uint64_t length);
+  void insert(uint64_t hash, uint64_t length,
+              std::shared_ptr<const ThumbPyramid> pyramid);
+
+  /**
+   * Note a request for the JPEG that missed the cache. True when the JPEG
+   * already missed recently: the shell is going through the sizes of that
+   * place, and building a pyramid pays off.
+   */
+  bool note_miss(uint64_t hash, uint64_t length);
+
+  /**
+   * A pyramid to build into: one dropped earlier that nothing is served from
+   * any more, so its buffers are reused, or a new one.
+   */
+  std::shared_ptr<ThumbPyramid> acquire();
+
+  size_t size_bytes() const;
+
+private:
+  struct Entry {
+    uint64_t hash;
+    uint64_t length;
+    std::shared_ptr<const ThumbPyramid> pyramid;
+  };
+  struct Miss {
+    uint64_t hash;
+    uint64_t length;
+  };
+  using Index = std::unordered_map<uint64_t, std::list<Entry>::iterator>;
+
+  static constexpr int miss_history = 64;
+  /** Dropped pyramids kept for #acquire, outside of #_max_bytes. */
+  static constexpr int spare_pyramids = 2;
+
+  /** Remove \a entry, moving it to \a dropped to be released unlocked. */
+  void drop(std::list<Entry>::iterator entry, std::list<Entry> &dropped);
+
+  /** Most recently used first. */
+  std::list<Entry> _entries;
+  Index _index;
+  /* List and index nodes of dropped entries, reused by #insert so a full
+   * cache doesn't allocate. */
+  std::list<Entry> _spare_entries;
+  std::vector<Index::node_type> _spare_nodes;
+  std::shared_ptr<const ThumbPyramid> _spare_pyramids[spare_pyramids];
+  Miss _misses[miss_history] = {};
+  int _next_miss = 0;
+  size_t _max_bytes;
+  size_t _bytes = 0;
+  mutable std::mutex _lock;
+};
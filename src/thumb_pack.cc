@@ -0,0 +1,231 @@
+/** \file
+ * Pixel format conversion kernels, see thumb_pack.hh.
+ *
+ * The SIMD kernels move whole groups of pixels with `pshufb`: four 3-byte
+ * pixels spread over four 32-bit slots (or the other way around), with the
+ * alpha slot zeroed by the shuffle and set with an OR. Pixels left over at
+ * the end of a row, and rows too short to load a full register from, go to
+ * the next narrower kernel.
+ */
+
+#include <cstring>
+
+#include "thumb_cpu.hh"
+#include "thumb_pack.hh"
+#include "thumb_resample.hh"
+
+using RowFn = void (*)(const uint8_t *src, uint8_t *dst, int width);
+
+static constexpr size_t pixel_size(eThumbPixelFormat format) {
+  return format == THUMB_PIXEL_BGRA32 ? 4 : 3;
+}
+
+/* -------------------------------------------------------------------- */
+/** \name 24 to 32 bits
+ * \{ */
+
+template<eThumbPixelFormat Src>
+static void to_bgra_scalar(const uint8_t *src, uint8_t *dst, int width) {
+  constexpr int blue = Src == THUMB_PIXEL_BGR24 ? 0 : 2;
+  for (int x = 0; x < width; x++) {
+    const uint8_t *p = src + x * 3;
+    uint8_t *q = dst + x * 4;
+    q[0] = p[blue];
+    q[1] = p[1];
+    q[2] = p[2 - blue];
+    q[3] = 0xff;
+  }
+}
+
+#ifdef THUMB_X86_64
+
+/** Four pixels from the low 12 bytes to BGRX, X zeroed. */
+template<eThumbPixelFormat Src> static __m128i to_bgra_shuffle() {
+  if constexpr (Src == THUMB_PIXEL_BGR24) {
+    return _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  } else {
+    return _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+  }
+}
+
+template<eThumbPixelFormat Src>
+THUMB_TARGET_SSSE3 static void to_bgra_ssse3(const uint8_t *src, uint8_t *dst,
+                                             int width) {
+  const __m128i shuffle = to_bgra_shuffle<Src>();
+  const __m128i alpha = _mm_set1_epi32(int(0xff000000u));
+  int x = 0;
+  /* Sixteen pixels from three loads, realigned so each register starts on a
+   * pixel. Nothing is read past the last pixel. */
+  for (; x + 16 <= width; x += 16) {
+    const uint8_t *p = src + x * 3;
+    const __m128i in0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    const __m128i in1 =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16));
+    const __m128i in2 =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 32));
+    const __m128i px[4] = {in0, _mm_alignr_epi8(in1, in0, 12),
+                           _mm_alignr_epi8(in2, in1, 8),
+                           _mm_srli_si128(in2, 4)};
+    for (int i = 0; i < 4; i++) {
+      _mm_storeu_si128(
+          reinterpret_cast<__m128i *>(dst + x * 4 + i * 16),
+          _mm_or_si128(_mm_shuffle_epi8(px[i], shuffle), alpha));
+    }
+  }
+  to_bgra_scalar<Src>(src + x * 3, dst + x * 4, width - x);
+}
+
+template<eThumbPixelFormat Src>
+THUMB_TARGET_AVX2 static void to_bgra_avx2(const uint8_t *src, uint8_t *dst,
+                                           int width) {
+  const __m256i shuffle = _mm256_broadcastsi128_si256(to_bgra_shuffle<Src>());
+  const __m256i alpha = _mm256_set1_epi32(int(0xff000000u));
+  int x = 0;
+  /* Eight pixels, four per lane. The upper load reads four bytes past them,
+   * so two more pixels have to follow. */
+  for (; x + 10 <= width; x += 8) {
+    const uint8_t *p = src + x * 3;
+    const __m256i in = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(p))),
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 12)), 1);
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i *>(dst + x * 4),
+        _mm256_or_si256(_mm256_shuffle_epi8(in, shuffle), alpha));
+  }
+  _mm256_zeroupper();
+  to_bgra_ssse3<Src>(src + x * 3, dst + x * 4, width - x);
+}
+
+#endif
+
+/** \} */
+
+/* -------------------------------------------------------------------- */
+/** \name 32 to 24 bits
+ * \{ */
+
+static void to_bgr_scalar(const uint8_t *src, uint8_t *dst, int width) {
+  for (int x = 0; x < width; x++) {
+    memcpy(dst + x * 3, src + x * 4, 3);
+  }
+}
+
+#ifdef THUMB_X86_64
+
+/** Four BGRX pixels to the low 12 bytes, the rest zeroed. */
+static __m128i to_bgr_shuffle() {
+  return _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+}
+
+THUMB_TARGET_SSSE3
+static void to_bgr_ssse3(const uint8_t *src, uint8_t *dst, int width) {
+  const __m128i shuffle = to_bgr_shuffle();
+  int x = 0;
+  /* Sixteen pixels packed into three full stores. */
+  for (; x + 16 <= width; x += 16) {
+    const __m128i *p = reinterpret_cast<const __m128i *>(src + x * 4);
+    __m128i *q = reinterpret_cast<__m128i *>(dst + x * 3);
+    const __m128i a = _mm_shuffle_epi8(_mm_loadu_si128(p + 0), shuffle);
+    const __m128i b = _mm_shuffle_epi8(_mm_loadu_si128(p + 1), shuffle);
+    const __m128i c = _mm_shuffle_epi8(_mm_loadu_si128(p + 2), shuffle);
+    const __m128i d = _mm_shuffle_epi8(_mm_loadu_si128(p + 3), shuffle);
+    _mm_storeu_si128(q + 0, _mm_or_si128(a, _mm_slli_si128(b, 12)));
+    _mm_storeu_si128(q + 1,
+                     _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+    _mm_storeu_si128(q + 2,
+                     _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+  }
+  to_bgr_scalar(src + x * 4, dst + x * 3, width - x);
+}
+
+THUMB_TARGET_AVX2
+static void to_bgr_avx2(const uint8_t *src, uint8_t *dst, int width) {
+  const __m256i shuffle = _mm256_broadcastsi128_si256(to_bgr_shuffle());
+  /* Close the gap between the lanes' 12 byte halves. */
+  const __m256i compact = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+  int x = 0;
+  /* Eight pixels per store, which writes eight bytes of zeroes past them;
+   * the next store or the narrower kernel overwrites those, and the loop
+   * stops while they still land inside the row. */
+  for (; x + 11 <= width; x += 8) {
+    const __m256i in =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + x * 4));
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i *>(dst + x * 3),
+        _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(in, shuffle),
+                                    compact));
+  }
+  _mm256_zeroupper();
+  to_bgr_ssse3(src + x * 4, dst + x * 3, width - x);
+}
+
+#endif
+
+/** \} */
+
+template<eThumbPixelFormat Src, eThumbPixelFormat Dst>
+static RowFn select_row() {
+  [[maybe_unused]] const eThumbSimdLevel simd = thumb_simd_level();
+  if constexpr (Dst == THUMB_PIXEL_BGRA32) {
+#ifdef THUMB_X86_64
+    if (simd >= THUMB_SIMD_AVX2) {
+      return to_bgra_avx2<Src>;
+    }
+    if (simd >= THUMB_SIMD_SSSE3) {
+      return to_bgra_ssse3<Src>;
+    }
+#endif
+    return to_bgra_scalar<Src>;
+  } else {
+#ifdef THUMB_X86_64
+    if (simd >= THUMB_SIMD_AVX2) {
+      return to_bgr_avx2;
+    }
+    if (simd >= THUMB_SIMD_SSSE3) {
+      return to_bgr_ssse3;
+    }
+#endif
+    return to_bgr_scalar;
+  }
+}
+
+template<eThumbPixelFormat Src, eThumbPixelFormat Dst>
+void thumb_convert_pixels(const uint8_t *src, size_t src_stride, uint8_t *dst,
+                          size_t dst_stride, int width, int height) {
+  if constexpr (Src == Dst) {
+    /* Rows are plain copies, memcpy already moves them at full width. */
+    const size_t row_size = size_t(width) * pixel_size(Src);
+    for (int y = 0; y < height; y++) {
+      memcpy(dst + size_t(y) * dst_stride, src + size_t(y) * src_stride,
+             row_size);
+    }
+  } else {
+    static_assert(Src == THUMB_PIXEL_BGRA32 ? Dst == THUMB_PIXEL_BGR24
+                                            : Dst == THUMB_PIXEL_BGRA32,
+                  "No kernel for this pair of pixel formats");
+    const RowFn row = select_row<Src, Dst>();
+    for (int y = 0; y < height; y++) {
+      row(src + size_t(y) * src_stride, dst + size_t(y) * dst_stride, width);
+    }
+  }
+}
+
+#define THUMB_CONVERT_PIXELS(src, dst) \
+  template void thumb_convert_pixels<src, dst>( \
+      const uint8_t *, size_t, uint8_t *, size_t, int, int);
+
+THUMB_CONVERT_PIXELS(THUMB_PIXEL_RGB24, THUMB_PIXEL_BGRA32)
+THUMB_CONVERT_PIXELS(THUMB_PIXEL_BGR24, THUMB_PIXEL_BGRA32)
+THUMB_CONVERT_PIXELS(THUMB_PIXEL_BGRA32, THUMB_PIXEL_BGR24)
+THUMB_CONVERT_PIXELS(THUMB_PIXEL_RGB24, THUMB_PIXEL_RGB24)
+THUMB_CONVERT_PIXELS(THUMB_PIXEL_BGR24, THUMB_PIXEL_BGR24)
+THUMB_CONVERT_PIXELS(THUMB_PIXEL_BGRA32, THUMB_PIXEL_BGRA32)
+
+#undef THUMB_CONVERT_PIXELS
+
+void thumb_pack_bgra(const Thumbnail &thumb, uint8_t *dst, size_t dst_stride) {
+  thumb_convert_pixels<THUMB_PIXEL_BGR24, THUMB_PIXEL_BGRA32>(
+      thumb.data.data(), thumb_bgr_stride(thumb.width), dst, dst_stride,
+      thumb.width, thumb.height);
+}
@@ -0,0 +1,52 @@
+/** \file
+ * Pixel format conversion and output packing.
+ *
+ * The decoders, resampler and cache work on BGR24 rows padded to 4 bytes;
+ * the shell handler writes top-down BGRA32 straight into its DIB section and
+ * reports it as `WTSAT_ARGB`. The kernels in between are specialized per
+ * source and destination format at compile time, and pick a scalar, SSSE3 or
+ * AVX2 row kernel once per call.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "thumb.hh"
+
+enum eThumbPixelFormat {
+  /** R, G, B bytes, as libjpeg and WIC's 24bppRGB lay them out. */
+  THUMB_PIXEL_RGB24,
+  /** B, G, R bytes, the decoders' output and GDI's 24bpp. */
+  THUMB_PIXEL_BGR24,
+  /** B, G, R, A bytes, 32bpp DIBs and the resampler's widened rows. */
+  THUMB_PIXEL_BGRA32,
+};
+
+/** Row stride of a BGRA32 image; 32bpp DIB rows never need padding. */
+inline size_t thumb_bgra_stride(int width) {
+  return size_t(width) * 4;
+}
+
+/**
+ * Convert \a width x \a height pixels from \a Src to \a Dst, rows
+ * \a src_stride and \a dst_stride bytes apart. Defined for:
+ * - #THUMB_PIXEL_RGB24 and #THUMB_PIXEL_BGR24 to #THUMB_PIXEL_BGRA32, with
+ *   opaque alpha;
+ * - #THUMB_PIXEL_BGRA32 to #THUMB_PIXEL_BGR24, dropping alpha;
+ * - any format to itself, which only changes the stride, e.g. from padded
+ *   BGR24 rows to packed ones.
+ *
+ * Other pairs fail to link.
+ */
+template<eThumbPixelFormat Src, eThumbPixelFormat Dst>
+void thumb_convert_pixels(const uint8_t *src, size_t src_stride, uint8_t *dst,
+                          size_t dst_stride, int width, int height);
+
+/**
+ * Write \a thumb to \a dst as top-down BGRA32 with opaque alpha, rows
+ * \a dst_stride bytes apart. JPEGs have no transparency, so the shell can
+ * take alpha as is and skip its own conversion.
+ */
+void thumb_pack_bgra(const Thumbnail &thumb, uint8_t *dst, size_t dst_stride);
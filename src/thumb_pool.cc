@@ -0,0 +1,148 @@
+/** \file
+ * Shared worker threads, see thumb_pool.hh.
+ *
+ * A job is published under the lock together with a new generation number;
+ * the workers it needs wake up, take task indices from an atomic counter
+ * alongside the caller, and report back when the counter runs out. The
+ * caller only returns once every worker of its job has reported, so no
+ * worker can still be looking at a job that has been replaced.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "thumb_pool.hh"
+
+namespace {
+
+struct Pool {
+  /** Held by the caller whose job owns the workers. */
+  std::mutex busy;
+
+  std::mutex lock;
+  std::condition_variable wake;
+  std::condition_variable done;
+  std::vector<std::thread> workers;
+  bool stopping = false;
+  uint64_t generation = 0;
+
+  /* The current job. */
+  ThumbTaskFn fn = nullptr;
+  void *context = nullptr;
+  int count = 0;
+  std::atomic<int> next{0};
+  /** Workers taking part, the first ones in #workers. */
+  int job_workers = 0;
+  int finished = 0;
+};
+
+}  // namespace
+
+static std::atomic<int> threads_override{0};
+
+/* Never destroyed: at process exit the workers may already be gone, and a
+ * module that unloads calls #thumb_pool_shutdown first. */
+static Pool &pool() {
+  static Pool *instance = new Pool();
+  return *instance;
+}
+
+static void run_tasks(Pool &p) {
+  for (;;) {
+    const int i = p.next.fetch_add(1, std::memory_order_relaxed);
+    if (i >= p.count) {
+      return;
+    }
+    p.fn(p.context, i);
+  }
+}
+
+/** \a seen is the generation when the worker was started, so it still
+ * picks up the job published right after. */
+static void worker_main(Pool *p, int slot, uint64_t seen) {
+  std::unique_lock<std::mutex> guard(p->lock);
+  for (;;) {
+    p->wake.wait(guard,
+                 [&] { return p->stopping || p->generation != seen; });
+    if (p->stopping) {
+      return;
+    }
+    seen = p->generation;
+    if (slot >= p->job_workers) {
+      continue;
+    }
+    guard.unlock();
+    run_tasks(*p);
+    guard.lock();
+    if (++p->finished == p->job_workers) {
+      p->done.notify_all();
+    }
+  }
+}
+
+void thumb_parallel_run(int count, int threads, ThumbTaskFn fn,
+                        void *context) {
+  threads = std::min(threads, count);
+  Pool &p = pool();
+  if (threads <= 1 || !p.busy.try_lock()) {
+    for (int i = 0; i < count; i++) {
+      fn(context, i);
+    }
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(p.lock);
+    while (int(p.workers.size()) < threads - 1) {
+      p.workers.emplace_back(worker_main, &p, int(p.workers.size()),
+                             p.generation);
+    }
+    p.fn = fn;
+    p.context = context;
+    p.count = count;
+    p.next.store(0, std::memory_order_relaxed);
+    p.job_workers = threads - 1;
+    p.finished = 0;
+    p.generation++;
+  }
+  p.wake.notify_all();
+  run_tasks(p);
+  {
+    std::unique_lock<std::mutex> guard(p.lock);
+    p.done.wait(guard, [&] { return p.finished == p.job_workers; });
+  }
+  p.busy.unlock();
+}
+
+int thumb_pool_threads() {
+  static const int cores =
+      int(std::max(1u, std::thread::hardware_concurrency()));
+  const int threads = threads_override.load(std::memory_order_relaxed);
+  return threads > 0 ? threads : cores;
+}
+
+void thumb_pool_set_threads(int threads) {
+  threads_override.store(std::max(threads, 0), std::memory_order_relaxed);
+}
+
+void thumb_pool_shutdown() {
+  Pool &p = pool();
+  std::lock_guard<std::mutex> busy(p.busy);
+  std::vector<std::thread> workers;
+  {
+    std::lock_guard<std::mutex> guard(p.lock);
+    p.stopping = true;
+    workers.swap(p.workers);
+  }
+  p.wake.notify_all();
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  std::lock_guard<std::mutex> guard(p.lock);
+  p.stopping = false;
+}
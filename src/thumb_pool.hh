@@ -0,0 +1,49 @@
+/** \file
+ * Worker threads shared by the decoders.
+ *
+ * The pool starts its threads on first use and keeps them, so a parallel
+ * decode doesn't pay for creating threads (or allocating) every time. One
+ * caller's work runs on the pool at a time; when another thread asks while
+ * it is busy, its tasks simply run on the calling thread, which is what
+ * happens with several thumbnails being extracted at once anyway.
+ */
+
+#pragma once
+
+#include <type_traits>
+
+using ThumbTaskFn = void (*)(void *context, int index);
+
+/**
+ * Call \a fn for every index in [0, \a count) on up to \a threads threads,
+ * the calling one included, and return once all calls are done. Tasks are
+ * handed out in order, one at a time, as threads become free.
+ */
+void thumb_parallel_run(int count, int threads, ThumbTaskFn fn,
+                        void *context);
+
+template<typename Fn>
+void thumb_parallel_for(int count, int threads, Fn &&fn) {
+  using Callable = std::remove_reference_t<Fn>;
+  thumb_parallel_run(
+      count, threads,
+      [](void *context, int index) {
+        (*static_cast<Callable *>(context))(index);
+      },
+      const_cast<void *>(static_cast<const void *>(&fn)));
+}
+
+/** Threads parallel work should use: one per core unless set otherwise. */
+int thumb_pool_threads();
+
+/**
+ * Override #thumb_pool_threads, so benchmarks can compare thread counts and
+ * hosts can keep a decode on fewer cores; 0 goes back to one per core.
+ */
+void thumb_pool_set_threads(int threads);
+
+/**
+ * Stop and join the workers. A module that is about to be unloaded must
+ * call this first; the next parallel call starts them again.
+ */
+void thumb_pool_shutdown();
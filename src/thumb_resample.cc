@@ -0,0 +1,425 @@
+/** \file
+ * Separable Lanczos-3 resampler, see thumb_resample.hh.
+ *
+ * The horizontal pass widens every source row to BGRX and filters it into a
+ * window of `dst_width` BGRX rows, as many as the vertical filter has taps;
+ * the vertical pass then filters columns of that window into the BGR24
+ * output. Both passes use a fixed number of taps per output sample, padded
+ * with zero weights to a multiple of four so the kernels can feed pairs of
+ * taps to `pmaddwd` and keep two accumulators in flight.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "thumb_cpu.hh"
+#include "thumb_pack.hh"
+#include "thumb_resample.hh"
+
+static constexpr int weight_bits = 14;
+static constexpr int weight_round = 1 << (weight_bits - 1);
+static constexpr double lanczos_lobes = 3.0;
+static constexpr double pi = 3.14159265358979323846;
+
+/**
+ * Filter for one axis: output `i` reads `taps` samples from `start[i]`.
+ * `pairs` holds the same weights as `weights`, two per 32-bit word in the
+ * order `pmaddwd` wants them. The arrays live in the request arena.
+ */
+struct ThumbFilterTaps {
+  int taps;
+  int *start;
+  int16_t *weights;
+  int32_t *pairs;
+};
+
+static double lanczos(double x) {
+  x = std::fabs(x);
+  if (x < 1e-9) {
+    return 1.0;
+  }
+  if (x >= lanczos_lobes) {
+    return 0.0;
+  }
+  const double px = pi * x;
+  return lanczos_lobes * std::sin(px) * std::sin(px / lanczos_lobes) /
+         (px * px);
+}
+
+static const ThumbFilterTaps *make_taps(ThumbArena &arena, int src_len,
+                                        int dst_len) {
+  const double scale = double(src_len) / dst_len;
+  /* When shrinking, stretch the kernel so it averages over the whole
+   * footprint of each output sample. */
+  const double filter_scale = std::max(scale, 1.0);
+  const double support = lanczos_lobes * filter_scale;
+
+  ThumbFilterTaps &filter = *arena.alloc_array<ThumbFilterTaps>(1);
+  filter.taps = (int(std::ceil(support)) * 2 + 1 + 3) & ~3;
+  const size_t count = size_t(dst_len) * filter.taps;
+  filter.start = arena.alloc_array<int>(dst_len);
+  filter.weights = arena.alloc_array<int16_t>(count);
+  memset(filter.weights, 0, count * sizeof(int16_t));
+
+  double *weights = arena.alloc_array<double>(filter.taps);
+  for (int i = 0; i < dst_len; i++) {
+    const double center = (i + 0.5) * scale;
+    int lo = std::max(0, int(std::floor(center - support)));
+    int hi = std::min(src_len, int(std::ceil(center + support)));
+    hi = std::min(hi, lo + filter.taps);
+
+    double sum = 0.0;
+    for (int j = lo; j < hi; j++) {
+      weights[j - lo] = lanczos((j + 0.5 - center) / filter_scale);
+      sum += weights[j - lo];
+    }
+
+    int16_t *out = &filter.weights[size_t(i) * filter.taps];
+    int total = 0, largest = 0;
+    for (int j = 0; j < hi - lo; j++) {
+      out[j] = int16_t(std::lround(weights[j] / sum * (1 << weight_bits)));
+      total += out[j];
+      largest = out[j] > out[largest] ? j : largest;
+    }
+    /* Rounding must not brighten or darken flat areas. */
+    out[largest] = int16_t(out[largest] + (1 << weight_bits) - total);
+    filter.start[i] = lo;
+  }
+
+  filter.pairs = arena.alloc_array<int32_t>(count / 2);
+  for (size_t k = 0; k < count / 2; k++) {
+    filter.pairs[k] =
+        int32_t(uint32_t(uint16_t(filter.weights[k * 2])) |
+                (uint32_t(uint16_t(filter.weights[k * 2 + 1])) << 16));
+  }
+  return &filter;
+}
+
+static inline uint8_t clamp_u8(int value) {
+  return uint8_t(value < 0 ? 0 : value > 255 ? 255 : value);
+}
+
+/* -------------------------------------------------------------------- */
+/** \name Horizontal pass
+ * \{ */
+
+static void horizontal_scalar(const uint8_t *row,
+                              const ThumbFilterTaps &filter, int dst_width,
+                              uint8_t *out) {
+  for (int x = 0; x < dst_width; x++) {
+    const int16_t *w = &filter.weights[size_t(x) * filter.taps];
+    const uint8_t *p = row + size_t(filter.start[x]) * 4;
+    int acc[3] = {weight_round, weight_round, weight_round};
+    for (int j = 0; j < filter.taps; j++) {
+      for (int c = 0; c < 3; c++) {
+        acc[c] += p[j * 4 + c] * w[j];
+      }
+    }
+    for (int c = 0; c < 3; c++) {
+      out[x * 4 + c] = clamp_u8(acc[c] >> weight_bits);
+    }
+    out[x * 4 + 3] = 0;
+  }
+}
+
+#ifdef THUMB_X86_64
+static void horizontal_sse2(const uint8_t *row,
+                            const ThumbFilterTaps &filter, int dst_width,
+                            uint8_t *out) {
+  const __m128i zero = _mm_setzero_si128();
+  for (int x = 0; x < dst_width; x++) {
+    const int32_t *w = &filter.pairs[size_t(x) * filter.taps / 2];
+    const uint8_t *p = row + size_t(filter.start[x]) * 4;
+    __m128i acc0 = _mm_set1_epi32(weight_round);
+    __m128i acc1 = _mm_setzero_si128();
+    for (int j = 0; j < filter.taps; j += 4) {
+      /* Four BGRX pixels, each pair interleaved per channel:
+       * b0 b1 g0 g1 r0 r1 x0 x1 and b2 b3 g2 g3 r2 r3 x2 x3. */
+      __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + j * 4));
+      __m128i lo = _mm_unpacklo_epi8(px, zero);
+      __m128i hi = _mm_unpackhi_epi8(px, zero);
+      lo = _mm_unpacklo_epi16(lo, _mm_unpackhi_epi64(lo, lo));
+      hi = _mm_unpacklo_epi16(hi, _mm_unpackhi_epi64(hi, hi));
+      __m128i w01 = _mm_set1_epi32(w[j / 2]);
+      __m128i w23 = _mm_set1_epi32(w[j / 2 + 1]);
+      acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(lo, w01));
+      acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(hi, w23));
+    }
+    __m128i acc = _mm_srai_epi32(_mm_add_epi32(acc0, acc1), weight_bits);
+    acc = _mm_packs_epi32(acc, acc);
+    acc = _mm_packus_epi16(acc, acc);
+    uint32_t pixel = uint32_t(_mm_cvtsi128_si32(acc));
+    memcpy(out + x * 4, &pixel, 4);
+  }
+}
+
+/* Four taps per `vpmaddwd`: the pixels are widened to words across both
+ * lanes, pixels 0-1 in the low lane and 2-3 in the high one, and each lane
+ * is interleaved per channel like in the SSE2 version, with the matching
+ * weight pair spread over it. The lanes are only summed once per output
+ * pixel. */
+THUMB_TARGET_AVX2
+static inline __m256i madd4_avx2(const uint8_t *p, const int32_t *w) {
+  const __m256i interleave = _mm256_setr_epi8(
+      0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14, 15, 0, 1, 8, 9, 2, 3,
+      10, 11, 4, 5, 12, 13, 6, 7, 14, 15);
+  const __m256i spread = _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1);
+  __m256i px = _mm256_cvtepu8_epi16(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+  __m256i wv = _mm256_permutevar8x32_epi32(
+      _mm256_castsi128_si256(
+          _mm_loadl_epi64(reinterpret_cast<const __m128i *>(w))),
+      spread);
+  return _mm256_madd_epi16(_mm256_shuffle_epi8(px, interleave), wv);
+}
+
+THUMB_TARGET_AVX2
+static void horizontal_avx2(const uint8_t *row,
+                            const ThumbFilterTaps &filter, int dst_width,
+                            uint8_t *out) {
+  const int taps = filter.taps;
+  for (int x = 0; x < dst_width; x++) {
+    const int32_t *w = &filter.pairs[size_t(x) * taps / 2];
+    const uint8_t *p = row + size_t(filter.start[x]) * 4;
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    int j = 0;
+    for (; j + 8 <= taps; j += 8) {
+      acc0 = _mm256_add_epi32(acc0, madd4_avx2(p + j * 4, w + j / 2));
+      acc1 = _mm256_add_epi32(acc1,
+                              madd4_avx2(p + j * 4 + 16, w + j / 2 + 2));
+    }
+    if (j < taps) {
+      acc0 = _mm256_add_epi32(acc0, madd4_avx2(p + j * 4, w + j / 2));
+    }
+    acc0 = _mm256_add_epi32(acc0, acc1);
+    __m128i acc = _mm_add_epi32(_mm256_castsi256_si128(acc0),
+                                _mm256_extracti128_si256(acc0, 1));
+    acc = _mm_add_epi32(acc, _mm_set1_epi32(weight_round));
+    acc = _mm_srai_epi32(acc, weight_bits);
+    acc = _mm_packs_epi32(acc, acc);
+    acc = _mm_packus_epi16(acc, acc);
+    uint32_t pixel = uint32_t(_mm_cvtsi128_si32(acc));
+    memcpy(out + x * 4, &pixel, 4);
+  }
+}
+#endif
+
+/** \} */
+
+/* -------------------------------------------------------------------- */
+/** \name Vertical pass
+ *
+ * Rows are BGRX and padded to a multiple of 32 bytes, so the kernels never
+ * need a tail loop.
+ * \{ */
+
+static void vertical_scalar(const uint8_t *const *rows, const int16_t *w,
+                            int taps, size_t row_bytes, uint8_t *out) {
+  for (size_t i = 0; i < row_bytes; i++) {
+    int acc = weight_round;
+    for (int j = 0; j < taps; j++) {
+      acc += rows[j][i] * w[j];
+    }
+    out[i] = clamp_u8(acc >> weight_bits);
+  }
+}
+
+#ifdef THUMB_X86_64
+static void vertical_sse2(const uint8_t *const *rows, const int32_t *w,
+                          int taps, size_t row_bytes, uint8_t *out) {
+  const __m128i zero = _mm_setzero_si128();
+  for (size_t i = 0; i < row_bytes; i += 16) {
+    __m128i acc[4];
+    for (__m128i &a : acc) {
+      a = _mm_set1_epi32(weight_round);
+    }
+    for (int j = 0; j < taps; j += 2) {
+      __m128i a = _mm_load_si128(reinterpret_cast<const __m128i *>(rows[j] + i));
+      __m128i b =
+          _mm_load_si128(reinterpret_cast<const __m128i *>(rows[j + 1] + i));
+      __m128i wv = _mm_set1_epi32(w[j / 2]);
+      __m128i ab_lo = _mm_unpacklo_epi8(a, b);
+      __m128i ab_hi = _mm_unpackhi_epi8(a, b);
+      acc[0] = _mm_add_epi32(
+          acc[0], _mm_madd_epi16(_mm_unpacklo_epi8(ab_lo, zero), wv));
+      acc[1] = _mm_add_epi32(
+          acc[1], _mm_madd_epi16(_mm_unpackhi_epi8(ab_lo, zero), wv));
+      acc[2] = _mm_add_epi32(
+          acc[2], _mm_madd_epi16(_mm_unpacklo_epi8(ab_hi, zero), wv));
+      acc[3] = _mm_add_epi32(
+          acc[3], _mm_madd_epi16(_mm_unpackhi_epi8(ab_hi, zero), wv));
+    }
+    for (__m128i &a : acc) {
+      a = _mm_srai_epi32(a, weight_bits);
+    }
+    __m128i lo = _mm_packs_epi32(acc[0], acc[1]);
+    __m128i hi = _mm_packs_epi32(acc[2], acc[3]);
+    _mm_store_si128(reinterpret_cast<__m128i *>(out + i),
+                    _mm_packus_epi16(lo, hi));
+  }
+}
+
+/* Same as the SSE2 version; unpacks and packs both work per 128-bit lane, so
+ * the byte order comes out right without any cross-lane shuffles. */
+THUMB_TARGET_AVX2
+static void vertical_avx2(const uint8_t *const *rows, const int32_t *w,
+                          int taps, size_t row_bytes, uint8_t *out) {
+  const __m256i zero = _mm256_setzero_si256();
+  for (size_t i = 0; i < row_bytes; i += 32) {
+    __m256i acc[4];
+    for (__m256i &a : acc) {
+      a = _mm256_set1_epi32(weight_round);
+    }
+    for (int j = 0; j < taps; j += 2) {
+      __m256i a =
+          _mm256_load_si256(reinterpret_cast<const __m256i *>(rows[j] + i));
+      __m256i b = _mm256_load_si256(
+          reinterpret_cast<const __m256i *>(rows[j + 1] + i));
+      __m256i wv = _mm256_set1_epi32(w[j / 2]);
+      __m256i ab_lo = _mm256_unpacklo_epi8(a, b);
+      __m256i ab_hi = _mm256_unpackhi_epi8(a, b);
+      acc[0] = _mm256_add_epi32(
+          acc[0], _mm256_madd_epi16(_mm256_unpacklo_epi8(ab_lo, zero), wv));
+      acc[1] = _mm256_add_epi32(
+          acc[1], _mm256_madd_epi16(_mm256_unpackhi_epi8(ab_lo, zero), wv));
+      acc[2] = _mm256_add_epi32(
+          acc[2], _mm256_madd_epi16(_mm256_unpacklo_epi8(ab_hi, zero), wv));
+      acc[3] = _mm256_add_epi32(
+          acc[3], _mm256_madd_epi16(_mm256_unpackhi_epi8(ab_hi, zero), wv));
+    }
+    for (__m256i &a : acc) {
+      a = _mm256_srai_epi32(a, weight_bits);
+    }
+    __m256i lo = _mm256_packs_epi32(acc[0], acc[1]);
+    __m256i hi = _mm256_packs_epi32(acc[2], acc[3]);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(out + i),
+                       _mm256_packus_epi16(lo, hi));
+  }
+}
+#endif
+
+/** \} */
+
+void thumb_fit_size(int width, int height, int cx, int *r_width,
+                    int *r_height) {
+  if (cx <= 0 || std::max(width, height) <= cx) {
+    *r_width = width;
+    *r_height = height;
+  } else if (width >= height) {
+    *r_width = cx;
+    *r_height = std::max(1, int((int64_t(height) * cx + width / 2) / width));
+  } else {
+    *r_height = cx;
+    *r_width = std::max(1, int((int64_t(width) * cx + height / 2) / height));
+  }
+}
+
+ThumbResampler::ThumbResampler(ThumbArena &arena, int src_width,
+                               int src_height, uint8_t *dst, int dst_width,
+                               int dst_height, size_t dst_stride)
+    : _filter_x(make_taps(arena, src_width, dst_width)),
+      _filter_y(make_taps(arena, src_height, dst_height)),
+      _src_width(src_width),
+      _src_height(src_height),
+      _dst(dst),
+      _dst_width(dst_width),
+      _dst_height(dst_height),
+      _dst_stride(dst_stride) {
+  /* Source row widened to BGRX, with zeroed room for the padding taps. The
+   * arena aligns enough for the vertical kernels' aligned loads. */
+  const size_t wide_size = (size_t(src_width) + _filter_x->taps) * 4;
+  _row = arena.alloc_array<uint8_t>(wide_size);
+  memset(_row + size_t(src_width) * 4, 0, size_t(_filter_x->taps) * 4);
+  /* An odd number of cache lines per row, so the rows under the vertical
+   * filter fall into different cache sets even at power of two widths. */
+  const size_t lines = (size_t(dst_width) * 4 + 63) / 64;
+  _window_stride = (lines | 1) * 64;
+  _window = arena.alloc_array<uint8_t>(_window_stride * _filter_y->taps);
+  _out_row = arena.alloc_array<uint8_t>(_window_stride);
+  _taps_rows = arena.alloc_array<const uint8_t *>(_filter_y->taps);
+}
+
+void ThumbResampler::push_bgr(const uint8_t *src) {
+  /* The alpha it fills in is filtered along and dropped at the end. */
+  thumb_convert_pixels<THUMB_PIXEL_BGR24, THUMB_PIXEL_BGRA32>(
+      src, 0, _row, 0, _src_width, 1);
+  push();
+}
+
+void ThumbResampler::push() {
+  const eThumbSimdLevel simd = thumb_simd_level();
+  const int taps = _filter_y->taps;
+  uint8_t *filtered = _window + size_t(_pushed % taps) * _window_stride;
+#ifdef THUMB_X86_64
+  if (simd >= THUMB_SIMD_AVX2) {
+    horizontal_avx2(_row, *_filter_x, _dst_width, filtered);
+  } else if (simd >= THUMB_SIMD_SSE2) {
+    horizontal_sse2(_row, *_filter_x, _dst_width, filtered);
+  } else
+#endif
+  {
+    horizontal_scalar(_row, *_filter_x, _dst_width, filtered);
+  }
+  _pushed++;
+
+  /* Starts only grow, so the rows of every output row written here are
+   * among the last `taps` pushed. */
+  while (_written < _dst_height &&
+         std::min(_filter_y->start[_written] + taps, _src_height) <=
+             _pushed) {
+    const int y = _written++;
+    for (int j = 0; j < taps; j++) {
+      /* Padding taps have zero weight, any valid row will do. */
+      const int row = std::min(_filter_y->start[y] + j, _src_height - 1);
+      _taps_rows[j] = _window + size_t(row % taps) * _window_stride;
+    }
+#ifdef THUMB_X86_64
+    const int32_t *pairs = &_filter_y->pairs[size_t(y) * taps / 2];
+    if (simd >= THUMB_SIMD_AVX2) {
+      vertical_avx2(_taps_rows, pairs, taps, _window_stride, _out_row);
+    } else if (simd >= THUMB_SIMD_SSE2) {
+      vertical_sse2(_taps_rows, pairs, taps, _window_stride, _out_row);
+    } else
+#endif
+    {
+      const int16_t *w = &_filter_y->weights[size_t(y) * taps];
+      vertical_scalar(_taps_rows, w, taps, _window_stride, _out_row);
+    }
+
+    thumb_convert_pixels<THUMB_PIXEL_BGRA32, THUMB_PIXEL_BGR24>(
+        _out_row, 0, _dst + size_t(y) * _dst_stride, 0, _dst_width, 1);
+  }
+}
+
+void thumb_resample_bgr(const uint8_t *src, int src_width, int src_height,
+                        size_t src_stride, uint8_t *dst, int dst_width,
+                        int dst_height, size_t dst_stride) {
+  ThumbArenaScope scope(thumb_arena());
+  ThumbResampler resampler(scope.arena(), src_width, src_height, dst,
+                           dst_width, dst_height, dst_stride);
+  for (int y = 0; y < src_height; y++) {
+    resampler.push_bgr(src + size_t(y) * src_stride);
+  }
+}
+
+void thumb_fit_to(Thumbnail *thumb, int cx) {
+  int width, height;
+  thumb_fit_size(thumb->width, thumb->height, cx, &width, &height);
+  if (width == thumb->width && height == thumb->height) {
+    return;
+  }
+  /* Resample into the arena and copy back: the result is smaller than the
+   * source, so the thumbnail's own buffer never has to grow for it. */
+  ThumbArenaScope scope(thumb_arena());
+  const size_t size = thumb_bgr_stride(width) * height;
+  uint8_t *data = scope.arena().alloc_array<uint8_t>(size);
+  thumb_resample_bgr(thumb->data.data(), thumb->width, thumb->height,
+                     thumb_bgr_stride(thumb->width), data, width, height,
+                     thumb_bgr_stride(width));
+  thumb->data.resize(size);
+  memcpy(thumb->data.data(), data, size);
+  thumb->width = width;
+  thumb->height = height;
+}
@@ -0,0 +1,90 @@
+/** \file
+ * Separable Lanczos-3 resampling of decoded thumbnails.
+ *
+ * Works on the BGR24 rows with 4-byte aligned stride that the decoders
+ * produce. Filter weights are precomputed once per call in 14-bit fixed
+ * point; the passes run on SSE2 (horizontal) and SSE2/AVX2 (vertical).
+ * #ThumbResampler takes the source a row at a time, so a decoder can feed it
+ * while it goes and never hold the full resolution image.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "thumb.hh"
+
+/** Row stride of a BGR24 thumbnail, rows are padded to 4 bytes. */
+inline size_t thumb_bgr_stride(int width) {
+  return (size_t(width) * 3 + 3) & ~size_t(3);
+}
+
+/**
+ * Size that fits the longest edge of \a width x \a height to \a cx while
+ * keeping the aspect ratio. Images that already fit are left alone.
+ */
+void thumb_fit_size(int width, int height, int cx, int *r_width,
+                    int *r_height);
+
+/** Resample between two BGR24 images with arbitrary strides. */
+void thumb_resample_bgr(const uint8_t *src, int src_width, int src_height,
+                        size_t src_stride, uint8_t *dst, int dst_width,
+                        int dst_height, size_t dst_stride);
+
+/**
+ * Scale \a thumb down so its longest edge is \a cx, in place. Does nothing
+ * when it already fits.
+ */
+void thumb_fit_to(Thumbnail *thumb, int cx);
+
+struct ThumbFilterTaps;
+
+/**
+ * Streaming form of #thumb_resample_bgr. Source rows are pushed top to
+ * bottom, and every output row is written as soon as the last source row
+ * under its filter has arrived; only as many horizontally filtered rows as
+ * the vertical filter has taps are kept. The output is the same as
+ * #thumb_resample_bgr's, byte for byte.
+ *
+ * Scratch memory comes from \a arena, which must outlive the resampler.
+ */
+class ThumbResampler {
+public:
+  ThumbResampler(ThumbArena &arena, int src_width, int src_height,
+                 uint8_t *dst, int dst_width, int dst_height,
+                 size_t dst_stride);
+
+  ThumbResampler(const ThumbResampler &) = delete;
+  ThumbResampler &operator=(const ThumbResampler &) = delete;
+
+  /**
+   * Where the next source row goes as `src_width` BGRX pixels, before
+   * #push. Alpha is filtered along and dropped at the end; nothing past the
+   * last pixel may be written.
+   */
+  uint8_t *row() { return _row; }
+
+  /** Take the row written to #row. */
+  void push();
+
+  /** Take a BGR24 row. */
+  void push_bgr(const uint8_t *src);
+
+private:
+  const ThumbFilterTaps *_filter_x;
+  const ThumbFilterTaps *_filter_y;
+  int _src_width, _src_height;
+  uint8_t *_dst;
+  int _dst_width, _dst_height;
+  size_t _dst_stride;
+
+  uint8_t *_row;
+  /** Horizontally filtered rows, source row `y` at `y % taps`. */
+  uint8_t *_window;
+  size_t _window_stride;
+  uint8_t *_out_row;
+  const uint8_t **_taps_rows;
+  int _pushed = 0;
+  int _written = 0;
+};
@@ -0,0 +1,18 @@
+/** \file
+ * Choosing the size a thumbnail is decoded at.
+ */
+
+#include <algorithm>
+
+#include "thumb.hh"
+
+int thumb_scale_denominator(int width, int height, int cx) {
+  const int longest = std::max(width, height);
+  for (int denominator = 8; denominator > 1; denominator /= 2) {
+    /* Decoders round scaled sizes up. */
+    if ((longest + denominator - 1) / denominator >= cx) {
+      return denominator;
+    }
+  }
+  return 1;
+}
@@ -0,0 +1,196 @@
+/** \file
+ * Vectorized substring search, see thumb_scan.hh.
+ */
+
+#include <cstring>
+
+#include "thumb_cpu.hh"
+#include "thumb_scan.hh"
+
+using FindFn = const uint8_t *(*)(const uint8_t *, size_t, const char *,
+                                  size_t);
+
+static inline bool inner_matches(const uint8_t *p, const char *needle,
+                                 size_t needle_len) {
+  return memcmp(p + 1, needle + 1, needle_len - 2) == 0;
+}
+
+static const uint8_t *find_scalar(const uint8_t *haystack, size_t len,
+                                  const char *needle, size_t needle_len) {
+  if (len < needle_len) {
+    return nullptr;
+  }
+  const uint8_t last = uint8_t(needle[needle_len - 1]);
+  const uint8_t *p = haystack;
+  const uint8_t *end = haystack + len - needle_len + 1;
+  while (p < end) {
+    p = static_cast<const uint8_t *>(memchr(p, needle[0], end - p));
+    if (!p) {
+      return nullptr;
+    }
+    if (p[needle_len - 1] == last && inner_matches(p, needle, needle_len)) {
+      return p;
+    }
+    p++;
+  }
+  return nullptr;
+}
+
+static const uint8_t *find_last_scalar(const uint8_t *haystack, size_t len,
+                                       const char *needle, size_t needle_len) {
+  if (len < needle_len) {
+    return nullptr;
+  }
+  const uint8_t first = uint8_t(needle[0]);
+  const uint8_t last = uint8_t(needle[needle_len - 1]);
+  for (size_t i = len - needle_len + 1; i-- > 0;) {
+    const uint8_t *p = haystack + i;
+    if (p[0] == first && p[needle_len - 1] == last &&
+        inner_matches(p, needle, needle_len)) {
+      return p;
+    }
+  }
+  return nullptr;
+}
+
+#ifdef THUMB_X86_64
+
+/* Each kernel handles whole blocks of candidate start positions and hands the
+ * leftover (fewer than one register of starts) to the scalar version. */
+
+static const uint8_t *find_sse2(const uint8_t *haystack, size_t len,
+                                const char *needle, size_t needle_len) {
+  const __m128i first = _mm_set1_epi8(needle[0]);
+  const __m128i last = _mm_set1_epi8(needle[needle_len - 1]);
+  size_t i = 0;
+  for (; i + 16 + needle_len - 1 <= len; i += 16) {
+    __m128i block_first =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(haystack + i));
+    __m128i block_last = _mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(haystack + i + needle_len - 1));
+    uint32_t mask = uint32_t(_mm_movemask_epi8(_mm_and_si128(
+        _mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last))));
+    while (mask) {
+      const uint8_t *p = haystack + i + thumb_ctz(mask);
+      if (inner_matches(p, needle, needle_len)) {
+        return p;
+      }
+      mask &= mask - 1;
+    }
+  }
+  return find_scalar(haystack + i, len - i, needle, needle_len);
+}
+
+static const uint8_t *find_last_sse2(const uint8_t *haystack, size_t len,
+                                     const char *needle, size_t needle_len) {
+  if (len < needle_len) {
+    return nullptr;
+  }
+  const __m128i first = _mm_set1_epi8(needle[0]);
+  const __m128i last = _mm_set1_epi8(needle[needle_len - 1]);
+  size_t starts = len - needle_len + 1;
+  while (starts >= 16) {
+    starts -= 16;
+    __m128i block_first =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(haystack + starts));
+    __m128i block_last = _mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(haystack + starts + needle_len - 1));
+    uint32_t mask = uint32_t(_mm_movemask_epi8(_mm_and_si128(
+        _mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last))));
+    while (mask) {
+      unsigned bit = thumb_highest_bit(mask);
+      const uint8_t *p = haystack + starts + bit;
+      if (inner_matches(p, needle, needle_len)) {
+        return p;
+      }
+      mask &= ~(1u << bit);
+    }
+  }
+  return find_last_scalar(haystack, starts + needle_len - 1, needle,
+                          needle_len);
+}
+
+THUMB_TARGET_AVX2
+static const uint8_t *find_avx2(const uint8_t *haystack, size_t len,
+                                const char *needle, size_t needle_len) {
+  const __m256i first = _mm256_set1_epi8(needle[0]);
+  const __m256i last = _mm256_set1_epi8(needle[needle_len - 1]);
+  size_t i = 0;
+  for (; i + 32 + needle_len - 1 <= len; i += 32) {
+    __m256i block_first =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(haystack + i));
+    __m256i block_last = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(haystack + i + needle_len - 1));
+    uint32_t mask = uint32_t(_mm256_movemask_epi8(
+        _mm256_and_si256(_mm256_cmpeq_epi8(first, block_first),
+                         _mm256_cmpeq_epi8(last, block_last))));
+    while (mask) {
+      const uint8_t *p = haystack + i + thumb_ctz(mask);
+      if (inner_matches(p, needle, needle_len)) {
+        return p;
+      }
+      mask &= mask - 1;
+    }
+  }
+  _mm256_zeroupper();
+  return find_sse2(haystack + i, len - i, needle, needle_len);
+}
+
+THUMB_TARGET_AVX2
+static const uint8_t *find_last_avx2(const uint8_t *haystack, size_t len,
+                                     const char *needle, size_t needle_len) {
+  if (len < needle_len) {
+    return nullptr;
+  }
+  const __m256i first = _mm256_set1_epi8(needle[0]);
+  const __m256i last = _mm256_set1_epi8(needle[needle_len - 1]);
+  size_t starts = len - needle_len + 1;
+  while (starts >= 32) {
+    starts -= 32;
+    __m256i block_first = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(haystack + starts));
+    __m256i block_last = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(haystack + starts + needle_len - 1));
+    uint32_t mask = uint32_t(_mm256_movemask_epi8(
+        _mm256_and_si256(_mm256_cmpeq_epi8(first, block_first),
+                         _mm256_cmpeq_epi8(last, block_last))));
+    while (mask) {
+      unsigned bit = thumb_highest_bit(mask);
+      const uint8_t *p = haystack + starts + bit;
+      if (inner_matches(p, needle, needle_len)) {
+        return p;
+      }
+      mask &= ~(1u << bit);
+    }
+  }
+  _mm256_zeroupper();
+  return find_last_sse2(haystack, starts + needle_len - 1, needle, needle_len);
+}
+
+static FindFn select_find() {
+  return thumb_cpu_has_avx2() ? find_avx2 : find_sse2;
+}
+
+static FindFn select_find_last() {
+  return thumb_cpu_has_avx2() ? find_last_avx2 : find_last_sse2;
+}
+
+#else
+
+static FindFn select_find() { return find_scalar; }
+
+static FindFn select_find_last() { return find_last_scalar; }
+
+#endif
+
+const uint8_t *thumb_find(const uint8_t *haystack, size_t haystack_len,
+                          const char *needle, size_t needle_len) {
+  static const FindFn fn = select_find();
+  return fn(haystack, haystack_len, needle, needle_len);
+}
+
+const uint8_t *thumb_find_last(const uint8_t *haystack, size_t haystack_len,
+                               const char *needle, size_t needle_len) {
+  static const FindFn fn = select_find_last();
+  return fn(haystack, haystack_len, needle, needle_len);
+}
@@ -0,0 +1,21 @@
+/** \file
+ * Vectorized substring search used to find the `</roblox>` tag.
+ *
+ * Candidates are found by comparing the first and last byte of the needle
+ * against whole registers at once; only positions where both match are
+ * checked with `memcmp`. SSE2 is the baseline on x86-64, AVX2 is picked at
+ * runtime when the CPU supports it. Needles must be at least two bytes.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/** First occurrence of \a needle in \a haystack, or null. */
+const uint8_t *thumb_find(const uint8_t *haystack, size_t haystack_len,
+                          const char *needle, size_t needle_len);
+
+/** Last occurrence of \a needle in \a haystack, or null. */
+const uint8_t *thumb_find_last(const uint8_t *haystack, size_t haystack_len,
+                               const char *needle, size_t needle_len);
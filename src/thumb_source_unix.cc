@@ -0,0 +1,145 @@
+/** \file
+ * #ThumbSource backends for POSIX file descriptors and mapped files, and
+ * file stamps for `thumb_manifest.hh`.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "thumb.hh"
+#include "thumb_manifest.hh"
+
+class FdSource : public ThumbSource {
+public:
+  FdSource(int fd, bool owned) : _fd(fd), _owned(owned), _size(-1) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+      _size = st.st_size;
+    }
+  }
+
+  ~FdSource() override {
+    if (_owned) {
+      close(_fd);
+    }
+  }
+
+  int64_t size() override { return _size; }
+
+  int64_t read_at(uint64_t offset, void *buffer, size_t len) override {
+    ssize_t n;
+    do {
+      n = pread(_fd, buffer, len, off_t(offset));
+    } while (n < 0 && errno == EINTR);
+    return n;
+  }
+
+  int64_t read(void *buffer, size_t len) override {
+    ssize_t n;
+    do {
+      n = ::read(_fd, buffer, len);
+    } while (n < 0 && errno == EINTR);
+    return n;
+  }
+
+private:
+  int _fd;
+  bool _owned;
+  int64_t _size;
+};
+
+std::unique_ptr<ThumbSource> thumb_source_open_file(const char *path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return nullptr;
+  }
+  return std::make_unique<FdSource>(fd, true);
+}
+
+/**
+ * Whole-file read-only mapping. Read-ahead is switched off for the mapping as
+ * a whole, since the XML body is normally never touched, and every #view asks
+ * the kernel to fetch exactly the requested range up front. That keeps the
+ * backward tail search from faulting in one page at a time.
+ */
+class MmapSource : public ThumbSource {
+public:
+  MmapSource(const uint8_t *data, size_t size) : _data(data), _size(size) {
+    madvise(const_cast<uint8_t *>(_data), _size, MADV_RANDOM);
+  }
+
+  ~MmapSource() override { munmap(const_cast<uint8_t *>(_data), _size); }
+
+  int64_t size() override { return int64_t(_size); }
+
+  int64_t read_at(uint64_t offset, void *buffer, size_t len) override {
+    if (offset >= _size) {
+      return 0;
+    }
+    len = std::min<size_t>(len, _size - offset);
+    memcpy(buffer, _data + offset, len);
+    return int64_t(len);
+  }
+
+  int64_t read(void *buffer, size_t len) override {
+    int64_t n = read_at(_pos, buffer, len);
+    _pos += n;
+    return n;
+  }
+
+  const uint8_t *view(uint64_t offset, size_t len) override {
+    if (offset > _size || len > _size - offset) {
+      return nullptr;
+    }
+    if (len > 0) {
+      static const uintptr_t page_mask = uintptr_t(sysconf(_SC_PAGESIZE)) - 1;
+      uintptr_t begin = uintptr_t(_data + offset) & ~page_mask;
+      uintptr_t end = uintptr_t(_data + offset + len);
+      madvise(reinterpret_cast<void *>(begin), end - begin, MADV_WILLNEED);
+    }
+    return _data + offset;
+  }
+
+private:
+  const uint8_t *_data;
+  size_t _size;
+  uint64_t _pos = 0;
+};
+
+std::unique_ptr<ThumbSource> thumb_source_map_file(const char *path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    close(fd);
+    return nullptr;
+  }
+  void *data = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  /* The mapping keeps the file alive on its own. */
+  close(fd);
+  if (data == MAP_FAILED) {
+    return nullptr;
+  }
+  return std::make_unique<MmapSource>(static_cast<const uint8_t *>(data),
+                                      size_t(st.st_size));
+}
+
+bool thumb_file_stamp(const char *path, ThumbFileStamp *r_stamp) {
+  struct stat st;
+  if (stat(path, &st) != 0) {
+    return false;
+  }
+  r_stamp->size = uint64_t(st.st_size);
+  r_stamp->mtime_ns = int64_t(st.st_mtim.tv_sec) * 1000000000 +
+                      st.st_mtim.tv_nsec;
+  r_stamp->device = uint64_t(st.st_dev);
+  r_stamp->inode = uint64_t(st.st_ino);
+  return true;
+}
@@ -0,0 +1,172 @@
+/** \file
+ * Statistics storage, shared segments and reports, see thumb_stats.hh.
+ */
+
+#include <cstring>
+#include <string>
+
+#ifdef _WIN32
+#  include <windows.h>
+#else
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+#include "thumb_stats.hh"
+
+static const char *const stage_names[THUMB_STAGE_COUNT] = {
+    "read", "locate", "decode", "scale", "output"};
+
+static const char *const counter_names[THUMB_COUNTER_COUNT] = {
+    "requests", "failures", "cache hits", "pyramid hits",
+    "bytes read", "file bytes"};
+
+static ThumbStats private_stats = {thumb_stats_magic, sizeof(ThumbStats),
+                                   {}, {}};
+static std::atomic<ThumbStats *> active_stats{&private_stats};
+
+ThumbStats *thumb_stats() {
+  return active_stats.load(std::memory_order_relaxed);
+}
+
+/** Map the segment \a name, \a create it when it doesn't exist. */
+static void *map_segment(const char *name, bool create) {
+#ifdef _WIN32
+  HANDLE mapping;
+  if (create) {
+    mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                                 0, DWORD(sizeof(ThumbStats)), name);
+  } else {
+    mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+  }
+  if (!mapping) {
+    return nullptr;
+  }
+  /* The view keeps the mapping alive, the handle isn't needed any more. */
+  void *view = MapViewOfFile(mapping, create ? FILE_MAP_WRITE : FILE_MAP_READ,
+                             0, 0, sizeof(ThumbStats));
+  CloseHandle(mapping);
+  return view;
+#else
+  /* POSIX segment names start with a single slash. */
+  std::string path = name[0] == '/' ? name : std::string("/") + name;
+  int fd = shm_open(path.c_str(), create ? O_RDWR | O_CREAT : O_RDONLY, 0600);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat st;
+  bool ok = fstat(fd, &st) == 0;
+  if (ok && create && st.st_size < off_t(sizeof(ThumbStats))) {
+    ok = ftruncate(fd, off_t(sizeof(ThumbStats))) == 0;
+  } else if (ok && st.st_size < off_t(sizeof(ThumbStats))) {
+    ok = false;
+  }
+  void *view = nullptr;
+  if (ok) {
+    view = mmap(nullptr, sizeof(ThumbStats),
+                create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    view = view == MAP_FAILED ? nullptr : view;
+  }
+  close(fd);
+  return view;
+#endif
+}
+
+bool thumb_stats_share(const char *name) {
+  ThumbStats *stats = static_cast<ThumbStats *>(map_segment(name, true));
+  if (!stats) {
+    return false;
+  }
+  /* New segments come zeroed; a segment made by a build with another layout
+   * is left alone. Concurrent creators write the same values. */
+  if (stats->magic == 0) {
+    stats->size = sizeof(ThumbStats);
+    stats->magic = thumb_stats_magic;
+  }
+  if (stats->magic != thumb_stats_magic || stats->size != sizeof(ThumbStats)) {
+    return false;
+  }
+  active_stats.store(stats, std::memory_order_relaxed);
+  return true;
+}
+
+const ThumbStats *thumb_stats_open_shared(const char *name) {
+  const ThumbStats *stats =
+      static_cast<const ThumbStats *>(map_segment(name, false));
+  if (stats && (stats->magic != thumb_stats_magic ||
+                stats->size != sizeof(ThumbStats))) {
+    return nullptr;
+  }
+  return stats;
+}
+
+/** Largest value that lands in \a bucket. */
+static uint64_t bucket_upper_bound(int bucket) {
+  if (bucket < thumb_histogram_sub_buckets) {
+    return uint64_t(bucket);
+  }
+  const int shift = bucket / thumb_histogram_sub_buckets - 1;
+  const uint64_t base = uint64_t(thumb_histogram_sub_buckets +
+                                 bucket % thumb_histogram_sub_buckets);
+  return ((base + 1) << shift) - 1;
+}
+
+uint64_t thumb_histogram_percentile(const ThumbHistogram &histogram,
+                                    double q) {
+  /* Buckets are read one by one while other threads may add to them, so the
+   * total is taken from the buckets themselves. */
+  uint64_t counts[thumb_histogram_buckets];
+  uint64_t total = 0;
+  for (int i = 0; i < thumb_histogram_buckets; i++) {
+    counts[i] = histogram.buckets[i].load(std::memory_order_relaxed);
+    total += counts[i];
+  }
+  if (total == 0) {
+    return 0;
+  }
+  const uint64_t max = histogram.max_ns.load(std::memory_order_relaxed);
+  uint64_t rank = uint64_t(q * double(total) + 0.5);
+  rank = rank < 1 ? 1 : rank > total ? total : rank;
+  uint64_t seen = 0;
+  for (int i = 0; i < thumb_histogram_buckets; i++) {
+    seen += counts[i];
+    if (seen >= rank) {
+      uint64_t value = bucket_upper_bound(i);
+      return value < max ? value : max;
+    }
+  }
+  return max;
+}
+
+void thumb_stats_write(const ThumbStats &stats, FILE *out) {
+  for (int i = 0; i < THUMB_COUNTER_COUNT; i++) {
+    fprintf(out, "%-12s %llu\n", counter_names[i],
+            (unsigned long long)stats.counters[i].load(
+                std::memory_order_relaxed));
+  }
+  fprintf(out, "\n%-8s %10s %10s %10s %10s %10s %10s %10s\n", "stage",
+          "count", "mean us", "p50 us", "p90 us", "p99 us", "p99.9 us",
+          "max us");
+  for (int i = 0; i < THUMB_STAGE_COUNT; i++) {
+    const ThumbHistogram &h = stats.stages[i];
+    const uint64_t count = h.count.load(std::memory_order_relaxed);
+    const uint64_t total = h.total_ns.load(std::memory_order_relaxed);
+    fprintf(out, "%-8s %10llu %10.1f", stage_names[i],
+            (unsigned long long)count, count ? total / 1e3 / count : 0.0);
+    for (double q : {0.5, 0.9, 0.99, 0.999}) {
+      fprintf(out, " %10.1f", thumb_histogram_percentile(h, q) / 1e3);
+    }
+    fprintf(out, " %10.1f\n", h.max_ns.load(std::memory_order_relaxed) / 1e3);
+  }
+}
+
+bool thumb_stats_dump(const char *path) {
+  FILE *out = fopen(path, "w");
+  if (!out) {
+    return false;
+  }
+  thumb_stats_write(*thumb_stats(), out);
+  return fclose(out) == 0;
+}
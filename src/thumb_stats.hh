@@ -0,0 +1,170 @@
+/** \file
+ * Always-on latency histograms and counters for the thumbnail pipeline.
+ *
+ * Every stage of a request records its duration into a log-linear histogram
+ * in the style of HdrHistogram: 32 sub-buckets per power of two, so any
+ * percentile is exact to about 3%, from nanoseconds up to minutes. Recording
+ * is a few relaxed atomic increments and never takes a lock, so it can stay
+ * enabled in production.
+ *
+ * The block of statistics is plain memory with a fixed layout. With
+ * #thumb_stats_share it lives in a named shared memory segment, which other
+ * processes (the shell's surrogate hosts, `Kiseki.ThumbnailStats`) can map
+ * and read at any time; #thumb_stats_dump writes a report to a file.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+#include "thumb_cpu.hh"
+
+enum eThumbStage {
+  /** Time spent inside the source's reads (`IStream::Read`). */
+  THUMB_STAGE_READ,
+  /** Finding the trailer, without the reads. */
+  THUMB_STAGE_LOCATE,
+  /** Decoding the JPEG, or reading it back from the cache. */
+  THUMB_STAGE_DECODE,
+  /** Resampling to the requested size. */
+  THUMB_STAGE_SCALE,
+  /** Handing the pixels over: packing the DIB section, or writing a file. */
+  THUMB_STAGE_OUTPUT,
+  THUMB_STAGE_COUNT,
+};
+
+enum eThumbCounter {
+  THUMB_COUNTER_REQUESTS,
+  THUMB_COUNTER_FAILURES,
+  THUMB_COUNTER_CACHE_HITS,
+  /** Requests served from an in-memory mip pyramid, see thumb_mip.hh. */
+  THUMB_COUNTER_PYRAMID_HITS,
+  /** Bytes actually read from sources... */
+  THUMB_COUNTER_BYTES_READ,
+  /** ...against the total size of the files they came from. */
+  THUMB_COUNTER_FILE_BYTES,
+  THUMB_COUNTER_COUNT,
+};
+
+static constexpr int thumb_histogram_sub_bits = 5;
+static constexpr int thumb_histogram_sub_buckets = 1 << thumb_histogram_sub_bits;
+/* Durations are clamped below 2^41 ns, about 36 minutes. */
+static constexpr int thumb_histogram_max_bits = 40;
+static constexpr int thumb_histogram_buckets =
+    (thumb_histogram_max_bits - thumb_histogram_sub_bits + 2) *
+    thumb_histogram_sub_buckets;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "statistics are shared between processes");
+
+struct ThumbHistogram {
+  std::atomic<uint64_t> count;
+  std::atomic<uint64_t> total_ns;
+  std::atomic<uint64_t> max_ns;
+  std::atomic<uint64_t> buckets[thumb_histogram_buckets];
+};
+
+struct ThumbStats {
+  /** #thumb_stats_magic once the block is set up. */
+  uint32_t magic;
+  /** Size of the block, a reader built with a different layout bails. */
+  uint32_t size;
+  std::atomic<uint64_t> counters[THUMB_COUNTER_COUNT];
+  ThumbHistogram stages[THUMB_STAGE_COUNT];
+};
+
+static constexpr uint32_t thumb_stats_magic = 0x5453544b; /* "KTST" */
+
+/** The block samples are recorded into. */
+ThumbStats *thumb_stats();
+
+/** Histogram bucket of \a ns; lower values get finer buckets. */
+inline int thumb_histogram_bucket(uint64_t ns) {
+  const uint64_t clamp = (uint64_t(1) << (thumb_histogram_max_bits + 1)) - 1;
+  ns = ns < clamp ? ns : clamp;
+  if (ns < uint64_t(thumb_histogram_sub_buckets)) {
+    return int(ns);
+  }
+  const int shift = int(thumb_highest_bit64(ns)) - thumb_histogram_sub_bits;
+  return (shift + 1) * thumb_histogram_sub_buckets +
+         int((ns >> shift) & (thumb_histogram_sub_buckets - 1));
+}
+
+inline void thumb_stats_record(eThumbStage stage, uint64_t ns) {
+  ThumbHistogram &h = thumb_stats()->stages[stage];
+  h.count.fetch_add(1, std::memory_order_relaxed);
+  h.total_ns.fetch_add(ns, std::memory_order_relaxed);
+  h.buckets[thumb_histogram_bucket(ns)].fetch_add(1,
+                                                  std::memory_order_relaxed);
+  uint64_t max = h.max_ns.load(std::memory_order_relaxed);
+  while (ns > max && !h.max_ns.compare_exchange_weak(
+                         max, ns, std::memory_order_relaxed)) {
+  }
+}
+
+inline void thumb_stats_add(eThumbCounter counter, uint64_t value = 1) {
+  thumb_stats()->counters[counter].fetch_add(value, std::memory_order_relaxed);
+}
+
+inline uint64_t thumb_stats_now() {
+  return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now().time_since_epoch())
+                      .count());
+}
+
+/** Times consecutive stages: each #lap charges the time since the last. */
+class ThumbStageTimer {
+public:
+  ThumbStageTimer() : _start(thumb_stats_now()) {}
+
+  /** Record the time since the previous lap into \a stage and return it. */
+  uint64_t lap(eThumbStage stage) {
+    const uint64_t ns = split();
+    thumb_stats_record(stage, ns);
+    return ns;
+  }
+
+  /**
+   * Return the time since the previous lap without recording it, for stages
+   * that are split up by the caller, and start the next lap.
+   */
+  uint64_t split() {
+    const uint64_t now = thumb_stats_now();
+    const uint64_t ns = now - _start;
+    _start = now;
+    return ns;
+  }
+
+private:
+  uint64_t _start;
+};
+
+/** Segment the shell handler publishes its statistics in. */
+#ifdef _WIN32
+#  define THUMB_STATS_SEGMENT "Local\\Kiseki.ThumbnailStats"
+#else
+#  define THUMB_STATS_SEGMENT "Kiseki.ThumbnailStats"
+#endif
+
+/**
+ * Record into the shared memory segment \a name from now on, creating it if
+ * no other process has. Processes sharing a segment add up their samples.
+ * Returns false, and keeps the private block, if it can't be mapped.
+ */
+bool thumb_stats_share(const char *name);
+
+/** Map the segment \a name read-only, or return null if there is none. */
+const ThumbStats *thumb_stats_open_shared(const char *name);
+
+/** Smallest duration at or above fraction \a q of the samples, in ns. */
+uint64_t thumb_histogram_percentile(const ThumbHistogram &histogram,
+                                    double q);
+
+/** Human readable report: counters, then count, mean and percentiles. */
+void thumb_stats_write(const ThumbStats &stats, FILE *out);
+
+/** #thumb_stats_write the current block to \a path. */
+bool thumb_stats_dump(const char *path);
@@ -0,0 +1,43 @@
+/** \file
+ * `Kiseki.ThumbnailStats [-i seconds] [segment]` prints the statistics a
+ * running shell handler or batch publishes with #thumb_stats_share, once or
+ * every few seconds. Without a segment name the shell handler's is read.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include "thumb_stats.hh"
+
+int main(int argc, char *argv[]) {
+  const char *name = THUMB_STATS_SEGMENT;
+  int interval = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+      interval = atoi(argv[++i]);
+    } else if (argv[i][0] != '-') {
+      name = argv[i];
+    } else {
+      fprintf(stderr, "Usage: %s [-i seconds] [segment]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  const ThumbStats *stats = thumb_stats_open_shared(name);
+  if (!stats) {
+    fprintf(stderr, "%s: no statistics segment\n", name);
+    return 2;
+  }
+  for (;;) {
+    thumb_stats_write(*stats, stdout);
+    fflush(stdout);
+    if (interval <= 0) {
+      return 0;
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(interval));
+    printf("\n");
+  }
+}
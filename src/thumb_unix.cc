@@ -0,0 +1,125 @@
+/** \file
+ * Command line front end for extracting place thumbnails on Linux.
+ *
+ * `Kiseki.Thumbnailer <input.rbxl> <output.jpg>` writes the JPEG embedded at
+ * the end of the place, using the same extraction code as the shell handler.
+ * Either name can be `-` for stdin/stdout; a place read from stdin is
+ * streamed, so only the JPEG is ever held in memory.
+ *
+ * `Kiseki.Thumbnailer --probe <input.rbxl>` prints the size and format of
+ * the embedded JPEG instead, from its headers alone.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <unistd.h>
+
+#include "thumb.hh"
+#include "thumb_jpeg.hh"
+
+/** Push stdin through a stream extractor as it arrives. */
+static eThumbStatus read_trailer_stdin(ThumbBuffer &buffer,
+                                       ThumbTrailer *r_trailer) {
+  static constexpr size_t chunk = 64 * 1024;
+  ThumbStreamExtractor extractor(buffer);
+  for (;;) {
+    ssize_t n = read(STDIN_FILENO, extractor.reserve(chunk), chunk);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      return THUMB_READ_ERROR;
+    }
+    eThumbStatus status = extractor.commit(size_t(n));
+    if (status != THUMB_OK) {
+      return status;
+    }
+    if (n == 0) {
+      return extractor.finish(r_trailer);
+    }
+  }
+}
+
+static std::unique_ptr<ThumbSource> open_source(const char *path) {
+  /* Pipes and special files can't be mapped, read those instead. */
+  std::unique_ptr<ThumbSource> source = thumb_source_map_file(path);
+  if (!source) {
+    source = thumb_source_open_file(path);
+  }
+  return source;
+}
+
+/** Print one line describing the JPEG in \a trailer. */
+static int print_probe(const char *path, const ThumbTrailer &trailer) {
+  ThumbJpegInfo info;
+  eThumbStatus status = thumb_jpeg_probe(trailer.data, trailer.length, &info);
+  if (status != THUMB_OK) {
+    fprintf(stderr, "%s: %s\n", path, thumb_status_message(status));
+    return 2;
+  }
+  const char *sampling = "other";
+  if (info.components == 1) {
+    sampling = "gray";
+  } else if (info.subsample_x == 1 && info.subsample_y == 1) {
+    sampling = "4:4:4";
+  } else if (info.subsample_x == 2 && info.subsample_y == 1) {
+    sampling = "4:2:2";
+  } else if (info.subsample_x == 2 && info.subsample_y == 2) {
+    sampling = "4:2:0";
+  }
+  printf("%dx%d %d-bit %d components %s %s%s\n", info.width, info.height,
+         info.precision, info.components, sampling,
+         info.progressive ? "progressive" : "sequential",
+         info.arithmetic ? " arithmetic" : "");
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  const bool probe = argc == 3 && strcmp(argv[1], "--probe") == 0;
+  if (argc != 3) {
+    fprintf(stderr,
+            "Usage: %s <input.rbxl|-> <output.jpg|->\n"
+            "       %s --probe <input.rbxl|->\n",
+            argv[0], argv[0]);
+    return 1;
+  }
+  const char *input = probe ? argv[2] : argv[1];
+  const bool from_stdin = strcmp(input, "-") == 0;
+  const bool to_stdout = strcmp(argv[2], "-") == 0;
+
+  std::unique_ptr<ThumbSource> source;
+  if (!from_stdin) {
+    source = open_source(input);
+    if (!source) {
+      perror(input);
+      return 1;
+    }
+  }
+
+  ThumbBuffer buffer;
+  ThumbTrailer trailer;
+  eThumbStatus status = source
+                            ? thumb_read_trailer(source.get(), buffer, &trailer)
+                            : read_trailer_stdin(buffer, &trailer);
+  if (status != THUMB_OK) {
+    fprintf(stderr, "%s: %s\n", input, thumb_status_message(status));
+    return 2;
+  }
+  if (probe) {
+    return print_probe(input, trailer);
+  }
+
+  FILE *out = to_stdout ? stdout : fopen(argv[2], "wb");
+  if (!out) {
+    perror(argv[2]);
+    return 1;
+  }
+  size_t written = fwrite(trailer.data, 1, trailer.length, out);
+  if (fclose(out) != 0 || written != trailer.length) {
+    perror(argv[2]);
+    return 1;
+  }
+  return 0;
+}
@@ -1,19 +1,80 @@
 #include <algorithm>
+#include <climits>
 #include <cstdint>
+#include <memory>
 #include <new>
+#include <shlobj.h> /* for #SHGetKnownFolderPath */
 #include <shlwapi.h>
-#include <string>
 #include <thumbcache.h> /* for #IThumbnailProvider */
 #include <vector>
 
 #include "Wincodec.h"
 
+#include "thumb.hh"
+#include "thumb_cache.hh"
+#include "thumb_jpeg.hh"
+#include "thumb_mip.hh"
+#include "thumb_pack.hh"
+#include "thumb_resample.hh"
+#include "thumb_stats.hh"
+
+#pragma comment(lib, "shell32.lib")
 #pragma comment(lib, "shlwapi.lib")
 
-struct Thumbnail {
-  std::vector<uint8_t> data;
-  int width;
-  int height;
+/**
+ * Exposes the shell's #IStream to the shared extraction code. Streams that
+ * can't report their size or seek are read sequentially instead, with
+ * reads still bounded by Stat() when it works. Time spent in the stream and
+ * the bytes it returned are tallied for #THUMB_STAGE_READ.
+ */
+class CStreamSource : public ThumbSource {
+public:
+  CStreamSource(IStream *pStream)
+      : _pStream(pStream), _size(-1), _seekable(false) {
+    STATSTG stat;
+    LARGE_INTEGER zero = {};
+    if (SUCCEEDED(_pStream->Stat(&stat, STATFLAG_NONAME))) {
+      _size = int64_t(stat.cbSize.QuadPart);
+    }
+    _seekable = SUCCEEDED(_pStream->Seek(zero, STREAM_SEEK_CUR, nullptr));
+  }
+
+  int64_t size() override { return _seekable ? _size : -1; }
+
+  int64_t size_hint() override { return _size; }
+
+  int64_t read_at(uint64_t offset, void *buffer, size_t len) override {
+    const uint64_t start = thumb_stats_now();
+    LARGE_INTEGER pos;
+    pos.QuadPart = LONGLONG(offset);
+    HRESULT hr = _pStream->Seek(pos, STREAM_SEEK_SET, nullptr);
+    totalReadNs += thumb_stats_now() - start;
+    if (FAILED(hr)) {
+      return -1;
+    }
+    return read(buffer, len);
+  }
+
+  int64_t read(void *buffer, size_t len) override {
+    const uint64_t start = thumb_stats_now();
+    ULONG bytesRead = 0;
+    ULONG request = ULONG(std::min<size_t>(len, ULONG_MAX));
+    HRESULT hr = _pStream->Read(buffer, request, &bytesRead);
+    totalReadNs += thumb_stats_now() - start;
+    if (FAILED(hr)) {
+      return -1;
+    }
+    totalBytesRead += bytesRead;
+    return int64_t(bytesRead);
+  }
+
+  uint64_t totalReadNs = 0;
+  uint64_t totalBytesRead = 0;
+
+private:
+  IStream *_pStream;
+  int64_t _size; /* From Stat(), -1 if unknown. */
+  bool _seekable;
 };
 
 /**
@@ -60,6 +121,92 @@ private:
   IStream *_pStream; /* provided in Initialize(). */
 };
 
+/**
+ * WIC imaging factory shared by every thumbnail in the process. The factory
+ * is free threaded, so one instance serves all surrogate threads. It is
+ * created on first use and dropped again from #DllCanUnloadNow.
+ */
+static SRWLOCK g_factoryLock = SRWLOCK_INIT;
+static IWICImagingFactory *g_pFactory = nullptr;
+
+/** Hand out a new reference to the shared factory, creating it if needed. */
+static HRESULT AcquireImagingFactory(IWICImagingFactory **ppFactory) {
+  AcquireSRWLockShared(&g_factoryLock);
+  IWICImagingFactory *pFactory = g_pFactory;
+  if (pFactory) {
+    pFactory->AddRef();
+  }
+  ReleaseSRWLockShared(&g_factoryLock);
+
+  if (!pFactory) {
+    HRESULT hr = S_OK;
+    AcquireSRWLockExclusive(&g_factoryLock);
+    if (!g_pFactory) {
+      hr = CoCreateInstance(CLSID_WICImagingFactory, nullptr,
+                            CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&g_pFactory));
+    }
+    if (SUCCEEDED(hr)) {
+      pFactory = g_pFactory;
+      pFactory->AddRef();
+    }
+    ReleaseSRWLockExclusive(&g_factoryLock);
+    if (FAILED(hr)) {
+      return hr;
+    }
+  }
+  *ppFactory = pFactory;
+  return S_OK;
+}
+
+void CKisekiThumb_ReleaseFactory() {
+  AcquireSRWLockExclusive(&g_factoryLock);
+  IWICImagingFactory *pFactory = g_pFactory;
+  g_pFactory = nullptr;
+  ReleaseSRWLockExclusive(&g_factoryLock);
+  if (pFactory) {
+    pFactory->Release();
+  }
+}
+
+/* Upper bound for the decoded thumbnail cache. */
+static constexpr uint64_t thumb_cache_max_bytes = 256ull * 1024 * 1024;
+
+/**
+ * Cache of decoded thumbnails in `%LOCALAPPDATA%\Kiseki\ThumbnailCache`,
+ * shared by all threads. Null when the folder can't be resolved.
+ */
+static ThumbCache *SharedThumbCache() {
+  static std::unique_ptr<ThumbCache> cache =
+      []() -> std::unique_ptr<ThumbCache> {
+    PWSTR pszPath = nullptr;
+    HRESULT hr = SHGetKnownFolderPath(FOLDERID_LocalAppData, 0, nullptr,
+                                      &pszPath);
+    if (FAILED(hr)) {
+      CoTaskMemFree(pszPath);
+      return nullptr;
+    }
+    std::filesystem::path directory(pszPath);
+    CoTaskMemFree(pszPath);
+    directory /= L"Kiseki";
+    directory /= L"ThumbnailCache";
+    return std::make_unique<ThumbCache>(directory, thumb_cache_max_bytes);
+  }();
+  return cache.get();
+}
+
+/* Upper bound for the pyramids kept in memory, one for a 1080p screenshot
+ * takes about 8MB. */
+static constexpr size_t thumb_pyramid_max_bytes = 64 * 1024 * 1024;
+
+/**
+ * Pyramids of the places decoded recently in this process, so the other
+ * sizes Explorer asks for skip the decode.
+ */
+static ThumbPyramidCache &SharedPyramidCache() {
+  static ThumbPyramidCache cache(thumb_pyramid_max_bytes);
+  return cache;
+}
+
 HRESULT CKisekiThumb_CreateInstance(REFIID riid, void **ppv) {
   CKisekiThumb *pNew = new (std::nothrow) CKisekiThumb();
   HRESULT hr = pNew ? S_OK : E_OUTOFMEMORY;
@@ -79,51 +226,22 @@ IFACEMETHODIMP CKisekiThumb::Initialize(IStream *pStream, DWORD) {
   return pStream->QueryInterface(&_pStream);
 }
 
-IFACEMETHODIMP CKisekiThumb::GetThumbnail(UINT cx, HBITMAP *phbmp,
-                                          WTS_ALPHATYPE *pdwAlpha) {
+/**
+ * Decode \a trailer with WIC, for the images the built-in decoder doesn't
+ * handle. Scales in the DCT domain like #thumb_jpeg_decode does.
+ */
+static HRESULT DecodeWithWIC(const ThumbTrailer &trailer, UINT cx,
+                             Thumbnail *thumb) {
   HRESULT hr = S_FALSE;
 
-  std::vector<char> buffer;
-  ULONG bytesRead;
-  char chunk[4096];
-  do {
-    hr = _pStream->Read(chunk, sizeof(chunk), &bytesRead);
-    if (SUCCEEDED(hr) && bytesRead > 0) {
-      buffer.insert(buffer.end(), chunk, chunk + bytesRead);
-    }
-  } while (SUCCEEDED(hr) && bytesRead > 0);
-
-  if (FAILED(hr)) {
-    return hr;
-  }
-
-  // Find the </roblox> closing tag
-  const std::string endTag = "</roblox>";
-  auto it =
-      std::search(buffer.begin(), buffer.end(), endTag.begin(), endTag.end());
-  if (it == buffer.end()) {
-    return E_FAIL; // Closing tag not found
-  }
-
-  // Move iterator past the closing tag and the null byte
-  std::advance(it, endTag.length() + 1);
-
-  if (it >= buffer.end()) {
-    return E_FAIL; // No data after the closing tag
-  }
-
-  // The rest is JPEG data
-  std::vector<unsigned char> jpegData(it, buffer.end());
-
-  // Create a WIC factory
+  // Get the process-wide WIC factory
   IWICImagingFactory *pFactory = nullptr;
-  hr = CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER,
-                        IID_PPV_ARGS(&pFactory));
+  hr = AcquireImagingFactory(&pFactory);
   if (FAILED(hr)) {
     return hr;
   }
 
-  // Create a stream from the JPEG data
+  // Wrap the JPEG in place, the context outlives the stream
   IWICStream *pStream = nullptr;
   hr = pFactory->CreateStream(&pStream);
   if (FAILED(hr)) {
@@ -131,7 +249,8 @@ IFACEMETHODIMP CKisekiThumb::GetThumbnail(UINT cx, HBITMAP *phbmp,
     return hr;
   }
 
-  hr = pStream->InitializeFromMemory(jpegData.data(), jpegData.size());
+  hr = pStream->InitializeFromMemory(const_cast<BYTE *>(trailer.data),
+                                     DWORD(trailer.length));
   if (FAILED(hr)) {
     pStream->Release();
     pFactory->Release();
@@ -169,30 +288,185 @@ IFACEMETHODIMP CKisekiThumb::GetThumbnail(UINT cx, HBITMAP *phbmp,
     return hr;
   }
 
-  UINT stride = (width * 3 + 3) & ~3;
+  // Let the decoder scale in the DCT domain when the shell asked for less
+  // than half the image, as long as the longest edge still covers cx
+  int denominator =
+      thumb_scale_denominator(int(width), int(height), int(cx));
+  IWICBitmapSourceTransform *pTransform = nullptr;
+  if (denominator > 1 &&
+      SUCCEEDED(pFrame->QueryInterface(IID_PPV_ARGS(&pTransform)))) {
+    UINT scaledWidth = (width + denominator - 1) / denominator;
+    UINT scaledHeight = (height + denominator - 1) / denominator;
+    if (SUCCEEDED(pTransform->GetClosestSize(&scaledWidth, &scaledHeight))) {
+      width = scaledWidth;
+      height = scaledHeight;
+    } else {
+      pTransform->Release();
+      pTransform = nullptr;
+    }
+  }
 
-  // Create a bitmap and copy the pixels
-  Thumbnail thumb;
-  thumb.width = width;
-  thumb.height = height;
-  thumb.data.resize(height * stride);
-  hr =
-      pFrame->CopyPixels(nullptr, stride, thumb.data.size(), thumb.data.data());
+  UINT stride = UINT(thumb_bgr_stride(int(width)));
+
+  // Copy the pixels
+  thumb->width = width;
+  thumb->height = height;
+  thumb->data.resize(height * stride);
+  if (pTransform) {
+    WICPixelFormatGUID format = GUID_WICPixelFormat24bppBGR;
+    hr = pTransform->CopyPixels(nullptr, width, height, &format,
+                                WICBitmapTransformRotate0, stride,
+                                thumb->data.size(), thumb->data.data());
+    pTransform->Release();
+  } else {
+    hr = pFrame->CopyPixels(nullptr, stride, thumb->data.size(),
+                            thumb->data.data());
+  }
 
   pFrame->Release();
   pDecoder->Release();
   pStream->Release();
   pFactory->Release();
 
-  if (FAILED(hr)) {
-    return hr;
+  return hr;
+}
+
+IFACEMETHODIMP CKisekiThumb::GetThumbnail(UINT cx, HBITMAP *phbmp,
+                                          WTS_ALPHATYPE *pdwAlpha) {
+  HRESULT hr = S_FALSE;
+
+  // Statistics go to a segment every surrogate process shares, so they can
+  // be read with Kiseki.ThumbnailStats while Explorer runs
+  static const bool statsShared = thumb_stats_share(THUMB_STATS_SEGMENT);
+  (void)statsShared;
+  thumb_stats_add(THUMB_COUNTER_REQUESTS);
+  auto fail = [](HRESULT hrFail) {
+    thumb_stats_add(THUMB_COUNTER_FAILURES);
+    return hrFail;
+  };
+  ThumbStageTimer timer;
+
+  // Buffers are reused from the previous thumbnail on this thread
+  ThumbContextLease context;
+
+  // Locate the JPEG after the </roblox> closing tag
+  CStreamSource source(_pStream);
+  ThumbTrailer trailer;
+  eThumbStatus status = thumb_read_trailer(&source, context->buffer, &trailer);
+
+  // The stream reads are timed on their own, the rest is the search
+  uint64_t locateNs = timer.split();
+  thumb_stats_record(THUMB_STAGE_READ, source.totalReadNs);
+  thumb_stats_record(THUMB_STAGE_LOCATE,
+                     locateNs - std::min(locateNs, source.totalReadNs));
+  thumb_stats_add(THUMB_COUNTER_BYTES_READ, source.totalBytesRead);
+  thumb_stats_add(THUMB_COUNTER_FILE_BYTES,
+                  uint64_t(std::max<int64_t>(source.size_hint(), 0)));
+  switch (status) {
+  case THUMB_OK:
+    break;
+  case THUMB_READ_ERROR:
+    return fail(STG_E_READFAULT);
+  default:
+    return fail(E_FAIL); // Not a place, or no data after the closing tag
+  }
+
+  // A thumbnail already decoded from the same JPEG at this size is reused
+  Thumbnail &thumb = context->pixels;
+  ThumbCache *cache = SharedThumbCache();
+  ThumbCacheKey key = thumb_cache_key(trailer, int(cx));
+  if (cache && cache->lookup(key, context->scratch, &thumb)) {
+    thumb_stats_add(THUMB_COUNTER_CACHE_HITS);
+    timer.lap(THUMB_STAGE_DECODE);
+  } else if (std::shared_ptr<const ThumbPyramid> pyramid =
+                 SharedPyramidCache().lookup(key.hash, key.length);
+             pyramid && thumb_pyramid_fit(*pyramid, int(cx), &thumb)) {
+    // Another size of this place was decoded recently, one resample from
+    // its pyramid replaces the decode
+    thumb_stats_add(THUMB_COUNTER_PYRAMID_HITS);
+    timer.lap(THUMB_STAGE_SCALE);
+    if (cache) {
+      cache->store(key, thumb, context->scratch);
+    }
+    timer.split();
+  } else {
+    // The first request for a JPEG takes the fused decode at cx; most places
+    // are only ever shown at one size. Once the shell comes back for another
+    // size, decode at the scale covering the top of the pyramid instead, so
+    // the rest come from the same decode. Sizes at or above the top build
+    // the pyramid from their own decode right away
+    ThumbPyramidCache &pyramids = SharedPyramidCache();
+    const bool aboveTop = int(cx) >= thumb_mip_top;
+    const bool buildPyramid =
+        aboveTop || pyramids.note_miss(key.hash, key.length);
+    const bool decodeTop = buildPyramid && !aboveTop;
+    const UINT decodeCx = decodeTop ? UINT(thumb_mip_top) : cx;
+
+    // Decode with the built-in decoder, at a DCT scale that still covers cx.
+    // The fused decode resamples the rows to cx as they are decoded.
+    // Progressive and other unusual JPEGs go through WIC instead
+    status = decodeTop ? thumb_jpeg_decode(trailer.data, trailer.length,
+                                           int(decodeCx), &thumb)
+                       : thumb_jpeg_decode_fit(trailer.data, trailer.length,
+                                               int(decodeCx), &thumb);
+    switch (status) {
+    case THUMB_OK:
+      break;
+    case THUMB_UNSUPPORTED:
+    case THUMB_INVALID_THUMB:
+      // WIC was all the handler had before the built-in decoder and is more
+      // forgiving with damaged files, so anything rejected gets a second try
+      hr = DecodeWithWIC(trailer, decodeCx, &thumb);
+      if (FAILED(hr)) {
+        return fail(hr);
+      }
+      // The DCT scale only gets within 2x of cx, resample the rest of the
+      // way so the shell caches exactly what it asked for
+      if (!decodeTop) {
+        thumb_fit_to(&thumb, int(cx));
+      }
+      break;
+    default:
+      return fail(E_FAIL);
+    }
+    timer.lap(THUMB_STAGE_DECODE);
+
+    if (buildPyramid) {
+      // The decoded pixels move into the pyramid, a recycled one hands its
+      // old buffers back, so a full cache builds without allocating
+      std::shared_ptr<ThumbPyramid> pyramid = pyramids.acquire();
+      thumb_pyramid_build(&thumb, pyramid.get());
+      thumb_pyramid_fit(*pyramid, int(cx), &thumb);
+      pyramids.insert(key.hash, key.length, std::move(pyramid));
+    }
+    timer.lap(THUMB_STAGE_SCALE);
+
+    if (cache) {
+      cache->store(key, thumb, context->scratch);
+    }
+    timer.split();
   }
 
-  *phbmp = CreateBitmap(thumb.width, thumb.height, 1, 24, thumb.data.data());
-  if (!*phbmp) {
-    return E_FAIL;
+  // Pack straight into a top-down 32bpp DIB section, the format the shell
+  // keeps in its own cache, so it takes the bitmap without converting it
+  BITMAPINFO bmi = {};
+  bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+  bmi.bmiHeader.biWidth = thumb.width;
+  bmi.bmiHeader.biHeight = -thumb.height;
+  bmi.bmiHeader.biPlanes = 1;
+  bmi.bmiHeader.biBitCount = 32;
+  bmi.bmiHeader.biCompression = BI_RGB;
+  void *bits = nullptr;
+  HBITMAP hbmp =
+      CreateDIBSection(nullptr, &bmi, DIB_RGB_COLORS, &bits, nullptr, 0);
+  if (!hbmp) {
+    return fail(E_OUTOFMEMORY);
   }
-  *pdwAlpha = WTSAT_RGB;
+  thumb_pack_bgra(thumb, static_cast<uint8_t *>(bits),
+                  thumb_bgra_stride(thumb.width));
+  *phbmp = hbmp;
+  *pdwAlpha = WTSAT_ARGB;
+  timer.lap(THUMB_STAGE_OUTPUT);
 
   hr = S_OK;
   return hr;
@@ -4,7 +4,10 @@
 #include <shlwapi.h>
 #include <thumbcache.h> /* For IThumbnailProvider */
 
+#include "thumb_pool.hh"
+
 extern HRESULT CKisekiThumb_CreateInstance(REFIID riid, void **ppv);
+extern void CKisekiThumb_ReleaseFactory();
 
 #define SZ_CLSID_KISEKITHUMBHANDLER L"{8ABA9ABD-829D-4E87-AC2C-4A628AB78236}"
 #define SZ_KISEKITHUMBHANDLER L"Kiseki Thumbnail Handler"
@@ -41,7 +44,16 @@ STDAPI_(BOOL) DllMain(HINSTANCE hInstance, DWORD dwReason, void *) {
 STDAPI DllCanUnloadNow() {
   /* Only allow the DLL to be unloaded after all outstanding references have
    * been released. */
-  return (g_cRefModule == 0) ? S_OK : S_FALSE;
+  if (g_cRefModule != 0) {
+    return S_FALSE;
+  }
+  /* Drop the objects kept for the lifetime of the module while COM is still
+   * usable, which it isn't by the time #DllMain sees the detach. */
+  CKisekiThumb_ReleaseFactory();
+  /* Workers still running when the code they run is unmapped would crash
+   * the host. */
+  thumb_pool_shutdown();
+  return S_OK;
 }
 
 void DllAddRef() { InterlockedIncrement(&g_cRefModule); }
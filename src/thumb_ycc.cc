@@ -0,0 +1,338 @@
+/** \file
+ * YCbCr to BGR row kernels, see thumb_ycc.hh.
+ *
+ * The SIMD kernels compute the chroma offsets with `pmaddwd` in 32 bits,
+ * exactly like the scalar code: constants that don't fit 16 bits are split
+ * over a pair of inputs, e.g. `116130 * cb` as `29032 * 4cb + 2 * cb`. The
+ * offsets are added to luma in 16 bits and clamped by the unsigned pack,
+ * then the three planes are interleaved into BGRX pixels and, for BGR24,
+ * squeezed to three bytes each. Pixels left over at the end of a row go to
+ * the next narrower kernel.
+ */
+
+#include <algorithm>
+
+#include "thumb_cpu.hh"
+#include "thumb_ycc.hh"
+
+static constexpr size_t pixel_size(eThumbPixelFormat format) {
+  return format == THUMB_PIXEL_BGRA32 ? 4 : 3;
+}
+
+/* -------------------------------------------------------------------- */
+/** \name Scalar
+ * \{ */
+
+template<eThumbPixelFormat Dst, int Shift>
+static void ycc_row_scalar(const uint8_t *y, const uint8_t *cb,
+                           const uint8_t *cr, uint8_t *dst, int width) {
+  constexpr size_t px = pixel_size(Dst);
+  for (int x = 0; x < width; x += 1 << Shift) {
+    const ThumbChromaOffsets chroma(cb[x >> Shift], cr[x >> Shift]);
+    const int end = std::min(x + (1 << Shift), width);
+    for (int i = x; i < end; i++) {
+      chroma.put(dst + i * px, y[i]);
+      if constexpr (Dst == THUMB_PIXEL_BGRA32) {
+        dst[i * px + 3] = 0xff;
+      }
+    }
+  }
+}
+
+/** \} */
+
+#ifdef THUMB_X86_64
+
+/* -------------------------------------------------------------------- */
+/** \name SSE2
+ * \{ */
+
+/* The split constants, see the file comment. */
+static constexpr int32_t cb_b_high = thumb_ycc_cb_b >> 2;
+static constexpr int32_t cb_b_low = thumb_ycc_cb_b & 3;
+static constexpr int32_t cr_r_high = thumb_ycc_cr_r >> 2;
+static constexpr int32_t cr_r_low = thumb_ycc_cr_r & 3;
+static constexpr int32_t cr_g_half = thumb_ycc_cr_g / 2;
+static_assert(cb_b_high < 32768 && cr_r_high < 32768 &&
+                  thumb_ycc_cr_g % 2 == 0 && cr_g_half >= -32768,
+              "chroma constants must split into 16-bit pairs");
+
+/** Coefficients of a pmaddwd pair, \a a for the low word. */
+static inline __m128i pair_const(int32_t a, int32_t b) {
+  return _mm_set1_epi32(
+      int32_t(uint32_t(uint16_t(a)) | (uint32_t(uint16_t(b)) << 16)));
+}
+
+namespace {
+
+/** Per channel offsets of eight pixels. */
+struct ChromaVec128 {
+  __m128i b, g, r;
+};
+
+/** Per channel offsets of sixteen pixels. */
+struct ChromaVec256 {
+  __m256i b, g, r;
+};
+
+}  // namespace
+
+/** `(a * k.low + b * k.high + 2^15) >> 16` of eight 16-bit pairs. */
+static inline __m128i madd_round_sse2(__m128i a, __m128i b, __m128i k) {
+  const __m128i round = _mm_set1_epi32(1 << 15);
+  const __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(a, b), k);
+  const __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(a, b), k);
+  return _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(lo, round), 16),
+                         _mm_srai_epi32(_mm_add_epi32(hi, round), 16));
+}
+
+/** Offsets of eight chroma pairs, centered to -128..127 in 16 bits. */
+static inline ChromaVec128 chroma_offsets_sse2(__m128i cb, __m128i cr) {
+  return {madd_round_sse2(_mm_slli_epi16(cb, 2), cb,
+                          pair_const(cb_b_high, cb_b_low)),
+          madd_round_sse2(cb, _mm_slli_epi16(cr, 1),
+                          pair_const(thumb_ycc_cb_g, cr_g_half)),
+          madd_round_sse2(_mm_slli_epi16(cr, 2), cr,
+                          pair_const(cr_r_high, cr_r_low))};
+}
+
+/** Eight chroma samples from \a p, centered. */
+static inline __m128i load_chroma_sse2(const uint8_t *p) {
+  const __m128i bytes =
+      _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p));
+  return _mm_sub_epi16(_mm_unpacklo_epi8(bytes, _mm_setzero_si128()),
+                       _mm_set1_epi16(128));
+}
+
+/** Four BGRX pixels to the low 12 bytes, the rest zeroed. */
+static inline __m128i squeeze_bgr_sse2(__m128i v) {
+  /* Two pixels per 64-bit lane, then the lanes' six bytes together. */
+  const __m128i lanes = _mm_or_si128(
+      _mm_and_si128(v, _mm_set1_epi64x(0xffffff)),
+      _mm_and_si128(_mm_srli_epi64(v, 8), _mm_set1_epi64x(0xffffff000000)));
+  return _mm_or_si128(
+      _mm_and_si128(lanes, _mm_set_epi64x(0, 0xffffffffffff)),
+      _mm_and_si128(_mm_srli_si128(lanes, 2),
+                    _mm_set_epi64x(0xffffffff, int64_t(0xffff000000000000u))));
+}
+
+/** Interleave sixteen pixels from their planes and store them. */
+template<eThumbPixelFormat Dst>
+static inline void store_pixels_sse2(__m128i b, __m128i g, __m128i r,
+                                     uint8_t *dst) {
+  const __m128i alpha = _mm_set1_epi8(-1);
+  const __m128i bg_lo = _mm_unpacklo_epi8(b, g);
+  const __m128i bg_hi = _mm_unpackhi_epi8(b, g);
+  const __m128i ra_lo = _mm_unpacklo_epi8(r, alpha);
+  const __m128i ra_hi = _mm_unpackhi_epi8(r, alpha);
+  const __m128i px[4] = {
+      _mm_unpacklo_epi16(bg_lo, ra_lo), _mm_unpackhi_epi16(bg_lo, ra_lo),
+      _mm_unpacklo_epi16(bg_hi, ra_hi), _mm_unpackhi_epi16(bg_hi, ra_hi)};
+  __m128i *q = reinterpret_cast<__m128i *>(dst);
+  if constexpr (Dst == THUMB_PIXEL_BGRA32) {
+    for (int i = 0; i < 4; i++) {
+      _mm_storeu_si128(q + i, px[i]);
+    }
+  } else {
+    const __m128i a = squeeze_bgr_sse2(px[0]);
+    const __m128i c = squeeze_bgr_sse2(px[1]);
+    const __m128i d = squeeze_bgr_sse2(px[2]);
+    const __m128i e = squeeze_bgr_sse2(px[3]);
+    _mm_storeu_si128(q + 0, _mm_or_si128(a, _mm_slli_si128(c, 12)));
+    _mm_storeu_si128(q + 1,
+                     _mm_or_si128(_mm_srli_si128(c, 4), _mm_slli_si128(d, 8)));
+    _mm_storeu_si128(q + 2,
+                     _mm_or_si128(_mm_srli_si128(d, 8), _mm_slli_si128(e, 4)));
+  }
+}
+
+template<eThumbPixelFormat Dst, int Shift>
+static void ycc_row_sse2(const uint8_t *y, const uint8_t *cb,
+                         const uint8_t *cr, uint8_t *dst, int width) {
+  constexpr size_t px = pixel_size(Dst);
+  const __m128i zero = _mm_setzero_si128();
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    /* Offsets of pixels 0-7 and 8-15. */
+    ChromaVec128 off[2];
+    if constexpr (Shift == 1) {
+      const ChromaVec128 o = chroma_offsets_sse2(
+          load_chroma_sse2(cb + x / 2), load_chroma_sse2(cr + x / 2));
+      off[0] = {_mm_unpacklo_epi16(o.b, o.b), _mm_unpacklo_epi16(o.g, o.g),
+                _mm_unpacklo_epi16(o.r, o.r)};
+      off[1] = {_mm_unpackhi_epi16(o.b, o.b), _mm_unpackhi_epi16(o.g, o.g),
+                _mm_unpackhi_epi16(o.r, o.r)};
+    } else {
+      off[0] = chroma_offsets_sse2(load_chroma_sse2(cb + x),
+                                   load_chroma_sse2(cr + x));
+      off[1] = chroma_offsets_sse2(load_chroma_sse2(cb + x + 8),
+                                   load_chroma_sse2(cr + x + 8));
+    }
+    const __m128i luma =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(y + x));
+    const __m128i y0 = _mm_unpacklo_epi8(luma, zero);
+    const __m128i y1 = _mm_unpackhi_epi8(luma, zero);
+    store_pixels_sse2<Dst>(
+        _mm_packus_epi16(_mm_add_epi16(y0, off[0].b),
+                         _mm_add_epi16(y1, off[1].b)),
+        _mm_packus_epi16(_mm_add_epi16(y0, off[0].g),
+                         _mm_add_epi16(y1, off[1].g)),
+        _mm_packus_epi16(_mm_add_epi16(y0, off[0].r),
+                         _mm_add_epi16(y1, off[1].r)),
+        dst + x * px);
+  }
+  ycc_row_scalar<Dst, Shift>(y + x, cb + (x >> Shift), cr + (x >> Shift),
+                             dst + x * px, width - x);
+}
+
+/** \} */
+
+/* -------------------------------------------------------------------- */
+/** \name AVX2
+ * \{ */
+
+THUMB_TARGET_AVX2
+static inline __m256i madd_round_avx2(__m256i a, __m256i b, __m128i k) {
+  const __m256i pair = _mm256_broadcastsi128_si256(k);
+  const __m256i round = _mm256_set1_epi32(1 << 15);
+  /* Unpacking and packing within lanes undo each other's order. */
+  const __m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), pair);
+  const __m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), pair);
+  return _mm256_packs_epi32(
+      _mm256_srai_epi32(_mm256_add_epi32(lo, round), 16),
+      _mm256_srai_epi32(_mm256_add_epi32(hi, round), 16));
+}
+
+THUMB_TARGET_AVX2
+static inline ChromaVec256 chroma_offsets_avx2(__m256i cb, __m256i cr) {
+  return {madd_round_avx2(_mm256_slli_epi16(cb, 2), cb,
+                          pair_const(cb_b_high, cb_b_low)),
+          madd_round_avx2(cb, _mm256_slli_epi16(cr, 1),
+                          pair_const(thumb_ycc_cb_g, cr_g_half)),
+          madd_round_avx2(_mm256_slli_epi16(cr, 2), cr,
+                          pair_const(cr_r_high, cr_r_low))};
+}
+
+/** Sixteen 8-bit samples from \a p in 16 bits, minus \a center. */
+THUMB_TARGET_AVX2
+static inline __m256i load_wide_avx2(const uint8_t *p, int center) {
+  return _mm256_sub_epi16(
+      _mm256_cvtepu8_epi16(
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(p))),
+      _mm256_set1_epi16(int16_t(center)));
+}
+
+/**
+ * Interleave 32 pixels and store them. The planes come from packing pixels
+ * 0-15 with 16-31, so their lanes hold pixels 0-7 and 16-23, then 8-15 and
+ * 24-31.
+ */
+template<eThumbPixelFormat Dst>
+THUMB_TARGET_AVX2 static inline void store_pixels_avx2(__m256i b, __m256i g,
+                                                       __m256i r,
+                                                       uint8_t *dst) {
+  const __m256i alpha = _mm256_set1_epi8(-1);
+  const __m256i bg_lo = _mm256_unpacklo_epi8(b, g);
+  const __m256i bg_hi = _mm256_unpackhi_epi8(b, g);
+  const __m256i ra_lo = _mm256_unpacklo_epi8(r, alpha);
+  const __m256i ra_hi = _mm256_unpackhi_epi8(r, alpha);
+  const __m256i p0 = _mm256_unpacklo_epi16(bg_lo, ra_lo);
+  const __m256i p1 = _mm256_unpackhi_epi16(bg_lo, ra_lo);
+  const __m256i p2 = _mm256_unpacklo_epi16(bg_hi, ra_hi);
+  const __m256i p3 = _mm256_unpackhi_epi16(bg_hi, ra_hi);
+  /* Eight pixels each, in order. */
+  const __m256i px[4] = {_mm256_permute2x128_si256(p0, p1, 0x20),
+                         _mm256_permute2x128_si256(p0, p1, 0x31),
+                         _mm256_permute2x128_si256(p2, p3, 0x20),
+                         _mm256_permute2x128_si256(p2, p3, 0x31)};
+  if constexpr (Dst == THUMB_PIXEL_BGRA32) {
+    for (int i = 0; i < 4; i++) {
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i * 32), px[i]);
+    }
+  } else {
+    const __m256i shuffle = _mm256_broadcastsi128_si256(_mm_setr_epi8(
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1));
+    const __m256i compact = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+    for (int i = 0; i < 4; i++) {
+      const __m256i bgr = _mm256_permutevar8x32_epi32(
+          _mm256_shuffle_epi8(px[i], shuffle), compact);
+      uint8_t *q = dst + i * 24;
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(q),
+                       _mm256_castsi256_si128(bgr));
+      _mm_storel_epi64(reinterpret_cast<__m128i *>(q + 16),
+                       _mm256_extracti128_si256(bgr, 1));
+    }
+  }
+}
+
+template<eThumbPixelFormat Dst, int Shift>
+THUMB_TARGET_AVX2 static void ycc_row_avx2(const uint8_t *y, const uint8_t *cb,
+                                           const uint8_t *cr, uint8_t *dst,
+                                           int width) {
+  constexpr size_t px = pixel_size(Dst);
+  int x = 0;
+  for (; x + 32 <= width; x += 32) {
+    /* Offsets of pixels 0-15 and 16-31. */
+    ChromaVec256 off[2];
+    if constexpr (Shift == 1) {
+      const ChromaVec256 o = chroma_offsets_avx2(
+          load_wide_avx2(cb + x / 2, 128), load_wide_avx2(cr + x / 2, 128));
+      /* Doubling within lanes gives pixels 0-7 and 16-23, then 8-15 and
+       * 24-31. */
+      const __m256i b_lo = _mm256_unpacklo_epi16(o.b, o.b);
+      const __m256i b_hi = _mm256_unpackhi_epi16(o.b, o.b);
+      const __m256i g_lo = _mm256_unpacklo_epi16(o.g, o.g);
+      const __m256i g_hi = _mm256_unpackhi_epi16(o.g, o.g);
+      const __m256i r_lo = _mm256_unpacklo_epi16(o.r, o.r);
+      const __m256i r_hi = _mm256_unpackhi_epi16(o.r, o.r);
+      off[0] = {_mm256_permute2x128_si256(b_lo, b_hi, 0x20),
+                _mm256_permute2x128_si256(g_lo, g_hi, 0x20),
+                _mm256_permute2x128_si256(r_lo, r_hi, 0x20)};
+      off[1] = {_mm256_permute2x128_si256(b_lo, b_hi, 0x31),
+                _mm256_permute2x128_si256(g_lo, g_hi, 0x31),
+                _mm256_permute2x128_si256(r_lo, r_hi, 0x31)};
+    } else {
+      off[0] = chroma_offsets_avx2(load_wide_avx2(cb + x, 128),
+                                   load_wide_avx2(cr + x, 128));
+      off[1] = chroma_offsets_avx2(load_wide_avx2(cb + x + 16, 128),
+                                   load_wide_avx2(cr + x + 16, 128));
+    }
+    const __m256i y0 = load_wide_avx2(y + x, 0);
+    const __m256i y1 = load_wide_avx2(y + x + 16, 0);
+    store_pixels_avx2<Dst>(
+        _mm256_packus_epi16(_mm256_add_epi16(y0, off[0].b),
+                            _mm256_add_epi16(y1, off[1].b)),
+        _mm256_packus_epi16(_mm256_add_epi16(y0, off[0].g),
+                            _mm256_add_epi16(y1, off[1].g)),
+        _mm256_packus_epi16(_mm256_add_epi16(y0, off[0].r),
+                            _mm256_add_epi16(y1, off[1].r)),
+        dst + x * px);
+  }
+  _mm256_zeroupper();
+  ycc_row_sse2<Dst, Shift>(y + x, cb + (x >> Shift), cr + (x >> Shift),
+                           dst + x * px, width - x);
+}
+
+/** \} */
+
+#endif
+
+template<eThumbPixelFormat Dst, int Shift> static ThumbYccRowFn select_row() {
+#ifdef THUMB_X86_64
+  const eThumbSimdLevel simd = thumb_simd_level();
+  if (simd >= THUMB_SIMD_AVX2) {
+    return ycc_row_avx2<Dst, Shift>;
+  }
+  if (simd >= THUMB_SIMD_SSE2) {
+    return ycc_row_sse2<Dst, Shift>;
+  }
+#endif
+  return ycc_row_scalar<Dst, Shift>;
+}
+
+template<eThumbPixelFormat Dst> ThumbYccRowFn thumb_ycc_row(int chroma_shift) {
+  return chroma_shift ? select_row<Dst, 1>() : select_row<Dst, 0>();
+}
+
+template ThumbYccRowFn thumb_ycc_row<THUMB_PIXEL_BGR24>(int);
+template ThumbYccRowFn thumb_ycc_row<THUMB_PIXEL_BGRA32>(int);
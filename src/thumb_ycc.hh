@@ -0,0 +1,57 @@
+/** \file
+ * YCbCr to BGR conversion of the JPEG decoder's sample rows.
+ *
+ * A row kernel takes one row each of luma and chroma samples and writes a
+ * row of #THUMB_PIXEL_BGR24 or #THUMB_PIXEL_BGRA32 pixels. Chroma is either
+ * at full resolution (4:4:4) or at half the horizontal resolution (4:2:0
+ * and 4:2:2, whose vertical subsampling is the caller's choice of row), and
+ * is replicated up to the luma resolution. There are SSE2 and AVX2 kernels
+ * next to the scalar ones, picked by #thumb_simd_level and matching them
+ * bit for bit.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "thumb_pack.hh"
+
+/* JFIF YCbCr to RGB in 16-bit fixed point. */
+static constexpr int32_t thumb_ycc_cr_r = 91881;  /* 1.402 */
+static constexpr int32_t thumb_ycc_cb_g = -22554; /* -0.344136 */
+static constexpr int32_t thumb_ycc_cr_g = -46802; /* -0.714136 */
+static constexpr int32_t thumb_ycc_cb_b = 116130; /* 1.772 */
+
+/** What one chroma pair adds to the luma of each channel. */
+struct ThumbChromaOffsets {
+  int32_t b, g, r;
+
+  ThumbChromaOffsets(int32_t cb, int32_t cr) {
+    constexpr int32_t round = 1 << 15;
+    cb -= 128;
+    cr -= 128;
+    b = (thumb_ycc_cb_b * cb + round) >> 16;
+    g = (thumb_ycc_cb_g * cb + thumb_ycc_cr_g * cr + round) >> 16;
+    r = (thumb_ycc_cr_r * cr + round) >> 16;
+  }
+
+  void put(uint8_t *out, int32_t luma) const {
+    out[0] = clamp(luma + b);
+    out[1] = clamp(luma + g);
+    out[2] = clamp(luma + r);
+  }
+
+private:
+  static uint8_t clamp(int32_t x) {
+    return uint8_t(x < 0 ? 0 : (x > 255 ? 255 : x));
+  }
+};
+
+using ThumbYccRowFn = void (*)(const uint8_t *y, const uint8_t *cb,
+                               const uint8_t *cr, uint8_t *dst, int width);
+
+/**
+ * Row kernel writing \a Dst pixels, for chroma subsampled horizontally by
+ * `1 << chroma_shift`, where \a chroma_shift is 0 or 1.
+ */
+template<eThumbPixelFormat Dst> ThumbYccRowFn thumb_ycc_row(int chroma_shift);
@@ -0,0 +1,35 @@
+/** \file
+ * Shared helpers for the checks in `Kiseki.ThumbnailTest`.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "test_source.hh"
+#include "thumb.hh"
+
+/** Record a failed check; the run exits non-zero once all suites are done. */
+void test_fail(const char *file, int line, const char *expr);
+
+#define TEST_CHECK(expr) \
+  ((expr) ? (void)0 : test_fail(__FILE__, __LINE__, #expr))
+
+/**
+ * `<roblox>`, \a xml_size bytes of filler, the closing tag and the NUL that
+ * separates it from \a trailer.
+ */
+std::vector<uint8_t> test_place(size_t xml_size,
+                                const std::vector<uint8_t> &trailer);
+
+/** \a size bytes starting with the JPEG SOI marker. */
+std::vector<uint8_t> test_trailer(size_t size);
+
+/** \name Suites
+ * \{ */
+
+void test_tail();
+
+/** \} */
@@ -0,0 +1,74 @@
+/** \file
+ * `Kiseki.ThumbnailTest [suite...]` runs the named suites, or all of them,
+ * and exits non-zero if any check failed. Each suite is registered with
+ * CTest on its own.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "test.hh"
+
+struct TestSuite {
+  const char *name;
+  void (*run)();
+};
+
+static const TestSuite suites[] = {
+    {"tail", test_tail},
+};
+
+static int failures = 0;
+
+void test_fail(const char *file, int line, const char *expr) {
+  fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+  failures++;
+}
+
+std::vector<uint8_t> test_place(size_t xml_size,
+                                const std::vector<uint8_t> &trailer) {
+  static const char header[] = "<roblox version=\"4\">";
+  static const char end_tag[] = "</roblox>";
+  std::vector<uint8_t> place(header, header + sizeof(header) - 1);
+  for (size_t i = 0; i < xml_size; i++) {
+    place.push_back(uint8_t("<Item class=\"Part\"/>\n"[i % 21]));
+  }
+  /* sizeof includes the NUL that separates the tag from the JPEG. */
+  place.insert(place.end(), end_tag, end_tag + sizeof(end_tag));
+  place.insert(place.end(), trailer.begin(), trailer.end());
+  return place;
+}
+
+std::vector<uint8_t> test_trailer(size_t size) {
+  std::vector<uint8_t> trailer(size);
+  for (size_t i = 0; i < size; i++) {
+    trailer[i] = uint8_t(i * 31 + 7);
+  }
+  trailer[0] = 0xff;
+  trailer[1] = 0xd8;
+  return trailer;
+}
+
+int main(int argc, char *argv[]) {
+  bool ran = false;
+  for (const TestSuite &suite : suites) {
+    bool run = argc == 1;
+    for (int i = 1; i < argc; i++) {
+      run |= strcmp(argv[i], suite.name) == 0;
+    }
+    if (run) {
+      suite.run();
+      ran = true;
+    }
+  }
+  if (!ran) {
+    fprintf(stderr, "Usage: %s [suite...]\nSuites:", argv[0]);
+    for (const TestSuite &suite : suites) {
+      fprintf(stderr, " %s", suite.name);
+    }
+    fprintf(stderr, "\n");
+    return 1;
+  }
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,33 @@
+/** \file
+ * In-memory stand-in source, see test_source.hh.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "test_source.hh"
+
+int64_t TestSource::size() {
+  return _mode == TEST_SOURCE_FILE ? int64_t(_data.size()) : -1;
+}
+
+int64_t TestSource::size_hint() {
+  return _mode == TEST_SOURCE_PIPE ? -1 : int64_t(_data.size());
+}
+
+int64_t TestSource::read_at(uint64_t offset, void *buffer, size_t len) {
+  if (_mode != TEST_SOURCE_FILE || offset > _data.size()) {
+    return -1;
+  }
+  _pos = offset;
+  return read(buffer, len);
+}
+
+int64_t TestSource::read(void *buffer, size_t len) {
+  size_t n = std::min({len, _max_read, size_t(_data.size() - _pos)});
+  memcpy(buffer, _data.data() + _pos, n);
+  _pos += n;
+  read_calls++;
+  bytes_read += n;
+  return int64_t(n);
+}
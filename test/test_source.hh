@@ -0,0 +1,49 @@
+/** \file
+ * In-memory #ThumbSource standing in for files and shell streams, shared by
+ * `Kiseki.ThumbnailTest` and `Kiseki.ThumbnailBench`.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "thumb.hh"
+
+enum eTestSourceMode {
+  /** Seekable with a known size, like a file. */
+  TEST_SOURCE_FILE,
+  /** Sequential but reports its size, like some shell streams. */
+  TEST_SOURCE_SIZED_STREAM,
+  /** Sequential with unknown size, like a pipe. */
+  TEST_SOURCE_PIPE,
+};
+
+/**
+ * A place held in memory. A seekable source reports its size and serves
+ * #read_at, like a file or a shell IStream that can Stat and Seek; the others
+ * report -1 and are read front to back. Calls and bytes are counted, so
+ * checks can tell how much of the place was touched, and every read is
+ * capped at \a max_read bytes like stream implementations tend to do.
+ */
+class TestSource : public ThumbSource {
+public:
+  TestSource(const std::vector<uint8_t> &data, eTestSourceMode mode,
+             size_t max_read = SIZE_MAX)
+      : _data(data), _mode(mode), _max_read(max_read) {}
+
+  int64_t size() override;
+  int64_t size_hint() override;
+  int64_t read_at(uint64_t offset, void *buffer, size_t len) override;
+  int64_t read(void *buffer, size_t len) override;
+
+  uint64_t read_calls = 0;
+  uint64_t bytes_read = 0;
+
+private:
+  const std::vector<uint8_t> &_data;
+  eTestSourceMode _mode;
+  size_t _max_read;
+  uint64_t _pos = 0;
+};
@@ -0,0 +1,169 @@
+/** \file
+ * #thumb_read_trailer over seekable and sequential stand-in streams.
+ *
+ * Seekable streams must be answered from the tail window, touching only a
+ * small part of a large place, and both kinds of stream must find the same
+ * JPEG. The closing tag is also moved across the seam of the first window,
+ * and repeated, in which case the last one counts.
+ */
+
+#include <cstring>
+#include <string>
+
+#include "test.hh"
+
+/* Matches the first window in `thumb_extract.cc`. */
+static constexpr size_t tail_window = 256 * 1024;
+
+static bool found_trailer(eThumbStatus status, const ThumbTrailer &found,
+                          const std::vector<uint8_t> &place,
+                          const std::vector<uint8_t> &trailer) {
+  const size_t offset = place.size() - trailer.size();
+  return status == THUMB_OK && found.length == trailer.size() &&
+         found.file_offset == offset &&
+         memcmp(found.data, trailer.data(), trailer.size()) == 0;
+}
+
+/** Read \a place both ways and check that each finds \a trailer. */
+static void check_both(const std::vector<uint8_t> &place,
+                       const std::vector<uint8_t> &trailer) {
+  ThumbBuffer buffer;
+  for (eTestSourceMode mode : {TEST_SOURCE_FILE, TEST_SOURCE_PIPE}) {
+    TestSource stream(place, mode);
+    ThumbTrailer found = {};
+    eThumbStatus status = thumb_read_trailer(&stream, buffer, &found);
+    TEST_CHECK(found_trailer(status, found, place, trailer));
+  }
+}
+
+static void check_tail_reads() {
+  std::vector<uint8_t> trailer = test_trailer(4096);
+  std::vector<uint8_t> place = test_place(size_t(4) << 20, trailer);
+  TestSource stream(place, TEST_SOURCE_FILE);
+  ThumbBuffer buffer;
+  ThumbTrailer found = {};
+  eThumbStatus status = thumb_read_trailer(&stream, buffer, &found);
+  TEST_CHECK(found_trailer(status, found, place, trailer));
+  /* The header check and a single window. */
+  TEST_CHECK(stream.read_calls == 2);
+  TEST_CHECK(stream.bytes_read <= tail_window + 8);
+  check_both(place, trailer);
+}
+
+static void check_widening() {
+  /* Needs two more rounds past the first window. */
+  std::vector<uint8_t> trailer = test_trailer(3 * tail_window);
+  std::vector<uint8_t> place = test_place(size_t(4) << 20, trailer);
+  TestSource stream(place, TEST_SOURCE_FILE);
+  ThumbBuffer buffer;
+  ThumbTrailer found = {};
+  eThumbStatus status = thumb_read_trailer(&stream, buffer, &found);
+  TEST_CHECK(found_trailer(status, found, place, trailer));
+  TEST_CHECK(stream.bytes_read < place.size() / 2);
+  check_both(place, trailer);
+}
+
+static void check_window_seam() {
+  /* Moves the tag and the NUL after it one byte at a time across the start
+   * of the first window. */
+  for (size_t size = tail_window - 12; size <= tail_window + 2; size++) {
+    std::vector<uint8_t> trailer = test_trailer(size);
+    check_both(test_place(size_t(1) << 20, trailer), trailer);
+  }
+}
+
+static void check_repeated_tags() {
+  /* Literal tags in the XML, one straddling the end of the first 64 KB
+   * sequential read. The JPEG follows the last tag. */
+  std::vector<uint8_t> trailer = test_trailer(4096);
+  std::vector<uint8_t> place = test_place(size_t(1) << 17, trailer);
+  for (size_t at : {size_t(100), size_t(65536 - 4)}) {
+    memcpy(place.data() + at, "</roblox>", 9);
+  }
+  check_both(place, trailer);
+
+  /* A byte at a time, so every tag lands on a seam, including the ones the
+   * extractor only meets after it has started on a JPEG. */
+  ThumbBuffer buffer;
+  ThumbStreamExtractor extractor(buffer);
+  for (uint8_t byte : place) {
+    TEST_CHECK(extractor.push(&byte, 1) == THUMB_OK);
+  }
+  ThumbTrailer found = {};
+  TEST_CHECK(found_trailer(extractor.finish(&found), found, place, trailer));
+}
+
+static void check_split_after_tag() {
+  /* A script holding the closing tag in CDATA, with the stream cut right
+   * after that tag, and right after the NUL a real tag would have behind
+   * it. What the next piece brings in after the cut still has the last
+   * tag. */
+  static const char head[] =
+      "<roblox version=\"4\"><Item class=\"Script\"><ProtectedString "
+      "name=\"Source\"><![CDATA[x = \"</roblox>";
+  static const char tail[] =
+      "\"]]></ProtectedString></Item>\n</roblox>";
+  std::vector<uint8_t> trailer = test_trailer(4096);
+  /* The tail's NUL is the one between the tag and the JPEG. */
+  const std::string xml = std::string(head) + tail + '\0';
+  std::vector<uint8_t> place(xml.begin(), xml.end());
+  place.insert(place.end(), trailer.begin(), trailer.end());
+  check_both(place, trailer);
+
+  ThumbBuffer buffer;
+  for (size_t cut : {sizeof(head) - 1, sizeof(head)}) {
+    ThumbStreamExtractor extractor(buffer);
+    TEST_CHECK(extractor.push(place.data(), cut) == THUMB_OK);
+    TEST_CHECK(extractor.push(place.data() + cut, place.size() - cut) ==
+               THUMB_OK);
+    ThumbTrailer found = {};
+    TEST_CHECK(found_trailer(extractor.finish(&found), found, place, trailer));
+  }
+}
+
+static void check_rejects() {
+  ThumbBuffer buffer;
+  ThumbTrailer found = {};
+
+  /* Not a place: only the header is read. */
+  std::vector<uint8_t> html(size_t(1) << 20, ' ');
+  memcpy(html.data(), "<html>", 6);
+  TestSource html_stream(html, TEST_SOURCE_FILE);
+  TEST_CHECK(thumb_read_trailer(&html_stream, buffer, &found) ==
+             THUMB_INVALID_FILE);
+  TEST_CHECK(html_stream.read_calls == 1);
+
+  /* Shorter than the header, nothing failed to read. */
+  const std::vector<uint8_t> tiny = {'<', 'r', 'o', 'b'};
+  for (eTestSourceMode mode : {TEST_SOURCE_FILE, TEST_SOURCE_PIPE}) {
+    TestSource stream(tiny, mode);
+    TEST_CHECK(thumb_read_trailer(&stream, buffer, &found) ==
+               THUMB_INVALID_FILE);
+  }
+
+  /* No closing tag anywhere. */
+  std::vector<uint8_t> open = test_place(size_t(1) << 20, {});
+  open.resize(open.size() - 10);
+  for (eTestSourceMode mode : {TEST_SOURCE_FILE, TEST_SOURCE_PIPE}) {
+    TestSource stream(open, mode);
+    TEST_CHECK(thumb_read_trailer(&stream, buffer, &found) ==
+               THUMB_INVALID_FILE);
+  }
+
+  /* The tag and its NUL with nothing after them. */
+  std::vector<uint8_t> empty = test_place(4096, {});
+  for (eTestSourceMode mode : {TEST_SOURCE_FILE, TEST_SOURCE_PIPE}) {
+    TestSource stream(empty, mode);
+    TEST_CHECK(thumb_read_trailer(&stream, buffer, &found) ==
+               THUMB_INVALID_THUMB);
+  }
+}
+
+void test_tail() {
+  check_tail_reads();
+  check_widening();
+  check_window_seam();
+  check_repeated_tags();
+  check_split_after_tag();
+  check_rejects();
+}